@@ -11,24 +11,71 @@
  */
 #include "postgres.h"
 
+#include "access/heapam.h"
 #include "access/htup_details.h"
+#include "catalog/index.h"
 #include "catalog/indexing.h"
 #include "catalog/pg_class.h"
 #include "catalog/pg_type.h"
 #include "executor/spi.h"
 #include "funcapi.h"
 #include "miscadmin.h"
+#include "pgstat.h"
 #include "storage/shmem.h"
 #include "storage/smgr.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/fmgroids.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
 #include "utils/relfilenodemap.h"
 #include "utils/syscache.h"
 
 #include "activetable.h"
+#include "capture.h"
+#include "fswatch.h"
 #include "pg_utils.h"
 
+#ifdef DISKQUOTA_NO_CORE_HOOKS
+#define DEFAULT_ACTIVE_TABLE_DETECTOR ACTIVE_TABLE_DETECTOR_INOTIFY
+#else
+#define DEFAULT_ACTIVE_TABLE_DETECTOR ACTIVE_TABLE_DETECTOR_HOOKS
+#endif
+
 HTAB *active_tables_map = NULL;
+
+/* table oid of an active relfilenode, InvalidOid if not found */
+typedef struct ResolvedRelFileNode
+{
+	RelFileNode node;
+	Oid			reloid;
+} ResolvedRelFileNode;
+
+/* GUC variables */
+int			diskquota_active_table_detector = DEFAULT_ACTIVE_TABLE_DETECTOR;
+
+static const struct config_enum_entry active_table_detector_options[] = {
+	{"hooks", ACTIVE_TABLE_DETECTOR_HOOKS, false},
+	{"inotify", ACTIVE_TABLE_DETECTOR_INOTIFY, false},
+	{"pgstat", ACTIVE_TABLE_DETECTOR_PGSTAT, false},
+	{NULL, 0, false}
+};
+
+/* write counters of a table in pgstat at last refresh, for the pgstat detector */
+typedef struct PgStatCountersEntry
+{
+	Oid			reloid;
+	int64		changes;		/* sum of the write and maintenance counters */
+	uint64		generation;		/* last refresh the table is seen in pgstat */
+} PgStatCountersEntry;
+
+static HTAB *pgstat_counters_map = NULL;
+static uint64 pgstat_generation = 0;
+/* set after track_counts is found off, to warn only once */
+static bool pgstat_track_counts_warned = false;
+
+#ifndef DISKQUOTA_NO_CORE_HOOKS
 static smgrcreate_hook_type prev_smgrcreate_hook = NULL;
 static smgrextend_hook_type prev_smgrextend_hook = NULL;
 static smgrtruncate_hook_type prev_smgrtruncate_hook = NULL;
@@ -47,10 +94,17 @@ static void active_table_hook_smgrtruncate(SMgrRelation reln,
 static void active_table_hook_smgrunlink(SMgrRelation *reln,
                               int nrels,
                               bool isRedo);
-
 static void report_active_table_SmgrStat(SMgrRelation reln, ActiveType at);
+#endif
+
+static bool check_active_table_detector(int *newval, void **extra, GucSource source);
 static HTAB* get_active_tables_stats(void);
+static HTAB *resolve_active_relfilenodes(HTAB *local_active_table_file_map);
 static HTAB* get_all_tables_stats(void);
+static List *get_pgstat_changed_tables(void);
+static HTAB *get_pgstat_tables_stats(List *changed);
+static Oid	get_pgstat_owning_table(Oid relOid, List **toasts);
+static List *get_toast_owning_tables(List *toasts);
 
 void init_active_table_hook(void);
 void init_shm_worker_active_tables(void);
@@ -58,11 +112,29 @@ void init_lock_active_tables(void);
 HTAB* pg_fetch_active_tables(bool);
 
 /*
- * Register smgr hook to detect active table.
+ * Define the detector of active tables, and register smgr hook to detect
+ * active table if the hooks are used.
  */
 void
 init_active_table_hook(void)
 {
+	DefineCustomEnumVariable("diskquota.active_table_detector",
+							 "Engine detecting active tables, hooks, inotify or pgstat.",
+							 "inotify and pgstat run in diskquota worker, "
+							 "and do not need the smgr hooks patch.",
+							 &diskquota_active_table_detector,
+							 DEFAULT_ACTIVE_TABLE_DETECTOR,
+							 active_table_detector_options,
+							 PGC_POSTMASTER,
+							 0,
+							 check_active_table_detector,
+							 NULL,
+							 NULL);
+
+	if (diskquota_active_table_detector != ACTIVE_TABLE_DETECTOR_HOOKS)
+		return;
+
+#ifndef DISKQUOTA_NO_CORE_HOOKS
 	prev_smgrcreate_hook = smgrcreate_hook;
 	smgrcreate_hook = active_table_hook_smgrcreate;
 
@@ -74,31 +146,51 @@ init_active_table_hook(void)
 
 	prev_smgrdounlinkall_hook = smgrdounlinkall_hook;
 	smgrdounlinkall_hook = active_table_hook_smgrunlink;
+#endif
 }
 
+static bool
+check_active_table_detector(int *newval, pg_attribute_unused() void **extra,
+							pg_attribute_unused() GucSource source)
+{
+#ifdef DISKQUOTA_NO_CORE_HOOKS
+	if (*newval == ACTIVE_TABLE_DETECTOR_HOOKS)
+	{
+		GUC_check_errdetail("diskquota is built without the smgr hooks patch.");
+		return false;
+	}
+#endif
+	return true;
+}
+
+#ifndef DISKQUOTA_NO_CORE_HOOKS
+
 static void
 active_table_hook_smgrcreate(SMgrRelation reln,
-							  pg_attribute_unused() ForkNumber forknum,
+							  ForkNumber forknum,
 							  pg_attribute_unused() bool isRedo)
 {
+	capture_smgr_event(reln, forknum, 0, AT_CREATE);
 	report_active_table_SmgrStat(reln, AT_CREATE);
 }
 
 static void
 active_table_hook_smgrextend(SMgrRelation reln,
-							  pg_attribute_unused() ForkNumber forknum,
-							  pg_attribute_unused() BlockNumber blocknum,
+							  ForkNumber forknum,
+							  BlockNumber blocknum,
 							  pg_attribute_unused() char *buffer,
 							  pg_attribute_unused() bool skipFsync)
 {
+	capture_smgr_event(reln, forknum, blocknum, AT_EXTEND);
 	report_active_table_SmgrStat(reln, AT_EXTEND);
 }
 
 static void
 active_table_hook_smgrtruncate(SMgrRelation reln,
-							  pg_attribute_unused() ForkNumber forknum,
-							  pg_attribute_unused() BlockNumber blocknum)
+							  ForkNumber forknum,
+							  BlockNumber blocknum)
 {
+	capture_smgr_event(reln, forknum, blocknum, AT_TRUNCATE);
 	report_active_table_SmgrStat(reln, AT_TRUNCATE);
 }
 
@@ -109,9 +201,11 @@ static void active_table_hook_smgrunlink(SMgrRelation *reln,
 	int i;
 	for (i = 0; i < nrels; i++)
 	{
+		capture_smgr_event(reln[i], InvalidForkNumber, 0, AT_UNLINK);
 		report_active_table_SmgrStat(reln[i], AT_UNLINK);
 	}
 }
+#endif
 
 /*
  * Init active_tables_map shared memory
@@ -139,6 +233,21 @@ init_shm_worker_active_tables(void)
  */
 HTAB* pg_fetch_active_tables(bool force)
 {
+	if (diskquota_active_table_detector == ACTIVE_TABLE_DETECTOR_PGSTAT)
+	{
+		/* counters are always compared, so that the next refresh sees only new changes */
+		List	   *changed = get_pgstat_changed_tables();
+
+		if (force)
+			return get_all_tables_stats();
+		return get_pgstat_tables_stats(changed);
+	}
+
+	/* re-measure all the tables if inotify events may have been lost */
+	if (diskquota_active_table_detector == ACTIVE_TABLE_DETECTOR_INOTIFY &&
+		fswatch_refresh_watches())
+		force = true;
+
 	if (force)
 	{
 		return get_all_tables_stats();
@@ -160,6 +269,7 @@ get_all_tables_stats()
 	HeapTuple tuple;
 	Relation classRel;
 	HeapScanDesc relScan;
+	RelationSizeBatch size_batch;
 
 	memset(&ctl, 0, sizeof(ctl));
 	ctl.keysize = sizeof(RelFileNode);
@@ -174,6 +284,11 @@ get_all_tables_stats()
 	
 	classRel = heap_open(RelationRelationId, AccessShareLock);
     relScan = heap_beginscan_catalog(classRel, 0, NULL);
+	size_batch_init(&size_batch);
+
+	/* all the tables are measured, the events found by inotify are not needed */
+	if (diskquota_active_table_detector == ACTIVE_TABLE_DETECTOR_INOTIFY)
+		fswatch_move_events(NULL);
 
 	while ((tuple = heap_getnext(relScan, ForwardScanDirection)) != NULL)
 	{
@@ -209,16 +324,259 @@ get_all_tables_stats()
 		entry = (DiskQuotaActiveTableEntry *) hash_search(local_table_stats_map, &node, HASH_ENTER, NULL);
 
 		entry->node = node;
+		entry->reloid = relOid;
+		entry->namespace = classForm->relnamespace;
+		entry->owner = classForm->relowner;
 		entry->type = AT_EXTEND;
-		entry->tablesize = diskquota_get_table_size_by_oid(relOid);
+		entry->tablesize = 0;
+		size_batch_add_relation(&size_batch, relOid, &entry->tablesize);
 
 	}
 
 	heap_endscan(relScan);
 	heap_close(classRel, AccessShareLock);
 
+	/* probe the file size of all the tables in one batch */
+	size_batch_execute(&size_batch);
+
     return local_table_stats_map;	
 }
+/*
+ * Get the tables whose write counters in pgstat are changed since last
+ * refresh, for the pgstat detector.  Inserted, updated and deleted tuples
+ * and vacuum and analyze counts are compared, since they are what changes
+ * the size of a table without a table rewrite.  A rewrite gets a new
+ * relfilenode, which is re-measured by calculate_table_disk_usage().
+ *
+ * Counters are only reported by backends at the end of transaction, so
+ * the size change in a running transaction is not seen until it commits.
+ */
+static List *
+get_pgstat_changed_tables(void)
+{
+	PgStat_StatDBEntry *dbentry;
+	PgStat_StatTabEntry *tabentry;
+	PgStatCountersEntry *entry;
+	HASH_SEQ_STATUS iter;
+	List	   *changed = NIL;
+	bool		found;
+
+	if (pgstat_counters_map == NULL)
+	{
+		HASHCTL		ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(Oid);
+		ctl.entrysize = sizeof(PgStatCountersEntry);
+		ctl.hcxt = TopMemoryContext;
+		pgstat_counters_map = hash_create("pgstat counters of tables",
+										  1024,
+										  &ctl,
+										  HASH_ELEM | HASH_CONTEXT | HASH_BLOBS);
+	}
+
+	if (!pgstat_track_counts)
+	{
+		if (!pgstat_track_counts_warned)
+			ereport(WARNING,
+					(errmsg("[diskquota] track_counts is off, active tables could not be detected by pgstat")));
+		pgstat_track_counts_warned = true;
+	}
+	else
+		pgstat_track_counts_warned = false;
+
+	/* read the latest stats file instead of the snapshot of this transaction */
+	pgstat_clear_snapshot();
+	dbentry = pgstat_fetch_stat_dbentry(MyDatabaseId);
+	if (dbentry == NULL || dbentry->tables == NULL)
+		return NIL;
+
+	pgstat_generation++;
+	hash_seq_init(&iter, dbentry->tables);
+	while ((tabentry = (PgStat_StatTabEntry *) hash_seq_search(&iter)) != NULL)
+	{
+		int64		changes;
+
+		/* ignore system table */
+		if (tabentry->tableid < FirstNormalObjectId)
+			continue;
+
+		changes = tabentry->tuples_inserted + tabentry->tuples_updated +
+			tabentry->tuples_deleted + tabentry->vacuum_count +
+			tabentry->autovac_vacuum_count + tabentry->analyze_count +
+			tabentry->autovac_analyze_count;
+
+		entry = hash_search(pgstat_counters_map, &tabentry->tableid, HASH_ENTER, &found);
+		if (!found || entry->changes != changes)
+			changed = lappend_oid(changed, tabentry->tableid);
+		entry->changes = changes;
+		entry->generation = pgstat_generation;
+	}
+
+	/* forget the tables removed from pgstat */
+	hash_seq_init(&iter, pgstat_counters_map);
+	while ((entry = (PgStatCountersEntry *) hash_seq_search(&iter)) != NULL)
+	{
+		if (entry->generation != pgstat_generation)
+			hash_search(pgstat_counters_map, &entry->reloid, HASH_REMOVE, NULL);
+	}
+
+	return changed;
+}
+
+/*
+ * Return the table an index belongs to, or the relation itself, InvalidOid
+ * if it is dropped.  A toast table, or an index of it, is appended to
+ * toasts instead, see get_toast_owning_tables().
+ */
+static Oid
+get_pgstat_owning_table(Oid relOid, List **toasts)
+{
+	char		relkind = get_rel_relkind(relOid);
+
+	if (relkind == RELKIND_INDEX)
+	{
+		relOid = IndexGetRelation(relOid, true);
+		if (!OidIsValid(relOid))
+			return InvalidOid;
+		relkind = get_rel_relkind(relOid);
+	}
+	if (relkind == RELKIND_TOASTVALUE)
+	{
+		*toasts = lappend_oid(*toasts, relOid);
+		return InvalidOid;
+	}
+	return relkind == '\0' ? InvalidOid : relOid;
+}
+
+/*
+ * Return the tables which own the given toast tables, found by their
+ * reltoastrelid in one scan of pg_class.
+ */
+static List *
+get_toast_owning_tables(List *toasts)
+{
+	HASHCTL		ctl;
+	HTAB	   *toast_set;
+	ListCell   *lc;
+	Relation	classRel;
+	HeapScanDesc relScan;
+	HeapTuple	tuple;
+	List	   *tables = NIL;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(Oid);
+	ctl.entrysize = sizeof(Oid);
+	ctl.hcxt = CurrentMemoryContext;
+	toast_set = hash_create("changed toast tables",
+							list_length(toasts),
+							&ctl,
+							HASH_ELEM | HASH_CONTEXT | HASH_BLOBS);
+	foreach(lc, toasts)
+		(void) hash_search(toast_set, &lfirst_oid(lc), HASH_ENTER, NULL);
+
+	classRel = heap_open(RelationRelationId, AccessShareLock);
+	relScan = heap_beginscan_catalog(classRel, 0, NULL);
+	while ((tuple = heap_getnext(relScan, ForwardScanDirection)) != NULL)
+	{
+		Form_pg_class classForm = (Form_pg_class) GETSTRUCT(tuple);
+
+		if (OidIsValid(classForm->reltoastrelid) &&
+			hash_search(toast_set, &classForm->reltoastrelid, HASH_FIND, NULL) != NULL)
+			tables = lappend_oid(tables, classForm->oid);
+	}
+	heap_endscan(relScan);
+	heap_close(classRel, AccessShareLock);
+
+	hash_destroy(toast_set);
+	list_free(toasts);
+	return tables;
+}
+
+/*
+ * Get the table size statistics for the tables whose pgstat counters are
+ * changed.  Indexes and toast tables have their own counters, a change of
+ * them re-measures the table they belong to, with its indexes and toast.
+ */
+static HTAB *
+get_pgstat_tables_stats(List *changed)
+{
+	HASHCTL		ctl;
+	HTAB	   *local_table_stats_map;
+	RelationSizeBatch size_batch;
+	ListCell   *lc;
+	List	   *tables = NIL;
+	List	   *toasts = NIL;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(RelFileNode);
+	ctl.entrysize = sizeof(DiskQuotaActiveTableEntry);
+	ctl.hcxt = CurrentMemoryContext;
+	ctl.hash = tag_hash;
+
+	local_table_stats_map = hash_create("local table map with table size info",
+										1024,
+										&ctl,
+										HASH_ELEM | HASH_CONTEXT | HASH_FUNCTION);
+	size_batch_init(&size_batch);
+
+	foreach(lc, changed)
+	{
+		Oid			relOid = get_pgstat_owning_table(lfirst_oid(lc), &toasts);
+
+		if (OidIsValid(relOid))
+			tables = lappend_oid(tables, relOid);
+	}
+	if (toasts != NIL)
+		tables = list_concat(tables, get_toast_owning_tables(toasts));
+
+	foreach(lc, tables)
+	{
+		Oid			relOid = lfirst_oid(lc);
+		HeapTuple	tuple;
+		Form_pg_class classForm;
+		DiskQuotaActiveTableEntry *entry;
+		RelFileNode node;
+		bool		found;
+
+		tuple = SearchSysCache1(RELOID, ObjectIdGetDatum(relOid));
+		if (!HeapTupleIsValid(tuple))
+			continue;
+		classForm = (Form_pg_class) GETSTRUCT(tuple);
+		if (classForm->relkind != RELKIND_RELATION &&
+			classForm->relkind != RELKIND_MATVIEW)
+		{
+			ReleaseSysCache(tuple);
+			continue;
+		}
+
+		node.spcNode = classForm->reltablespace == 0 ? MyDatabaseTableSpace : classForm->reltablespace;
+		node.dbNode = MyDatabaseId;
+		node.relNode = classForm->relfilenode;
+
+		/* the table may be changed along with its indexes or toast */
+		entry = (DiskQuotaActiveTableEntry *) hash_search(local_table_stats_map, &node, HASH_ENTER, &found);
+		if (!found)
+		{
+			entry->node = node;
+			entry->reloid = relOid;
+			entry->namespace = classForm->relnamespace;
+			entry->owner = classForm->relowner;
+			entry->type = AT_EXTEND;
+			entry->tablesize = 0;
+			size_batch_add_relation(&size_batch, relOid, &entry->tablesize);
+		}
+		ReleaseSysCache(tuple);
+	}
+
+	/* probe the file size of all the changed tables in one batch */
+	size_batch_execute(&size_batch);
+	list_free(changed);
+	list_free(tables);
+
+	return local_table_stats_map;
+}
+
 /**
  * Get local active table with table oid and table size info.
  * This function first copies active table map from shared memory 
@@ -232,9 +590,12 @@ get_active_tables_stats()
 	HASHCTL ctl;
 	HTAB *local_active_table_file_map = NULL;
 	HTAB *local_active_table_stats_map = NULL;
+	HTAB *resolved_map;
 	HASH_SEQ_STATUS iter;
 	DiskQuotaActiveTableFileEntry *active_table_file_entry;
 	DiskQuotaActiveTableEntry *active_table_entry;
+	ResolvedRelFileNode *resolved;
+	RelationSizeBatch size_batch;
 
 	Oid relOid;
 
@@ -272,6 +633,10 @@ get_active_tables_stats()
 
 	LWLockRelease(diskquota_locks.active_table_lock);
 
+	/* add the relfilenodes found by inotify since last refresh */
+	if (diskquota_active_table_detector == ACTIVE_TABLE_DETECTOR_INOTIFY)
+		fswatch_move_events(local_active_table_file_map);
+
 	memset(&ctl, 0, sizeof(ctl));
 	ctl.keysize = sizeof(RelFileNode);
 	ctl.entrysize = sizeof(DiskQuotaActiveTableEntry);
@@ -283,6 +648,11 @@ get_active_tables_stats()
 								&ctl,
 								HASH_ELEM | HASH_CONTEXT | HASH_FUNCTION);
 
+	size_batch_init(&size_batch);
+
+	/* find the table oid of the committed active relfilenodes */
+	resolved_map = resolve_active_relfilenodes(local_active_table_file_map);
+
 	/* traverse local active table map and calculate their file size. */
 	hash_seq_init(&iter, local_active_table_file_map);
 	/* scan whole local map, get the oid of each table and calculate the size of them */
@@ -294,13 +664,17 @@ get_active_tables_stats()
 		{
 			case TABLE_COMMIT_CREATE:
 			case TABLE_COMMIT_CHANGE:
-				relOid = RelidByRelfilenode(active_table_file_entry->node.spcNode,
-				                            active_table_file_entry->node.relNode);
+				resolved = hash_search(resolved_map, &active_table_file_entry->node, HASH_FIND, NULL);
+				relOid = resolved ? resolved->reloid : InvalidOid;
 				if (relOid != InvalidOid) {
 					active_table_entry = hash_search(local_active_table_stats_map, &active_table_file_entry->node,
 					                                 HASH_ENTER, &found);
 					active_table_entry->node = active_table_file_entry->node;
-					active_table_entry->tablesize = diskquota_get_table_size_by_oid(relOid);
+					active_table_entry->reloid = relOid;
+					active_table_entry->tablesize = 0;
+					size_batch_add_relation(&size_batch, relOid, &active_table_entry->tablesize);
+					active_table_entry->namespace = InvalidOid;
+					active_table_entry->owner = InvalidOid;
 					active_table_entry->type = AT_EXTEND;
 					hash_search(local_active_table_file_map, &active_table_file_entry->node, HASH_REMOVE, NULL);
 				} else {
@@ -312,7 +686,8 @@ get_active_tables_stats()
 				active_table_entry = hash_search(local_active_table_stats_map, &active_table_file_entry->node,
 				                                 HASH_ENTER, &found);
 				active_table_entry->node = active_table_file_entry->node;
-				active_table_entry->tablesize = diskquota_get_table_size_by_relfilenode(&active_table_entry->node);
+				active_table_entry->reloid = active_table_file_entry->inXreloid;
+				size_batch_add_relfilenode(&size_batch, &active_table_entry->node, &active_table_entry->tablesize);
 				active_table_entry->namespace = active_table_file_entry->inXnamespace;
 				active_table_entry->owner = active_table_file_entry->inXowner;
 				active_table_entry->type = AT_EXTEND;
@@ -323,6 +698,10 @@ get_active_tables_stats()
 				active_table_entry = hash_search(local_active_table_stats_map, &active_table_file_entry->node,
 				                                 HASH_ENTER, &found);
 				active_table_entry->node = active_table_file_entry->node;
+				active_table_entry->reloid = InvalidOid;
+				active_table_entry->tablesize = 0;
+				active_table_entry->namespace = InvalidOid;
+				active_table_entry->owner = InvalidOid;
 				active_table_entry->type = AT_UNLINK;
 				hash_search(local_active_table_file_map, &active_table_file_entry->node, HASH_REMOVE, NULL);
 				break;
@@ -336,6 +715,9 @@ get_active_tables_stats()
 		}
 	}
 
+	/* probe the file size of all the active tables in one batch */
+	size_batch_execute(&size_batch);
+
 	/* If table is not found, it could be in transaction, so push back to share memory */
 
 	if (hash_get_num_entries(local_active_table_file_map) > 0)
@@ -358,10 +740,101 @@ get_active_tables_stats()
 		LWLockRelease(diskquota_locks.active_table_lock);
 	}
 
+	hash_destroy(resolved_map);
 	hash_destroy(local_active_table_file_map);
 	return local_active_table_stats_map;
 }
 
+/*
+ * Find the table oid of the committed active relfilenodes.  Most of them
+ * belong to tables already in the quota model of this worker, the rest are
+ * looked up in pg_class by one query instead of one RelidByRelfilenode()
+ * each, which scans pg_class index on cache miss.  Relfilenodes not found
+ * are in the returned map with InvalidOid.
+ */
+static HTAB *
+resolve_active_relfilenodes(HTAB *local_active_table_file_map)
+{
+	HASHCTL		ctl;
+	HTAB	   *resolved_map;
+	HASH_SEQ_STATUS iter;
+	DiskQuotaActiveTableFileEntry *active_table_file_entry;
+	ResolvedRelFileNode *resolved;
+	Datum	   *unknown_nodes;
+	int			num_unknown = 0;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(RelFileNode);
+	ctl.entrysize = sizeof(ResolvedRelFileNode);
+	ctl.hcxt = CurrentMemoryContext;
+	ctl.hash = tag_hash;
+
+	resolved_map = hash_create("local map of resolved active relfilenodes",
+							   1024,
+							   &ctl,
+							   HASH_ELEM | HASH_CONTEXT | HASH_FUNCTION);
+
+	unknown_nodes = (Datum *) palloc(sizeof(Datum) *
+									 Max(hash_get_num_entries(local_active_table_file_map), 1));
+
+	hash_seq_init(&iter, local_active_table_file_map);
+	while ((active_table_file_entry = (DiskQuotaActiveTableFileEntry *) hash_seq_search(&iter)) != NULL)
+	{
+		if (active_table_file_entry->tablestatus != TABLE_COMMIT_CREATE &&
+			active_table_file_entry->tablestatus != TABLE_COMMIT_CHANGE)
+			continue;
+
+		resolved = hash_search(resolved_map, &active_table_file_entry->node, HASH_ENTER, NULL);
+		resolved->node = active_table_file_entry->node;
+		resolved->reloid = get_table_oid_by_node(&active_table_file_entry->node);
+		if (resolved->reloid == InvalidOid)
+			unknown_nodes[num_unknown++] = ObjectIdGetDatum(active_table_file_entry->node.relNode);
+	}
+
+	if (num_unknown > 0)
+	{
+		Oid			argtypes[1];
+		Datum		values[1];
+		int			ret;
+		uint64		i;
+
+		argtypes[0] = get_array_type(OIDOID);
+		values[0] = PointerGetDatum(construct_array(unknown_nodes, num_unknown, OIDOID,
+													sizeof(Oid), true, 'i'));
+		/* diskquota worker is connected to SPI during refresh */
+		ret = SPI_execute_with_args("select oid, reltablespace, relfilenode from pg_class"
+									" where relfilenode = any($1)",
+									1, argtypes, values, NULL, true, 0);
+		if (ret != SPI_OK_SELECT)
+			elog(ERROR, "[diskquota] cannot look up relfilenodes in pg_class, error code %d", ret);
+
+		for (i = 0; i < SPI_processed; i++)
+		{
+			HeapTuple	tup = SPI_tuptable->vals[i];
+			TupleDesc	tupdesc = SPI_tuptable->tupdesc;
+			RelFileNode node;
+			bool		isnull;
+			Oid			reloid;
+
+			reloid = DatumGetObjectId(SPI_getbinval(tup, tupdesc, 1, &isnull));
+			node.spcNode = DatumGetObjectId(SPI_getbinval(tup, tupdesc, 2, &isnull));
+			if (node.spcNode == InvalidOid)
+				node.spcNode = MyDatabaseTableSpace;
+			node.dbNode = MyDatabaseId;
+			node.relNode = DatumGetObjectId(SPI_getbinval(tup, tupdesc, 3, &isnull));
+
+			/* same relfilenode in another tablespace is not matched */
+			resolved = hash_search(resolved_map, &node, HASH_FIND, NULL);
+			if (resolved != NULL && resolved->reloid == InvalidOid)
+				resolved->reloid = reloid;
+		}
+	}
+
+	pfree(unknown_nodes);
+	return resolved_map;
+}
+
+#ifndef DISKQUOTA_NO_CORE_HOOKS
 /**
  *  Hook function in smgr to report the active table
  *  information and stroe them in active table shared memory
@@ -378,8 +851,14 @@ report_active_table_SmgrStat(SMgrRelation reln, ActiveType at)
 	if (reln->smgr_rnode.node.relNode < FirstNormalObjectId)
 		return;
 
+	/* WAL redo, only collected when workers run on hot standby */
+	if (AmStartupProcess() && !diskquota_hot_standby)
+		return;
+
 	LWLockAcquire(diskquota_locks.active_table_lock, LW_EXCLUSIVE);
 	entry = hash_search(active_tables_map, &reln->smgr_rnode.node, HASH_ENTER_NULL, &found);
+	if (entry && !found)
+		entry->ispushedback = false;
 	if (entry && !entry->ispushedback)
 	{
 		entry->node = reln->smgr_rnode.node;
@@ -388,16 +867,19 @@ report_active_table_SmgrStat(SMgrRelation reln, ActiveType at)
 			case AT_EXTEND :
 			case AT_TRUNCATE :
 				entry->tablestatus = TABLE_COMMIT_CHANGE;
+				entry->inXreloid = InvalidOid;
 				entry->inXnamespace = InvalidOid;
 				entry->inXowner = InvalidOid;
 				break;
 			case AT_CREATE:
 				entry->tablestatus = TABLE_COMMIT_CREATE;
+				entry->inXreloid = InvalidOid;
 				entry->inXnamespace = InvalidOid;
 				entry->inXowner = InvalidOid; 
 				break;
 			case AT_UNLINK:
 				entry->tablestatus = TABLE_COMMIT_DELETE;
+				entry->inXreloid = InvalidOid;
 				entry->inXnamespace = InvalidOid;
 				entry->inXowner = InvalidOid; 
 				break;
@@ -412,7 +894,11 @@ report_active_table_SmgrStat(SMgrRelation reln, ActiveType at)
 	 * this means the entry is only visible in transaction, and need to process here
 	 * TODO: this is time consuming, may need to let user to choose enable or disable
 	 */
-	else if (entry && found && entry->ispushedback)
+	/*
+	 * The startup process could not look up catalog during WAL redo, leave
+	 * the entry to diskquota worker on hot standby.
+	 */
+	else if (entry && found && entry->ispushedback && !AmStartupProcess())
 	{
 		Oid relOid;
 		HeapTuple tuple;
@@ -434,6 +920,7 @@ report_active_table_SmgrStat(SMgrRelation reln, ActiveType at)
 			if (HeapTupleIsValid(tuple))
 			{
 				rel = (Form_pg_class) GETSTRUCT(tuple);
+				entry->inXreloid = relOid;
 				entry->inXnamespace = rel->relnamespace;
 				entry->inXowner = rel->relowner;
 				switch (at)
@@ -469,3 +956,4 @@ report_active_table_SmgrStat(SMgrRelation reln, ActiveType at)
 	}
 	LWLockRelease(diskquota_locks.active_table_lock);
 }
+#endif
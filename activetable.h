@@ -24,10 +24,19 @@ typedef enum
 	AT_UNLINK = 4,
 } ActiveType;
 
+/* engine detecting active tables, see diskquota.active_table_detector */
+typedef enum
+{
+	ACTIVE_TABLE_DETECTOR_HOOKS = 0,	/* smgr hooks of pg_hooks.patch */
+	ACTIVE_TABLE_DETECTOR_INOTIFY,		/* inotify on database directories */
+	ACTIVE_TABLE_DETECTOR_PGSTAT		/* changes of pgstat table counters */
+} ActiveTableDetector;
+
 /* Cache to detect the active table list */
 typedef struct DiskQuotaActiveTableFileEntry
 {
 	RelFileNode     node;
+	Oid             inXreloid;
 	Oid             inXnamespace;
 	Oid             inXowner;
 	ATStatus        tablestatus;
@@ -38,6 +47,7 @@ typedef struct DiskQuotaActiveTableFileEntry
 typedef struct DiskQuotaActiveTableEntry
 {
 	RelFileNode     node;
+	Oid             reloid;
 	int64           tablesize;
 	Oid             namespace;
 	Oid             owner;
@@ -51,4 +61,5 @@ extern void init_shm_worker_active_tables(void);
 extern void init_lock_active_tables(void);
 
 extern HTAB *active_tables_map;
+extern int	diskquota_active_table_detector;
 #endif
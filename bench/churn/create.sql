@@ -0,0 +1,8 @@
+-- replace a staging table of the client with a new one and load it
+-- tables are churn_<n>.t<tid>, tid is unique per client and slot
+-- the table is dropped first, so that each run creates a new relfilenode
+\set tid :client_id * 100000 + random(1, :slots)
+\set nsp :tid % :nschemas
+drop table if exists churn_:nsp.t:tid;
+create table churn_:nsp.t:tid(i int, t text);
+insert into churn_:nsp.t:tid select g, repeat('x', 100) from generate_series(1, :rows) g;
@@ -0,0 +1,4 @@
+-- drop a staging table of the client
+\set tid :client_id * 100000 + random(1, :slots)
+\set nsp :tid % :nschemas
+drop table if exists churn_:nsp.t:tid;
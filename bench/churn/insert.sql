@@ -0,0 +1,5 @@
+-- append rows into a staging table of the client
+\set tid :client_id * 100000 + random(1, :slots)
+\set nsp :tid % :nschemas
+create table if not exists churn_:nsp.t:tid(i int, t text);
+insert into churn_:nsp.t:tid select g, repeat('x', 100) from generate_series(1, :rows) g;
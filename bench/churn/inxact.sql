@@ -0,0 +1,9 @@
+-- create, load and drop a table in one transaction, which is never
+-- visible to the diskquota worker
+\set tid :client_id * 100000 + :slots + 1
+\set nsp :tid % :nschemas
+begin;
+create table churn_:nsp.t:tid(i int, t text);
+insert into churn_:nsp.t:tid select g, repeat('x', 100) from generate_series(1, :rows) g;
+drop table churn_:nsp.t:tid;
+commit;
@@ -0,0 +1,141 @@
+#!/usr/bin/env bash
+#
+# DDL churn stress benchmark of the incremental disk quota model.
+#
+# Clients create, load, truncate, VACUUM FULL and drop their own staging
+# tables at full speed with pgbench, on an instance without diskquota and
+# on one with diskquota enabled.  The churn exercises relfilenode swaps,
+# unlink events, and tables which are not visible to the worker yet.
+#
+# For each run report:
+#   tps                    transactions per second of the churn
+#   hook_overhead_pct      tps lost with diskquota enabled (on runs only)
+#   refresh_p50_ms, refresh_max_ms
+#                          duration of worker refreshes during the churn
+#   usage_error_bytes      sum over schemas of |usage in the model - true size|
+#                          after the churn stops and the model is refreshed
+#   max_usage_error_bytes  the largest error of one schema
+#
+# Results are printed as JSON lines:
+#   {"bench": "churn", "diskquota": "on", "clients": 8, "tps": ..., ...}
+#
+# Environment:
+#   CLIENTS    list of concurrent clients (default: "4 16")
+#   DURATION   seconds of each run (default: 60)
+#   SLOTS      staging tables per client (default: 50)
+#   NSCHEMAS   schemas the staging tables are spread over (default: 10)
+#   ROWS       rows loaded by create and insert (default: 1000)
+#   WEIGHTS    pgbench weights of "create insert truncate vacuum_full drop inxact"
+#              (default: "3 3 2 1 3 1")
+#   OUTPUT     file the JSON lines are appended to (default: stdout only)
+# and those of bench/lib.sh.
+#
+set -euo pipefail
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+. "$HERE/../lib.sh"
+
+CLIENTS=${CLIENTS:-"4 16"}
+DURATION=${DURATION:-60}
+SLOTS=${SLOTS:-50}
+NSCHEMAS=${NSCHEMAS:-10}
+ROWS=${ROWS:-1000}
+WEIGHTS=${WEIGHTS:-"3 3 2 1 3 1"}
+OUTPUT=${OUTPUT:-/dev/null}
+COMMIT=$(bench_commit)
+
+trap stop_instance EXIT
+
+declare -A TPS
+
+scripts() {
+	local weights=($WEIGHTS) ops=(create insert truncate vacuum_full drop inxact) i
+	for i in "${!ops[@]}"; do
+		if [ "${weights[$i]:-0}" -gt 0 ]; then
+			echo "-f $HERE/${ops[$i]}.sql@${weights[$i]}"
+		fi
+	done
+}
+
+setup() {
+	local mode=$1 i schemas=""
+
+	for i in $(seq 0 $((NSCHEMAS - 1))); do
+		bench_psql -c "drop schema if exists churn_$i cascade; create schema churn_$i"
+		schemas="$schemas${schemas:+,}churn_$i"
+	done
+	if [ "$mode" = "on" ]; then
+		bench_query "select diskquota.set_schema_quotas(string_to_array('$schemas', ','), array['1 TB'])" >/dev/null
+		bench_query "select diskquota.refresh()" >/dev/null
+	fi
+}
+
+# sample the duration of the last refresh every second until killed
+sample_refresh() {
+	local out=$1 last=-1 count
+	while true; do
+		count=$(bench_query "select refresh_count from diskquota.worker_status()
+			where dbid = (select oid from pg_database where datname = current_database())" || echo -1)
+		if [ -n "$count" ] && [ "$count" != "$last" ]; then
+			bench_query "select last_refresh_ms from diskquota.worker_status()
+				where dbid = (select oid from pg_database where datname = current_database())" >>"$out" || true
+			last=$count
+		fi
+		sleep 1
+	done
+}
+
+run_case() {
+	local mode=$1 nclients=$2 dir="$WORKDIR/churn_${mode}_${nclients}"
+	local tps sampler p50=0 max=0 errors="0|0" overhead=0
+
+	setup "$mode"
+	rm -rf "$dir"
+	mkdir -p "$dir"
+	: >"$dir/refresh"
+
+	if [ "$mode" = "on" ]; then
+		sample_refresh "$dir/refresh" &
+		sampler=$!
+	fi
+
+	tps=$("$PGBIN/pgbench" -n -M simple -c "$nclients" -j "$nclients" -T "$DURATION" \
+			-D slots="$SLOTS" -D nschemas="$NSCHEMAS" -D rows="$ROWS" \
+			$(scripts) "$BENCH_DB" 2>"$dir/stderr" |
+		awk '/^tps = / { print $3; exit }')
+	TPS[$mode,$nclients]=$tps
+
+	if [ "$mode" = "on" ]; then
+		kill "$sampler" 2>/dev/null || true
+		wait "$sampler" 2>/dev/null || true
+		p50=$(percentile 50 "$dir/refresh")
+		max=$(percentile 100 "$dir/refresh")
+
+		# all the churn is committed, two refreshes settle the model
+		bench_query "select diskquota.refresh()" >/dev/null
+		bench_query "select diskquota.refresh()" >/dev/null
+		errors=$(bench_query "
+			with t as (
+				select n.oid,
+					(select coalesce(sum(pg_total_relation_size(c.oid)), 0)
+					 from pg_class c where c.relnamespace = n.oid and c.relkind = 'r') as true_size,
+					coalesce((select usage_in_bytes from diskquota.headroom(n.oid)), 0) as model_size
+				from pg_namespace n where n.nspname like 'churn\_%')
+			select sum(abs(model_size - true_size)), max(abs(model_size - true_size)) from t")
+		overhead=$(awk -v off="${TPS[off,$nclients]:-0}" -v on="$tps" \
+			'BEGIN { printf "%.2f", off > 0 ? (off - on) * 100.0 / off : 0 }')
+	fi
+
+	emit_json bench churn commit "$COMMIT" diskquota "$mode" clients "$nclients" \
+		duration_s "$DURATION" slots "$SLOTS" weights "$WEIGHTS" tps "$tps" \
+		hook_overhead_pct "$overhead" refresh_p50_ms "$p50" refresh_max_ms "$max" \
+		usage_error_bytes "${errors%|*}" max_usage_error_bytes "${errors#*|}" | tee -a "$OUTPUT"
+}
+
+for mode in off on; do
+	DISKQUOTA_NAPTIME=1 start_instance "$mode"
+	for nclients in $CLIENTS; do
+		run_case "$mode" "$nclients"
+	done
+	stop_instance
+done
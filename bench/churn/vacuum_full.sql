@@ -0,0 +1,5 @@
+-- rewrite a staging table of the client, which swaps its relfilenode
+\set tid :client_id * 100000 + random(1, :slots)
+\set nsp :tid % :nschemas
+create table if not exists churn_:nsp.t:tid(i int, t text);
+vacuum full churn_:nsp.t:tid;
@@ -0,0 +1,92 @@
+#!/usr/bin/env bash
+#
+# Enforcement latency benchmark of diskquota.
+#
+# Writers insert at a controlled rate into schema enf, which has a quota,
+# until their first write is rejected.  A monitor samples the true size of
+# the schema, measured on the files.  For each naptime and each number of
+# writers, report:
+#   delay_ms            from the first sample above the limit to the first
+#                       rejected write
+#   overshoot_bytes     true size above the limit at the first rejected write
+#   final_overshoot_bytes
+#                       true size above the limit after all writers stopped
+#   disk_full           whether the rejections are ERRCODE_DISK_FULL (53100)
+#
+# Results are printed as JSON lines:
+#   {"bench": "enforcement", "naptime": 2, "writers": 4, "delay_ms": ..., ...}
+#
+# Environment:
+#   NAPTIMES     list of diskquota.naptime in seconds (default: "1 2 5")
+#   WRITERS      list of concurrent writers (default: "1 4 16")
+#   RATE         rows per second of each writer (default: 20000)
+#   BATCH        rows per insert (default: 1000)
+#   ROW_BYTES    bytes of the text column of each row (default: 100)
+#   LIMIT_MB     quota of schema enf (default: 100)
+#   DURATION     max seconds of each run (default: 120)
+#   SAMPLE_MS    interval of the true size samples (default: 10)
+#   OUTPUT       file the JSON lines are appended to (default: stdout only)
+# and those of bench/lib.sh.
+#
+set -euo pipefail
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+. "$HERE/../lib.sh"
+
+NAPTIMES=${NAPTIMES:-"1 2 5"}
+WRITERS=${WRITERS:-"1 4 16"}
+RATE=${RATE:-20000}
+BATCH=${BATCH:-1000}
+ROW_BYTES=${ROW_BYTES:-100}
+LIMIT_MB=${LIMIT_MB:-100}
+DURATION=${DURATION:-120}
+SAMPLE_MS=${SAMPLE_MS:-10}
+OUTPUT=${OUTPUT:-/dev/null}
+COMMIT=$(bench_commit)
+
+trap stop_instance EXIT
+
+run_case() {
+	local naptime=$1 nwriters=$2 i pids=() result
+
+	bench_psql -v limit_mb="$LIMIT_MB" -v nwriters="$nwriters" -f "$HERE/setup.sql" >/dev/null
+	bench_query "select diskquota.refresh()" >/dev/null
+
+	bench_psql -c "call enf_bench.monitor($nwriters, $SAMPLE_MS)" &
+	pids+=($!)
+	for i in $(seq 1 "$nwriters"); do
+		bench_psql -c "call enf_bench.writer($i, $RATE, $BATCH, $ROW_BYTES, '$DURATION s')" &
+		pids+=($!)
+	done
+	wait "${pids[@]}"
+
+	result=$(bench_query "
+		with lim as (select $LIMIT_MB::int8 * 1024 * 1024 as bytes),
+		crossed as (
+			select min(ts) as ts from enf_bench.size_sample, lim where size_in_bytes > lim.bytes),
+		rejected as (
+			select min(ts) as ts, count(*) as writers,
+				bool_and(sqlstate = '53100') as disk_full
+			from enf_bench.rejection)
+		select coalesce(round(extract(epoch from rejected.ts - crossed.ts) * 1000), -1),
+			coalesce((select max(size_in_bytes) from enf_bench.size_sample
+				where ts <= rejected.ts) - lim.bytes, 0),
+			enf_bench.true_size() - lim.bytes,
+			rejected.writers,
+			coalesce(rejected.disk_full, false)
+		from lim, crossed, rejected")
+
+	IFS='|' read -r delay overshoot final rejected disk_full <<<"$result"
+	emit_json bench enforcement commit "$COMMIT" naptime "$naptime" writers "$nwriters" \
+		rate "$RATE" batch "$BATCH" row_bytes "$ROW_BYTES" limit_mb "$LIMIT_MB" \
+		delay_ms "$delay" overshoot_bytes "$overshoot" final_overshoot_bytes "$final" \
+		rejected_writers "$rejected" disk_full "$disk_full" | tee -a "$OUTPUT"
+}
+
+for naptime in $NAPTIMES; do
+	DISKQUOTA_NAPTIME=$naptime start_instance on
+	for nwriters in $WRITERS; do
+		run_case "$naptime" "$nwriters"
+	done
+	stop_instance
+done
@@ -0,0 +1,73 @@
+-- Objects of the enforcement latency benchmark.
+--
+-- usage: psql -v limit_mb=100 -v nwriters=4 -f setup.sql
+--
+-- Writers insert into their own table in schema enf, which has a quota of
+-- limit_mb.  The monitor samples the true size of schema enf, computed from
+-- the files, into enf_bench.size_sample, and writers record the time of
+-- their first rejected write into enf_bench.rejection.
+
+drop schema if exists enf cascade;
+drop schema if exists enf_bench cascade;
+create schema enf;
+create schema enf_bench;
+
+create table enf_bench.size_sample(ts timestamptz, size_in_bytes int8);
+create table enf_bench.rejection(writer int, ts timestamptz, rows_written int8, sqlstate text);
+create table enf_bench.done(writer int);
+
+select format('create table enf.w%s(i int, t text)', g)
+from generate_series(1, :nwriters) g
+\gexec
+
+select diskquota.set_schema_quota('enf', :'limit_mb' || ' MB');
+
+-- true size of schema enf, measured on the files
+create function enf_bench.true_size() returns int8 as $$
+	select coalesce(sum(pg_total_relation_size(c.oid)), 0)::int8
+	from pg_class c
+	where c.relnamespace = 'enf'::regnamespace and c.relkind = 'r'
+$$ language sql;
+
+-- Insert batch rows of row_bytes bytes into enf.w<writer> every
+-- batch / rate seconds, until a write is rejected or duration is elapsed.
+create procedure enf_bench.writer(writer int, rate int, batch int, row_bytes int, duration interval)
+as $$
+declare
+	stop_at timestamptz := clock_timestamp() + duration;
+	written int8 := 0;
+	next_at timestamptz := clock_timestamp();
+begin
+	while clock_timestamp() < stop_at loop
+		begin
+			execute format('insert into enf.w%s select g, repeat(''x'', %s) from generate_series(1, %s) g',
+						   writer, row_bytes, batch);
+		exception when others then
+			insert into enf_bench.rejection values (writer, clock_timestamp(), written, sqlstate);
+			exit;
+		end;
+		written := written + batch;
+		commit;
+		next_at := next_at + make_interval(secs => batch::float8 / rate);
+		if next_at > clock_timestamp() then
+			perform pg_sleep(extract(epoch from next_at - clock_timestamp()));
+		end if;
+	end loop;
+	insert into enf_bench.done values (writer);
+	commit;
+end;
+$$ language plpgsql;
+
+-- Sample the true size of schema enf every interval_ms, until all the
+-- writers are done.
+create procedure enf_bench.monitor(nwriters int, interval_ms int)
+as $$
+begin
+	loop
+		insert into enf_bench.size_sample values (clock_timestamp(), enf_bench.true_size());
+		commit;
+		exit when (select count(*) from enf_bench.done) >= nwriters;
+		perform pg_sleep(interval_ms / 1000.0);
+	end loop;
+end;
+$$ language plpgsql;
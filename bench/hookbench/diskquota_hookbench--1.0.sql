@@ -0,0 +1,22 @@
+/* contrib/diskquota/bench/hookbench/diskquota_hookbench--1.0.sql */
+
+-- complain if script is sourced in psql, rather than via CREATE EXTENSION
+\echo Use "CREATE EXTENSION diskquota_hookbench" to load this file. \quit
+
+-- Call smgrextend_hook on fake relfilenodes, keys are picked uniformly
+-- from nrels relations in each of ndbs databases.
+CREATE FUNCTION smgr_hook(calls int8, nrels int4 DEFAULT 1, ndbs int4 DEFAULT 1,
+	OUT ncalls int8, OUT total_ms float8, OUT ns_per_call float8,
+	OUT p50_ns int8, OUT p99_ns int8, OUT max_ns int8)
+RETURNS record STRICT
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+-- Call ReadBufferExtended_hook for a new block, relations are picked
+-- uniformly from relids.
+CREATE FUNCTION quota_check(calls int8, relids regclass[],
+	OUT ncalls int8, OUT total_ms float8, OUT ns_per_call float8,
+	OUT p50_ns int8, OUT p99_ns int8, OUT max_ns int8)
+RETURNS record STRICT
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
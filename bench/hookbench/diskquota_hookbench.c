@@ -0,0 +1,205 @@
+/* -------------------------------------------------------------------------
+ *
+ * diskquota_hookbench.c
+ *
+ * Test-only module to measure the overhead of diskquota hooks in isolation.
+ * It calls the smgr and ReadBufferExtended hooks installed by diskquota
+ * directly, many times in a loop, and reports the time per call.  Running
+ * it from many concurrent backends shows the contention on diskquota locks
+ * and shared hash tables.
+ *
+ * smgr_hook() reports fake relfilenodes of fake databases, which are never
+ * consumed by a diskquota worker and stay in the shared active table map,
+ * so only use it on a throwaway instance.
+ *
+ * Copyright (C) 2013, PostgreSQL Global Development Group
+ *
+ *
+ * -------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "catalog/pg_tablespace.h"
+#include "catalog/pg_type.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "portability/instr_time.h"
+#include "storage/bufmgr.h"
+#include "storage/smgr.h"
+#include "utils/array.h"
+#include "utils/rel.h"
+
+PG_MODULE_MAGIC;
+
+PG_FUNCTION_INFO_V1(smgr_hook);
+PG_FUNCTION_INFO_V1(quota_check);
+
+/* max number of calls in one run, the time of each call is kept in memory */
+#define MAX_BENCH_CALLS (10 * 1000 * 1000)
+/* fake database oids and relfilenodes used by smgr_hook() */
+#define HOOKBENCH_DBOID_BASE 0xF0000000
+#define HOOKBENCH_RELNODE_BASE 0x40000000
+
+static void check_calls(int64 calls);
+static int	cmp_int64(const void *a, const void *b);
+static Datum make_result(FunctionCallInfo fcinfo, int64 *times, int64 calls);
+
+static void
+check_calls(int64 calls)
+{
+	if (calls <= 0 || calls > MAX_BENCH_CALLS)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("calls must be between 1 and %d", MAX_BENCH_CALLS)));
+}
+
+static int
+cmp_int64(const void *a, const void *b)
+{
+	int64		x = *(const int64 *) a;
+	int64		y = *(const int64 *) b;
+
+	if (x < y)
+		return -1;
+	if (x > y)
+		return 1;
+	return 0;
+}
+
+/*
+ * Build (ncalls, total_ms, ns_per_call, p50_ns, p99_ns, max_ns) from the time
+ * of each call in ns.  The time includes the overhead of reading the clock.
+ */
+static Datum
+make_result(FunctionCallInfo fcinfo, int64 *times, int64 calls)
+{
+	TupleDesc	tupdesc;
+	Datum		values[6];
+	bool		nulls[6];
+	int64		total = 0;
+	int64		i;
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+	tupdesc = BlessTupleDesc(tupdesc);
+
+	for (i = 0; i < calls; i++)
+		total += times[i];
+	qsort(times, calls, sizeof(int64), cmp_int64);
+
+	memset(nulls, 0, sizeof(nulls));
+	values[0] = Int64GetDatum(calls);
+	values[1] = Float8GetDatum(total / 1000000.0);
+	values[2] = Float8GetDatum((double) total / calls);
+	values[3] = Int64GetDatum(times[(calls - 1) / 2]);
+	values[4] = Int64GetDatum(times[(calls - 1) * 99 / 100]);
+	values[5] = Int64GetDatum(times[calls - 1]);
+
+	return HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls));
+}
+
+/*
+ * Call smgrextend_hook on fake relfilenodes.
+ */
+Datum
+smgr_hook(PG_FUNCTION_ARGS)
+{
+	int64		calls = PG_GETARG_INT64(0);
+	int32		nrels = PG_GETARG_INT32(1);
+	int32		ndbs = PG_GETARG_INT32(2);
+	int64	   *times;
+	int64		i;
+	SMgrRelationData reln;
+	static char buffer[BLCKSZ];
+
+	check_calls(calls);
+	if (nrels <= 0 || ndbs <= 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("nrels and ndbs must be positive")));
+	if (smgrextend_hook == NULL)
+		ereport(ERROR,
+				(errmsg("smgrextend_hook is not installed"),
+				 errhint("Add diskquota into shared_preload_libraries.")));
+
+	memset(&reln, 0, sizeof(reln));
+	reln.smgr_rnode.backend = InvalidBackendId;
+	reln.smgr_rnode.node.spcNode = DEFAULTTABLESPACE_OID;
+
+	times = palloc(sizeof(int64) * calls);
+	for (i = 0; i < calls; i++)
+	{
+		int64		key = random() % ((int64) nrels * ndbs);
+		instr_time	start;
+		instr_time	duration;
+
+		reln.smgr_rnode.node.dbNode = HOOKBENCH_DBOID_BASE + key / nrels;
+		reln.smgr_rnode.node.relNode = HOOKBENCH_RELNODE_BASE + key % nrels;
+
+		INSTR_TIME_SET_CURRENT(start);
+		(*smgrextend_hook) (&reln, MAIN_FORKNUM, 0, buffer, true);
+		INSTR_TIME_SET_CURRENT(duration);
+		INSTR_TIME_SUBTRACT(duration, start);
+		times[i] = (int64) (INSTR_TIME_GET_DOUBLE(duration) * 1000000000.0);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	return make_result(fcinfo, times, calls);
+}
+
+/*
+ * Call ReadBufferExtended_hook as if a new block is being added to one of
+ * the relations.
+ */
+Datum
+quota_check(PG_FUNCTION_ARGS)
+{
+	int64		calls = PG_GETARG_INT64(0);
+	ArrayType  *array = PG_GETARG_ARRAYTYPE_P(1);
+	Datum	   *elems;
+	int			nrels;
+	Relation   *rels;
+	int64	   *times;
+	int64		i;
+
+	check_calls(calls);
+	if (ReadBufferExtended_hook == NULL)
+		ereport(ERROR,
+				(errmsg("ReadBufferExtended_hook is not installed"),
+				 errhint("Add diskquota into shared_preload_libraries.")));
+
+	deconstruct_array(array, REGCLASSOID, sizeof(Oid), true, 'i',
+					  &elems, NULL, &nrels);
+	if (nrels == 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("relids must not be empty")));
+
+	rels = palloc(sizeof(Relation) * nrels);
+	for (i = 0; i < nrels; i++)
+		rels[i] = relation_open(DatumGetObjectId(elems[i]), AccessShareLock);
+
+	times = palloc(sizeof(int64) * calls);
+	for (i = 0; i < calls; i++)
+	{
+		Relation	rel = rels[random() % nrels];
+		instr_time	start;
+		instr_time	duration;
+
+		INSTR_TIME_SET_CURRENT(start);
+		(*ReadBufferExtended_hook) (rel, MAIN_FORKNUM, P_NEW, RBM_NORMAL, NULL);
+		INSTR_TIME_SET_CURRENT(duration);
+		INSTR_TIME_SUBTRACT(duration, start);
+		times[i] = (int64) (INSTR_TIME_GET_DOUBLE(duration) * 1000000000.0);
+
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	for (i = 0; i < nrels; i++)
+		relation_close(rels[i], AccessShareLock);
+
+	return make_result(fcinfo, times, calls);
+}
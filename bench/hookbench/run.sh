@@ -0,0 +1,127 @@
+#!/usr/bin/env bash
+#
+# Microbenchmark of diskquota hooks under concurrency.
+#
+# Build and install the test-only module first:
+#   make -C bench/hookbench PG_CONFIG=... install
+#
+# For each key distribution and each concurrency, CONCURRENCY backends call
+# a diskquota hook CALLS times each at the same time, through the
+# diskquota_hookbench module.  Meanwhile pg_stat_activity is sampled to
+# estimate the time the backends spend waiting on diskquota LWLocks.
+#
+# Distributions:
+#   hot        smgr hook, one relation of one database
+#   rels       smgr hook, NRELS relations of one database
+#   dbs        smgr hook, NRELS relations in each of NDBS databases
+#   check      quota check hook, CHECK_RELS tables
+#
+# Results are printed as JSON lines:
+#   {"bench": "hook", "hook": "smgr", "distribution": "hot", "concurrency": 8,
+#    "ns_per_call": ..., "p99_ns": ..., "lwlock_wait_pct": ..., ...}
+# lwlock_wait_pct is the share of samples in which a benchmark backend was
+# waiting on the diskquota_locks tranche.
+#
+# Environment:
+#   CONCURRENCY    list of concurrent backends (default: "1 2 4 8 16 32")
+#   DISTRIBUTIONS  list of distributions (default: "hot rels dbs check")
+#   CALLS          calls per backend (default: 1000000)
+#   NRELS          relations per database (default: 10000)
+#   NDBS           databases of distribution dbs (default: 10)
+#   CHECK_RELS     tables of distribution check, opened by each backend (default: 100)
+#   OUTPUT         file the JSON lines are appended to (default: stdout only)
+# and those of bench/lib.sh.
+#
+set -euo pipefail
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+. "$HERE/../lib.sh"
+
+CONCURRENCY=${CONCURRENCY:-"1 2 4 8 16 32"}
+DISTRIBUTIONS=${DISTRIBUTIONS:-"hot rels dbs check"}
+CALLS=${CALLS:-1000000}
+NRELS=${NRELS:-10000}
+NDBS=${NDBS:-10}
+CHECK_RELS=${CHECK_RELS:-100}
+OUTPUT=${OUTPUT:-/dev/null}
+COMMIT=$(bench_commit)
+
+trap stop_instance EXIT
+
+# sample waits on diskquota locks of the benchmark backends until killed
+sample_waits() {
+	local out=$1
+	while true; do
+		bench_query "select count(*) filter (where wait_event = 'diskquota_locks'),
+				count(*)
+			from pg_stat_activity
+			where application_name = 'hookbench'" >>"$out" || true
+		sleep 0.01
+	done
+}
+
+run_case() {
+	local dist=$1 nconc=$2
+	local dir="$WORKDIR/hook_${dist}_${nconc}" sql hook sampler i
+
+	case $dist in
+		hot) hook=smgr sql="select * from diskquota_hookbench.smgr_hook($CALLS, 1, 1)" ;;
+		rels) hook=smgr sql="select * from diskquota_hookbench.smgr_hook($CALLS, $NRELS, 1)" ;;
+		dbs) hook=smgr sql="select * from diskquota_hookbench.smgr_hook($CALLS, $NRELS, $NDBS)" ;;
+		check) hook=quota_check sql="select * from diskquota_hookbench.quota_check($CALLS,
+				(select array_agg(c.oid::regclass) from pg_class c
+				 where c.relnamespace = 'hookbench'::regnamespace and c.relkind = 'r'
+				 and c.relname in (select 't' || g from generate_series(1, $CHECK_RELS) g)))" ;;
+		*) echo "unknown distribution $dist" >&2; exit 1 ;;
+	esac
+
+	rm -rf "$dir"
+	mkdir -p "$dir"
+	sample_waits "$dir/waits" &
+	sampler=$!
+
+	for i in $(seq 1 "$nconc"); do
+		PGAPPNAME=hookbench "$PGBIN/psql" -X -A -t -F ' ' -v ON_ERROR_STOP=1 -d "$BENCH_DB" \
+			-c "$sql" >"$dir/result.$i" &
+	done
+	wait $(jobs -p | grep -v "^$sampler\$")
+	kill "$sampler" 2>/dev/null || true
+	wait "$sampler" 2>/dev/null || true
+
+	# columns: ncalls total_ms ns_per_call p50_ns p99_ns max_ns
+	cat "$dir"/result.* | awk -v waits="$dir/waits" '
+		{
+			calls += $1; ns += $3 * $1
+			p50 = ($4 > p50) ? $4 : p50
+			p99 = ($5 > p99) ? $5 : p99
+			max = ($6 > max) ? $6 : max
+		}
+		END {
+			while ((getline line < waits) > 0) {
+				split(line, f, "|")
+				waiting += f[1]; running += f[2]
+			}
+			printf "%d %.1f %d %d %d %.2f\n", calls, ns / calls, p50, p99, max,
+				running > 0 ? waiting * 100.0 / running : 0
+		}' >"$dir/summary"
+
+	read -r calls ns p50 p99 max wait_pct <"$dir/summary"
+	emit_json bench hook commit "$COMMIT" hook "$hook" distribution "$dist" \
+		concurrency "$nconc" calls "$calls" ns_per_call "$ns" max_p50_ns "$p50" \
+		max_p99_ns "$p99" max_ns "$max" lwlock_wait_pct "$wait_pct" | tee -a "$OUTPUT"
+}
+
+start_instance on
+bench_psql -c "create extension diskquota_hookbench"
+bench_psql -c "create schema hookbench"
+bench_psql -v nrels="$NRELS" <<'SQL'
+select format('create table hookbench.t%s(i int)', g)
+from generate_series(1, :nrels) g
+\gexec
+SQL
+
+for dist in $DISTRIBUTIONS; do
+	for nconc in $CONCURRENCY; do
+		run_case "$dist" "$nconc"
+	done
+done
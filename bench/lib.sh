@@ -0,0 +1,110 @@
+#!/usr/bin/env bash
+#
+# bench/lib.sh
+#
+# Common functions of diskquota benchmarks: manage a temporary instance and
+# emit results as JSON lines.  Source it from a benchmark driver.
+#
+# Environment:
+#   PG_CONFIG   pg_config of the installation with diskquota (default: pg_config)
+#   WORKDIR     directory of the temporary instance and logs
+#   PGPORT      port of the temporary instance (default: 54329)
+#
+
+PG_CONFIG=${PG_CONFIG:-pg_config}
+PGBIN=$("$PG_CONFIG" --bindir)
+PGPORT=${PGPORT:-54329}
+WORKDIR=${WORKDIR:-/tmp/diskquota_bench}
+PGDATA_BENCH="$WORKDIR/data"
+BENCH_DB=${BENCH_DB:-bench}
+export PGPORT PGHOST=${PGHOST:-/tmp}
+
+# run psql against the benchmark database, quietly, stop on error
+bench_psql() {
+	"$PGBIN/psql" -X -q -v ON_ERROR_STOP=1 -d "$BENCH_DB" "$@"
+}
+
+# single value query against the benchmark database
+bench_query() {
+	"$PGBIN/psql" -X -A -t -v ON_ERROR_STOP=1 -d "$BENCH_DB" -c "$1"
+}
+
+# start_instance on|off [extra postgresql.conf lines...]
+#   init a fresh instance, with diskquota preloaded and created in the
+#   benchmark database if the first argument is "on"
+start_instance() {
+	local mode=$1
+	shift
+
+	stop_instance
+	rm -rf "$PGDATA_BENCH"
+	mkdir -p "$WORKDIR"
+	"$PGBIN/initdb" -D "$PGDATA_BENCH" -A trust >"$WORKDIR/initdb.log" 2>&1
+
+	{
+		echo "port = $PGPORT"
+		echo "unix_socket_directories = '$PGHOST'"
+		echo "listen_addresses = ''"
+		echo "max_connections = 200"
+		echo "autovacuum = off"
+		if [ "$mode" = "on" ]; then
+			echo "shared_preload_libraries = 'diskquota'"
+			echo "diskquota.naptime = ${DISKQUOTA_NAPTIME:-2}"
+			echo "max_worker_processes = 20"
+		fi
+		for line in "$@"; do
+			echo "$line"
+		done
+	} >>"$PGDATA_BENCH/postgresql.conf"
+
+	"$PGBIN/pg_ctl" -D "$PGDATA_BENCH" -w -l "$WORKDIR/server.log" start >/dev/null
+	"$PGBIN/createdb" "$BENCH_DB"
+
+	if [ "$mode" = "on" ]; then
+		bench_psql -c "create extension diskquota"
+		# wait for the worker to finish its initial refresh
+		sleep $((${DISKQUOTA_NAPTIME:-2} * 2))
+	fi
+}
+
+stop_instance() {
+	if [ -f "$PGDATA_BENCH/postmaster.pid" ]; then
+		"$PGBIN/pg_ctl" -D "$PGDATA_BENCH" -w -m fast stop >/dev/null || true
+	fi
+}
+
+# percentile p (0-100) of the numbers in a file, one per line
+percentile() {
+	local p=$1 file=$2
+	sort -n "$file" | awk -v p="$p" '
+		{ v[NR] = $1 }
+		END {
+			if (NR == 0) { print 0; exit }
+			i = int((p / 100.0) * NR + 0.999999)
+			if (i < 1) i = 1
+			if (i > NR) i = NR
+			print v[i]
+		}'
+}
+
+# emit_json key value [key value ...]
+#   print one JSON object; values which look like numbers are not quoted
+emit_json() {
+	local out="{" sep="" key value
+	while [ $# -ge 2 ]; do
+		key=$1 value=$2
+		shift 2
+		if [[ "$value" =~ ^-?[0-9]+(\.[0-9]+)?$ ]]; then
+			out="$out$sep\"$key\": $value"
+		else
+			out="$out$sep\"$key\": \"$value\""
+		fi
+		sep=", "
+	done
+	echo "$out}"
+}
+
+# commit of the diskquota tree under test, recorded with the results
+bench_commit() {
+	git -C "$(dirname "${BASH_SOURCE[0]}")" rev-parse --short HEAD 2>/dev/null || echo unknown
+}
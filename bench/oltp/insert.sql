@@ -0,0 +1,4 @@
+-- insert :rows rows into a random table of schema bench
+-- usage: pgbench -M simple -D ntables=2000 -D rows=100 -f insert.sql
+\set t random(1, :ntables)
+insert into bench.t:t select g, 'diskquota' from generate_series(1, :rows) g;
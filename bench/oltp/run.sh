@@ -0,0 +1,96 @@
+#!/usr/bin/env bash
+#
+# OLTP overhead benchmark of diskquota.
+#
+# For each number of tables and each number of connections, run the same
+# pgbench insert workload on a fresh instance without diskquota and on a
+# fresh instance with diskquota preloaded and enabled in the benchmark
+# database.  Each transaction inserts ROWS rows into a random table.
+#
+# Results are printed as JSON lines, one per run and one overhead summary
+# per (tables, clients):
+#   {"bench": "oltp", "diskquota": "on", "tables": 2000, "clients": 5,
+#    "tps": ..., "latency_p50_ms": ..., "latency_p99_ms": ...}
+#   {"bench": "oltp_overhead", "tables": 2000, "clients": 5,
+#    "tps_overhead_pct": ..., "p99_overhead_pct": ...}
+#
+# Environment:
+#   TABLES    list of table counts (default: "2000 4000 6000 8000 10000")
+#   CLIENTS   list of connection counts (default: "5 10 15 20 25")
+#   DURATION  seconds of each pgbench run (default: 60)
+#   ROWS      rows inserted by each transaction (default: 100)
+#   OUTPUT    file the JSON lines are appended to (default: stdout only)
+# and those of bench/lib.sh.
+#
+set -euo pipefail
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+. "$HERE/../lib.sh"
+
+TABLES=${TABLES:-"2000 4000 6000 8000 10000"}
+CLIENTS=${CLIENTS:-"5 10 15 20 25"}
+DURATION=${DURATION:-60}
+ROWS=${ROWS:-100}
+OUTPUT=${OUTPUT:-/dev/null}
+COMMIT=$(bench_commit)
+
+trap stop_instance EXIT
+
+declare -A TPS P99
+
+run_case() {
+	local mode=$1 ntables=$2 nclients=$3
+	local logdir="$WORKDIR/log_${mode}_${ntables}_${nclients}"
+	local tps p50 p99 line
+
+	bench_psql -v ntables="$ntables" -f "$HERE/setup.sql" >/dev/null
+	if [ "$mode" = "on" ]; then
+		bench_psql -c "select diskquota.set_schema_quota('bench', '1 TB')" >/dev/null
+		bench_psql -c "select diskquota.refresh()" >/dev/null
+	fi
+
+	rm -rf "$logdir"
+	mkdir -p "$logdir"
+	tps=$(cd "$logdir" && "$PGBIN/pgbench" -n -M simple -c "$nclients" -j "$nclients" \
+			-T "$DURATION" -D ntables="$ntables" -D rows="$ROWS" \
+			-l --log-prefix="$logdir/txn" -f "$HERE/insert.sql" "$BENCH_DB" 2>"$logdir/stderr" |
+		awk '/^tps = / { print $3; exit }')
+
+	# the third field of the transaction log is the latency in microseconds
+	cat "$logdir"/txn* | awk '{ print $3 / 1000.0 }' >"$logdir/latency"
+	p50=$(percentile 50 "$logdir/latency")
+	p99=$(percentile 99 "$logdir/latency")
+
+	TPS[$mode,$ntables,$nclients]=$tps
+	P99[$mode,$ntables,$nclients]=$p99
+
+	line=$(emit_json bench oltp commit "$COMMIT" diskquota "$mode" tables "$ntables" \
+		clients "$nclients" duration_s "$DURATION" rows "$ROWS" \
+		tps "$tps" latency_p50_ms "$p50" latency_p99_ms "$p99")
+	echo "$line" | tee -a "$OUTPUT"
+}
+
+for mode in off on; do
+	# setup.sql drops and creates up to 10000 tables in one transaction
+	start_instance "$mode" "max_locks_per_transaction = 4096"
+	for ntables in $TABLES; do
+		for nclients in $CLIENTS; do
+			run_case "$mode" "$ntables" "$nclients"
+		done
+	done
+	stop_instance
+done
+
+for ntables in $TABLES; do
+	for nclients in $CLIENTS; do
+		line=$(awk -v off_tps="${TPS[off,$ntables,$nclients]}" -v on_tps="${TPS[on,$ntables,$nclients]}" \
+				-v off_p99="${P99[off,$ntables,$nclients]}" -v on_p99="${P99[on,$ntables,$nclients]}" \
+				'BEGIN {
+					tps = off_tps > 0 ? (off_tps - on_tps) * 100.0 / off_tps : 0
+					p99 = off_p99 > 0 ? (on_p99 - off_p99) * 100.0 / off_p99 : 0
+					printf "%.2f %.2f", tps, p99
+				}')
+		echo "$(emit_json bench oltp_overhead commit "$COMMIT" tables "$ntables" clients "$nclients" \
+			tps_overhead_pct "${line% *}" p99_overhead_pct "${line#* }")" | tee -a "$OUTPUT"
+	done
+done
@@ -0,0 +1,8 @@
+-- create :ntables empty tables in schema bench
+-- usage: psql -v ntables=2000 -f setup.sql
+drop schema if exists bench cascade;
+create schema bench;
+
+select format('create table bench.t%s(i int, t text)', g)
+from generate_series(1, :ntables) g
+\gexec
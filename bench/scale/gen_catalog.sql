@@ -0,0 +1,52 @@
+-- Generate a synthetic catalog for the scale benchmark.
+--
+-- usage: psql -v ntables=100000 -v nschemas=100 -v nowners=10 \
+--             -v ntablespaces=0 -v toast_pct=50 -v index_pct=50 \
+--             -v part_pct=0 -v parts=0 -v batch=500 -f gen_catalog.sql
+--
+-- ntables tables are spread over nschemas schemas dq_s<n>, nowners roles
+-- dq_owner<n>, and the default tablespace plus ntablespaces tablespaces
+-- dq_spc<n>, which must exist.  toast_pct percent of the tables have a text
+-- column, thus a toast table and a toast index, index_pct percent of them
+-- have a primary key.  If parts is positive, part_pct percent of the tables
+-- are partitioned into parts partitions.  Each batch of tables is created
+-- in one transaction.
+
+select format('create role dq_owner%s', g)
+from generate_series(1, :nowners) g
+\gexec
+
+select format('create schema dq_s%s', g)
+from generate_series(1, :nschemas) g
+\gexec
+
+with t as (
+	select g,
+		'dq_s' || (g % :nschemas + 1) as nsp,
+		'dq_owner' || (g % :nowners + 1) as owner,
+		case when :ntablespaces > 0 and g % (:ntablespaces + 1) > 0
+			then ' tablespace dq_spc' || (g % (:ntablespaces + 1)) else '' end as spc,
+		(g * 7) % 100 < :toast_pct as has_toast,
+		(g * 13) % 100 < :index_pct as has_index,
+		:parts > 0 and (g * 17) % 100 < :part_pct as partitioned
+	from generate_series(1, :ntables) g
+), stmts as (
+	select g,
+		format('create table %s.t%s(i int%s%s)%s; alter table %s.t%s owner to %s',
+			nsp, g,
+			case when has_toast then ', t text' else '' end,
+			case when has_index then ', primary key (i)' else '' end,
+			case when partitioned then ' partition by range (i)' else spc end,
+			nsp, g, owner)
+		|| case when partitioned then (
+			select string_agg(format('; create table %s.t%s_p%s partition of %s.t%s for values from (%s) to (%s)%s; alter table %s.t%s_p%s owner to %s',
+					nsp, g, k, nsp, g, k * 1000, (k + 1) * 1000, spc, nsp, g, k, owner), '')
+			from generate_series(0, :parts - 1) k)
+			else '' end as stmt
+	from t
+)
+select string_agg(stmt, '; ' order by g)
+from stmts
+group by (g - 1) / :batch
+order by (g - 1) / :batch
+\gexec
@@ -0,0 +1,137 @@
+#!/usr/bin/env bash
+#
+# Scale benchmark of the diskquota worker.
+#
+# For each catalog size, generate a synthetic catalog on a fresh instance
+# with diskquota enabled, restart it and measure:
+#   - the duration of the initial forced refresh of the worker, which scans
+#     the whole catalog and probes the size of all the tables
+#   - the duration of steady state refreshes, each after ACTIVE tables are
+#     written to
+#   - the RSS of the worker after the initial refresh and after the steady
+#     state refreshes (Linux only)
+# Durations are read from diskquota.worker_status().
+#
+# Results are printed as JSON lines, one per (size, active tables):
+#   {"bench": "scale", "commit": "...", "tables": 100000, "relations": ...,
+#    "active": 1000, "init_refresh_ms": ..., "cycle_p50_ms": ...,
+#    "cycle_max_ms": ..., "init_rss_kb": ..., "rss_kb": ...}
+# Append them to the same OUTPUT file on every commit to track them.
+#
+# Environment:
+#   SIZES         list of table counts (default: "100000 1000000")
+#   ACTIVE        list of active tables per refresh (default: "0 1000 10000")
+#   CYCLES        steady state refreshes per active count (default: 10)
+#   NSCHEMAS      schemas (default: 100)
+#   NOWNERS       owners (default: 10)
+#   NTABLESPACES  tablespaces besides the default one (default: 0)
+#   TOAST_PCT     percent of tables with a toast table (default: 50)
+#   INDEX_PCT     percent of tables with an index (default: 50)
+#   PART_PCT      percent of tables which are partitioned (default: 0)
+#   PARTS         partitions of a partitioned table (default: 0)
+#   SIZE_PROVIDER diskquota.size_provider, simulated to measure the refresh
+#                 pipeline without the cost of stat() (default: filesystem)
+#   SIMULATED_LATENCY
+#                 diskquota.simulated_latency in us (default: 0)
+#   OUTPUT        file the JSON lines are appended to (default: stdout only)
+# and those of bench/lib.sh.
+#
+set -euo pipefail
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+. "$HERE/../lib.sh"
+
+SIZES=${SIZES:-"100000 1000000"}
+ACTIVE=${ACTIVE:-"0 1000 10000"}
+CYCLES=${CYCLES:-10}
+NSCHEMAS=${NSCHEMAS:-100}
+NOWNERS=${NOWNERS:-10}
+NTABLESPACES=${NTABLESPACES:-0}
+TOAST_PCT=${TOAST_PCT:-50}
+INDEX_PCT=${INDEX_PCT:-50}
+PART_PCT=${PART_PCT:-0}
+PARTS=${PARTS:-0}
+SIZE_PROVIDER=${SIZE_PROVIDER:-filesystem}
+SIMULATED_LATENCY=${SIMULATED_LATENCY:-0}
+OUTPUT=${OUTPUT:-/dev/null}
+COMMIT=$(bench_commit)
+
+trap stop_instance EXIT
+
+worker_status() {
+	bench_query "select $1 from diskquota.worker_status()
+		where dbid = (select oid from pg_database where datname = current_database())"
+}
+
+worker_rss_kb() {
+	local pid
+	pid=$(worker_status pid)
+	awk '/^VmRSS:/ { print $2 }' "/proc/$pid/status" 2>/dev/null || echo 0
+}
+
+# write one row into n random tables of the synthetic catalog
+touch_tables() {
+	local n=$1 maxval=$(( PARTS > 0 ? PARTS * 1000 : 1000 ))
+
+	[ "$n" -gt 0 ] || return 0
+	bench_psql >/dev/null <<SQL
+select format('insert into %s values (%s) on conflict do nothing',
+		c.oid::regclass, (random() * ($maxval - 1))::int)
+from pg_class c join pg_namespace n on n.oid = c.relnamespace
+where n.nspname like 'dq\_s%' and c.relkind in ('r', 'p') and not c.relispartition
+order by random()
+limit $n
+\gexec
+SQL
+}
+
+run_size() {
+	local ntables=$1 i nrels init_ms init_rss active cycles p50 max rss
+
+	# a long naptime, so that only the refreshes requested here are measured
+	start_instance on "diskquota.naptime = 3600" "max_locks_per_transaction = 4096" \
+		"diskquota.size_provider = $SIZE_PROVIDER" "diskquota.simulated_latency = $SIMULATED_LATENCY"
+	for i in $(seq 1 "$NTABLESPACES"); do
+		mkdir -p "$WORKDIR/spc$i"
+		bench_psql -c "create tablespace dq_spc$i location '$WORKDIR/spc$i'"
+	done
+	bench_psql -v ntables="$ntables" -v nschemas="$NSCHEMAS" -v nowners="$NOWNERS" \
+		-v ntablespaces="$NTABLESPACES" -v toast_pct="$TOAST_PCT" -v index_pct="$INDEX_PCT" \
+		-v part_pct="$PART_PCT" -v parts="$PARTS" -v batch=500 \
+		-f "$HERE/gen_catalog.sql" >/dev/null
+	nrels=$(bench_query "select count(*) from pg_class where oid >= 16384")
+
+	# the worker starts with a forced refresh of the whole catalog
+	"$PGBIN/pg_ctl" -D "$PGDATA_BENCH" -w -l "$WORKDIR/server.log" restart >/dev/null
+	until [ "$(worker_status "coalesce(refresh_count, 0)")" -ge 1 ] 2>/dev/null; do
+		sleep 1
+	done
+	init_ms=$(worker_status init_refresh_ms)
+	init_rss=$(worker_rss_kb)
+
+	for active in $ACTIVE; do
+		cycles="$WORKDIR/cycles_${ntables}_${active}"
+		: >"$cycles"
+		for i in $(seq 1 "$CYCLES"); do
+			touch_tables "$active"
+			bench_query "select diskquota.refresh()" >/dev/null
+			worker_status last_refresh_ms >>"$cycles"
+		done
+		p50=$(percentile 50 "$cycles")
+		max=$(percentile 100 "$cycles")
+		rss=$(worker_rss_kb)
+
+		emit_json bench scale commit "$COMMIT" tables "$ntables" relations "$nrels" \
+			schemas "$NSCHEMAS" owners "$NOWNERS" tablespaces "$NTABLESPACES" \
+			toast_pct "$TOAST_PCT" index_pct "$INDEX_PCT" part_pct "$PART_PCT" parts "$PARTS" \
+			size_provider "$SIZE_PROVIDER" simulated_latency_us "$SIMULATED_LATENCY" \
+			active "$active" cycles "$CYCLES" init_refresh_ms "$init_ms" \
+			cycle_p50_ms "$p50" cycle_max_ms "$max" init_rss_kb "$init_rss" rss_kb "$rss" |
+			tee -a "$OUTPUT"
+	done
+	stop_instance
+}
+
+for ntables in $SIZES; do
+	run_size "$ntables"
+done
@@ -0,0 +1,210 @@
+/* -------------------------------------------------------------------------
+ *
+ * capture.c
+ *
+ * Optional capture of the active table event stream.  When
+ * diskquota.capture_directory is set, every smgr event reported to diskquota
+ * is also appended to a per-backend binary file in that directory, see
+ * capture.h for the format.  Captures are fed to tools/replay to compare
+ * naptime, map sizes and refresh budgets on real traffic offline.
+ *
+ * Records are buffered, and flushed when the buffer is full, at least
+ * every second while events keep coming, and at process exit.
+ *
+ * Copyright (C) 2013, PostgreSQL Global Development Group
+ *
+ *
+ * -------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "access/transam.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+
+#include "capture.h"
+
+#define CAPTURE_BUFFER_RECORDS 256
+/* interval to flush buffered records, in ms */
+#define CAPTURE_FLUSH_INTERVAL 1000
+
+/* GUC variables */
+char	   *diskquota_capture_directory = NULL;
+
+static int	capture_fd = -1;
+/* directory of the opened capture file */
+static char *capture_opened_directory = NULL;
+/* set when the capture file could not be written, until the directory is changed */
+static bool capture_failed = false;
+static bool capture_exit_registered = false;
+static CaptureRecord capture_buffer[CAPTURE_BUFFER_RECORDS];
+static int	capture_nbuffered = 0;
+static TimestampTz capture_last_flush = 0;
+
+static bool open_capture_file(void);
+static void flush_capture_buffer(void);
+static void close_capture_file(void);
+static void capture_exit(int code, Datum arg);
+
+/*
+ * Define the GUC of event capture.
+ * Called from _PG_init().
+ */
+void
+init_capture(void)
+{
+	DefineCustomStringVariable("diskquota.capture_directory",
+							   "Directory to capture active table events into, empty to disable capture.",
+							   NULL,
+							   &diskquota_capture_directory,
+							   "",
+							   PGC_SIGHUP,
+							   0,
+							   NULL,
+							   NULL,
+							   NULL);
+}
+
+/*
+ * Open the capture file of current backend and write the file header.
+ */
+static bool
+open_capture_file(void)
+{
+	char		path[MAXPGPATH];
+	CaptureFileHeader header;
+
+	snprintf(path, MAXPGPATH, "%s/%d_" INT64_FORMAT CAPTURE_FILE_SUFFIX,
+			 diskquota_capture_directory, MyProcPid, (int64) GetCurrentTimestamp());
+
+	capture_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | PG_BINARY, S_IRUSR | S_IWUSR);
+	if (capture_fd < 0)
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("[diskquota] could not open capture file \"%s\": %m", path)));
+		return false;
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = CAPTURE_MAGIC;
+	header.version = CAPTURE_VERSION;
+	header.record_size = sizeof(CaptureRecord);
+	header.block_size = BLCKSZ;
+	header.pid = MyProcPid;
+	if (write(capture_fd, &header, sizeof(header)) != sizeof(header))
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("[diskquota] could not write capture file \"%s\": %m", path)));
+		close(capture_fd);
+		capture_fd = -1;
+		return false;
+	}
+
+	if (capture_opened_directory)
+		pfree(capture_opened_directory);
+	capture_opened_directory = MemoryContextStrdup(TopMemoryContext,
+												   diskquota_capture_directory);
+	if (!capture_exit_registered)
+	{
+		on_proc_exit(capture_exit, (Datum) 0);
+		capture_exit_registered = true;
+	}
+	return true;
+}
+
+static void
+flush_capture_buffer(void)
+{
+	ssize_t		len = sizeof(CaptureRecord) * capture_nbuffered;
+
+	if (capture_fd >= 0 && capture_nbuffered > 0 &&
+		write(capture_fd, capture_buffer, len) != len)
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("[diskquota] could not write capture file, capture is stopped: %m")));
+		capture_failed = true;
+		close(capture_fd);
+		capture_fd = -1;
+	}
+	capture_nbuffered = 0;
+	capture_last_flush = GetCurrentTimestamp();
+}
+
+static void
+close_capture_file(void)
+{
+	flush_capture_buffer();
+	if (capture_fd >= 0)
+		close(capture_fd);
+	capture_fd = -1;
+}
+
+static void
+capture_exit(pg_attribute_unused() int code, pg_attribute_unused() Datum arg)
+{
+	close_capture_file();
+}
+
+/*
+ * Capture one smgr event.  Only the events of user relations are captured,
+ * which are the ones the active table map sees.
+ */
+void
+capture_smgr_event(SMgrRelation reln, ForkNumber forknum, BlockNumber block, int op)
+{
+	CaptureRecord *record;
+	TimestampTz now;
+
+	if (diskquota_capture_directory == NULL || diskquota_capture_directory[0] == '\0')
+	{
+		if (capture_fd >= 0)
+			close_capture_file();
+		return;
+	}
+
+	if (reln->smgr_rnode.node.relNode < FirstNormalObjectId)
+		return;
+
+	/* capture directory is changed by reloading configuration */
+	if (capture_opened_directory != NULL &&
+		strcmp(capture_opened_directory, diskquota_capture_directory) != 0)
+	{
+		close_capture_file();
+		pfree(capture_opened_directory);
+		capture_opened_directory = NULL;
+		capture_failed = false;
+	}
+
+	if (capture_failed)
+		return;
+	if (capture_fd < 0 && !open_capture_file())
+	{
+		capture_failed = true;
+		return;
+	}
+
+	now = GetCurrentTimestamp();
+	record = &capture_buffer[capture_nbuffered++];
+	memset(record, 0, sizeof(CaptureRecord));
+	record->timestamp = now +
+		((int64) (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY * USECS_PER_SEC);
+	record->spcnode = reln->smgr_rnode.node.spcNode;
+	record->dbnode = reln->smgr_rnode.node.dbNode;
+	record->relnode = reln->smgr_rnode.node.relNode;
+	record->block = block;
+	record->fork = (int8) forknum;
+	record->op = (uint8) op;
+
+	if (capture_nbuffered >= CAPTURE_BUFFER_RECORDS ||
+		TimestampDifferenceExceeds(capture_last_flush, now, CAPTURE_FLUSH_INTERVAL))
+		flush_capture_buffer();
+}
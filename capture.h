@@ -0,0 +1,64 @@
+/* -------------------------------------------------------------------------
+ *
+ * capture.h
+ *
+ * Binary format of the active table event capture.  It is shared by the
+ * capture in diskquota hooks and the offline replay tool, so it must not
+ * depend on backend headers.
+ *
+ * A capture file starts with a CaptureFileHeader, followed by
+ * CaptureRecords in the order the backend reported the events.  Each
+ * backend writes its own file.
+ *
+ * Copyright (C) 2013, PostgreSQL Global Development Group
+ *
+ *
+ * -------------------------------------------------------------------------
+ */
+#ifndef DISKQUOTA_CAPTURE_H
+#define DISKQUOTA_CAPTURE_H
+
+#define CAPTURE_MAGIC 0x50414351	/* "QCAP" */
+#define CAPTURE_VERSION 1
+#define CAPTURE_FILE_SUFFIX ".dqcap"
+
+/* values of CaptureRecord.op, same as ActiveType */
+#define CAPTURE_OP_CREATE 1
+#define CAPTURE_OP_EXTEND 2
+#define CAPTURE_OP_TRUNCATE 3
+#define CAPTURE_OP_UNLINK 4
+
+typedef struct CaptureFileHeader
+{
+	uint32		magic;
+	uint32		version;
+	uint32		record_size;	/* sizeof(CaptureRecord) */
+	uint32		block_size;		/* BLCKSZ of the server */
+	int32		pid;			/* backend which wrote the file */
+	uint32		padding;
+} CaptureFileHeader;
+
+typedef struct CaptureRecord
+{
+	int64		timestamp;		/* microseconds since the Unix epoch */
+	uint32		spcnode;
+	uint32		dbnode;
+	uint32		relnode;
+	uint32		block;			/* extended block, or new number of blocks on truncate */
+	int8		fork;			/* -1 on unlink, which is for all the forks */
+	uint8		op;				/* CAPTURE_OP_* */
+	uint16		padding;
+	uint32		padding2;
+} CaptureRecord;
+
+#ifndef FRONTEND
+#include "storage/smgr.h"
+
+extern char *diskquota_capture_directory;
+
+extern void init_capture(void);
+extern void capture_smgr_event(SMgrRelation reln, ForkNumber forknum,
+							   BlockNumber block, int op);
+#endif
+
+#endif
@@ -0,0 +1,102 @@
+/* contrib/diskquota/diskquota--1.0--1.1.sql */
+
+-- complain if script is sourced in psql, rather than via ALTER EXTENSION
+\echo Use "ALTER EXTENSION diskquota UPDATE TO '1.1'" to load this file. \quit
+
+-- Quota rules matching schema or role names by LIKE pattern
+create table diskquota.quota_rule (quotatype int, pattern text, quotalimitMB int8, PRIMARY KEY(quotatype, pattern));
+
+SELECT pg_catalog.pg_extension_config_dump('diskquota.quota_rule', '');
+
+-- Notify diskquota worker to reload quota setting
+CREATE FUNCTION diskquota.quota_config_changed()
+RETURNS trigger
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+CREATE TRIGGER quota_config_changed AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE
+ON diskquota.quota_config FOR EACH STATEMENT
+EXECUTE PROCEDURE diskquota.quota_config_changed();
+
+CREATE TRIGGER quota_rule_changed AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE
+ON diskquota.quota_rule FOR EACH STATEMENT
+EXECUTE PROCEDURE diskquota.quota_config_changed();
+
+CREATE FUNCTION diskquota.set_database_quota(text)
+RETURNS void STRICT
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+CREATE FUNCTION diskquota.set_schema_quotas(text[], text[])
+RETURNS void STRICT
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+CREATE FUNCTION diskquota.set_role_quotas(text[], text[])
+RETURNS void STRICT
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+CREATE FUNCTION diskquota.set_schema_quota_rule(text, text)
+RETURNS void STRICT
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+CREATE FUNCTION diskquota.set_role_quota_rule(text, text)
+RETURNS void STRICT
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+CREATE FUNCTION diskquota.headroom(target oid, quotatype int4 DEFAULT 0,
+	OUT quota_in_mb int8, OUT usage_in_bytes int8, OUT headroom_in_bytes int8, OUT staleness interval)
+RETURNS record STRICT
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+CREATE FUNCTION diskquota.refresh(target oid DEFAULT NULL, wait bool DEFAULT true, quotatype int4 DEFAULT 0)
+RETURNS void
+AS 'MODULE_PATHNAME', 'diskquota_refresh'
+LANGUAGE C;
+
+CREATE FUNCTION diskquota.worker_status(
+	OUT dbid oid, OUT pid int4, OUT refresh_count int8, OUT last_refresh_time timestamptz,
+	OUT init_refresh_ms float8, OUT last_refresh_ms float8, OUT num_tables int8)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+CREATE FUNCTION diskquota.database_usage(
+	OUT dbid oid, OUT usage_in_bytes int8, OUT quota_in_mb int8, OUT last_refresh_time timestamptz)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+CREATE FUNCTION diskquota.relation_activity(
+	OUT relid oid, OUT size_in_bytes int8, OUT first_seen timestamptz,
+	OUT last_extended timestamptz, OUT last_truncated timestamptz)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+CREATE FUNCTION diskquota.wal_usage(
+	OUT targetoid oid, OUT quotatype int4, OUT wal_bytes int8, OUT wal_bytes_per_sec float8)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+CREATE FUNCTION diskquota.reclaimable_tables(
+	OUT targetoid oid, OUT quotatype int4, OUT quota_in_mb int8, OUT usage_in_bytes int8,
+	OUT target_reclaimable_in_bytes int8, OUT relid oid, OUT table_size_in_bytes int8,
+	OUT reclaimable_in_bytes int8)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+CREATE VIEW diskquota.show_reclaimable_view AS
+SELECT CASE WHEN r.quotatype = 0 THEN pg_namespace.nspname ELSE pg_roles.rolname END as target_name,
+	r.quotatype, r.quota_in_mb, r.usage_in_bytes, r.target_reclaimable_in_bytes,
+	r.relid::regclass as table_name, r.table_size_in_bytes, r.reclaimable_in_bytes
+FROM diskquota.reclaimable_tables() as r
+	LEFT JOIN pg_namespace ON r.quotatype = 0 and pg_namespace.oid = r.targetoid
+	LEFT JOIN pg_roles ON r.quotatype = 1 and pg_roles.oid = r.targetoid
+ORDER BY r.reclaimable_in_bytes DESC;
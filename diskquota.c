@@ -16,6 +16,7 @@
 
 #include "access/tupdesc.h"
 #include "access/xact.h"
+#include "access/xlog.h"
 #include "catalog/indexing.h"
 #include "catalog/namespace.h"
 #include "catalog/objectaccess.h"
@@ -25,6 +26,7 @@
 #include "catalog/pg_type.h"
 #include "commands/dbcommands.h"
 #include "commands/extension.h"
+#include "commands/trigger.h"
 #include "executor/spi.h"
 #include "miscadmin.h"
 #include "nodes/makefuncs.h"
@@ -32,25 +34,43 @@
 #include "postmaster/bgworker.h"
 #include "storage/ipc.h"
 #include "tcop/utility.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/fmgroids.h"
 #include "utils/formatting.h"
+#include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/numeric.h"
 #include "utils/snapmgr.h"
 #include "utils/syscache.h"
+#include "utils/timestamp.h"
 
 #include "activetable.h"
+#include "capture.h"
 #include "diskquota.h"
+#include "federation.h"
+#include "fswatch.h"
+#include "pg_utils.h"
+#include "sizeservice.h"
+#include "walusage.h"
 PG_MODULE_MAGIC;
 
 /* disk quota helper function */
 PG_FUNCTION_INFO_V1(set_schema_quota);
 PG_FUNCTION_INFO_V1(set_role_quota);
+PG_FUNCTION_INFO_V1(set_database_quota);
+PG_FUNCTION_INFO_V1(set_schema_quotas);
+PG_FUNCTION_INFO_V1(set_role_quotas);
+PG_FUNCTION_INFO_V1(set_schema_quota_rule);
+PG_FUNCTION_INFO_V1(set_role_quota_rule);
+PG_FUNCTION_INFO_V1(quota_config_changed);
 PG_FUNCTION_INFO_V1(diskquota_start_worker);
+PG_FUNCTION_INFO_V1(diskquota_refresh);
 
 /* timeout count to wait response from launcher process, in 1/10 sec */
 #define WAIT_TIME_COUNT  120
+/* interval to check whether the requested refresh is finished, in ms */
+#define REFRESH_WAIT_INTERVAL 10
 
 /* flags set by signal handlers */
 static volatile sig_atomic_t got_sighup = false;
@@ -63,6 +83,9 @@ static volatile sig_atomic_t got_sigusr1 = false;
 int	diskquota_naptime = 0;
 char *diskquota_monitored_database_list = NULL;
 int diskquota_max_active_tables = MAX_DISK_QUOTA_ACTIVE_ENTRIES;
+bool		diskquota_hot_standby = false;
+int			diskquota_reclaim_threshold = 90;
+bool		diskquota_utility_headroom_check = false;
 
 typedef struct DiskQuotaWorkerEntry DiskQuotaWorkerEntry;
 
@@ -80,6 +103,8 @@ volatile MessageBox * message_box = NULL;
 static HTAB *disk_quota_worker_map = NULL;
 static object_access_hook_type next_object_access_hook;
 static int num_db = 0;
+/* set when quota_config or quota_rule is modified in current transaction */
+static bool quota_config_is_changed = false;
 
 /* functions of disk quota*/
 void _PG_init(void);
@@ -91,12 +116,18 @@ static void disk_quota_sigterm(SIGNAL_ARGS);
 static void disk_quota_sighup(SIGNAL_ARGS);
 static int64 get_size_in_mb(char *str);
 static void set_quota_internal(Oid targetoid, int64 quota_limit_mb, QuotaType type);
+static void set_quotas_internal(Oid *targetoids, int64 *quota_limit_mbs, int num, QuotaType type);
+static void set_quota_rule_internal(char *pattern, int64 quota_limit_mb, QuotaType type);
+static Datum set_quotas_common(FunctionCallInfo fcinfo, QuotaType type);
+static Datum set_quota_rule_common(FunctionCallInfo fcinfo, QuotaType type);
+static void dq_xact_callback(XactEvent event, void *arg);
 static int start_worker_by_dboid(Oid dbid);
 static void create_monitor_db_table();
 static inline void exec_simple_utility(const char *sql);
 static void exec_simple_spi(const char *sql, int expected_code);
 static bool add_db_to_config(Oid dbid);
 static void del_db_from_config(Oid dbid);
+static void try_kill_db_worker(Oid dbid);
 static void process_message_box(void);
 static void process_message_box_internal(MessageResult *code);
 static void dq_object_access_hook(ObjectAccessType access, Oid classId,
@@ -154,14 +185,72 @@ _PG_init(void)
 							NULL,
 							NULL);
 
+	DefineCustomBoolVariable("diskquota.hot_standby",
+							 "Run diskquota workers on hot standby to keep the quota model warm.",
+							 "Active tables are collected from WAL redo, so that quota is "
+							 "enforced without a full refresh after promotion.",
+							 &diskquota_hot_standby,
+							 false,
+							 PGC_POSTMASTER,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomIntVariable("diskquota.reclaim_estimate_threshold",
+							"Usage in percent of quota limit, above which the space VACUUM could "
+							"reclaim is estimated for the tables of a schema or role.",
+							"0 disables the estimate.",
+							&diskquota_reclaim_threshold,
+							90,
+							0,
+							100,
+							PGC_SIGHUP,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomBoolVariable("diskquota.utility_headroom_check",
+							 "Reject rewriting commands whose relation is larger than the headroom.",
+							 "VACUUM FULL, CLUSTER, REINDEX, REFRESH MATERIALIZED VIEW and rewriting "
+							 "ALTER TABLE need a new copy of the relation until they commit.",
+							 &diskquota_utility_headroom_check,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
 	/* Add dq_object_access_hook to handle drop extension event.*/
 	next_object_access_hook = object_access_hook;
 	object_access_hook = dq_object_access_hook;
 
+	/* Notify diskquota worker to reload quota setting after commit */
+	RegisterXactCallback(dq_xact_callback, NULL);
+
+	/* start the processes probing table file sizes for all workers */
+	init_size_provider();
+	init_size_service();
+
+	/* optional capture of active table events for offline replay */
+	init_capture();
+
+	/* optional WAL generation accounting of schemas and roles */
+	init_wal_usage();
+
+	/* optional quota federation across the instances of a host */
+	init_federation();
+
+	/* C API for other extensions */
+	init_diskquota_api();
+
 	/* set up common data for diskquota launcher worker */
 	worker.bgw_flags = BGWORKER_SHMEM_ACCESS |
 		BGWORKER_BACKEND_DATABASE_CONNECTION;
-	worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+	worker.bgw_start_time = diskquota_hot_standby ?
+		BgWorkerStart_ConsistentState : BgWorkerStart_RecoveryFinished;
 	worker.bgw_restart_time = BGW_NEVER_RESTART;
 	sprintf(worker.bgw_library_name, "diskquota");
 	sprintf(worker.bgw_function_name, "disk_quota_launcher_main");
@@ -237,6 +326,9 @@ void
 disk_quota_worker_main(Datum main_arg)
 {
 	char *dbname = MyBgworkerEntry->bgw_extra;
+	TimestampTz next_refresh;
+	int			fswatch_fd = PGINVALID_SOCKET;
+
 	elog(LOG,"[diskquota]:start disk quota worker process to monitor database:%s", dbname);
 
 	/* Establish signal handlers before unblocking signals. */
@@ -252,14 +344,20 @@ disk_quota_worker_main(Datum main_arg)
 
 	/* Initialize diskquota related local hash map and refresh model immediately*/
 	init_disk_quota_model();
+	if (diskquota_active_table_detector == ACTIVE_TABLE_DETECTOR_INOTIFY)
+		fswatch_fd = fswatch_start();
 	refresh_disk_quota_model(true);
 
 	/*
 	 * Main loop: do this until the SIGTERM handler tells us to terminate
 	 */
+	next_refresh = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+											   diskquota_naptime * 1000L);
 	while (!got_sigterm)
 	{
-		int			rc;
+		int			rc = 0;
+		long		secs;
+		int			usecs;
 
 		/*
 		 * Background workers mustn't call usleep() or any direct equivalent:
@@ -267,18 +365,22 @@ disk_quota_worker_main(Datum main_arg)
 		 * necessary, but is awakened if postmaster dies.  That way the
 		 * background process goes away immediately in an emergency.
 		 */
-		rc = WaitLatch(&MyProc->procLatch,
-					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
-					   diskquota_naptime * 1000L, PG_WAIT_EXTENSION);
+		TimestampDifference(GetCurrentTimestamp(), next_refresh, &secs, &usecs);
+		if (!got_sigusr1)
+			rc = WaitLatchOrSocket(&MyProc->procLatch,
+								   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH |
+								   (fswatch_fd != PGINVALID_SOCKET ? WL_SOCKET_READABLE : 0),
+								   fswatch_fd, secs * 1000L + usecs / 1000, PG_WAIT_EXTENSION);
 		ResetLatch(&MyProc->procLatch);
 
-		/* Do the work */
-		refresh_disk_quota_model(false);
-
 		/* emergency bailout if postmaster has died */
 		if (rc & WL_POSTMASTER_DEATH)
 			proc_exit(1);
 
+		/* keep the inotify queue short, so that events are not lost */
+		if (rc & WL_SOCKET_READABLE)
+			fswatch_drain();
+
 		/*
 		 * In case of a SIGHUP, just reload the configuration.
 		 */
@@ -287,6 +389,19 @@ disk_quota_worker_main(Datum main_arg)
 			got_sighup = false;
 			ProcessConfigFile(PGC_SIGHUP);
 		}
+
+		/*
+		 * The latch is also set by the size service, refresh only when
+		 * naptime is elapsed or diskquota.refresh() is called.
+		 */
+		if (!got_sigusr1 && GetCurrentTimestamp() < next_refresh)
+			continue;
+		got_sigusr1 = false;
+
+		/* Do the work */
+		refresh_disk_quota_model(false);
+		next_refresh = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+												   diskquota_naptime * 1000L);
 	}
 
 	diskquota_invalidate_db(MyDatabaseId);
@@ -349,7 +464,12 @@ is_valid_dbid(Oid dbid)
 }
 /*
  * in early stage, start all worker processes of diskquota-enabled databases
- * from diskquota_namespace.database_list
+ * from diskquota_namespace.database_list.
+ *
+ * It is called again after promotion, since CREATE and DROP EXTENSION
+ * replayed on a standby do not notify the launcher.  The workers which are
+ * still running are kept, and the workers of the databases no longer in
+ * the list are terminated.
  */
 static void
 start_workers_from_dblist()
@@ -360,6 +480,9 @@ start_workers_from_dblist()
 	int num = 0;
 	int ret;
 	int i;
+	Oid *listed_dbid;
+	HASH_SEQ_STATUS iter;
+	DiskQuotaWorkerEntry *workerentry;
 	StartTransactionCommand();
 	PushActiveSnapshot(GetTransactionSnapshot());
 	ret = SPI_connect();
@@ -372,12 +495,14 @@ start_workers_from_dblist()
 	if (tupdesc->natts != 1 || tupdesc->attrs[0].atttypid != OIDOID)
 		elog(ERROR, "[diskquota] table database_list corrupt, laucher will exit");
 
-	for (i = 0; num < SPI_processed; i++)
+	listed_dbid = (Oid *) palloc0(sizeof(Oid) * Max(SPI_processed, 1));
+	for (i = 0; i < SPI_processed; i++)
 	{
 		HeapTuple tup;
 		Oid dbid;
 		Datum dat;
 		bool isnull;
+		pid_t pid;
 
 	    tup	= SPI_tuptable->vals[i];
 		dat = SPI_getbinval(tup, tupdesc, 1, &isnull);
@@ -391,13 +516,38 @@ start_workers_from_dblist()
 			fake_dbid[fake_count++] = dbid;
 			continue;
 		}
+		listed_dbid[i] = dbid;
+		num++;
+
+		/* keep the worker started before promotion if it is still running */
+		workerentry = (DiskQuotaWorkerEntry *) hash_search(disk_quota_worker_map,
+														   (void *) &dbid,
+														   HASH_FIND, NULL);
+		if (workerentry != NULL)
+		{
+			if (GetBackgroundWorkerPid(workerentry->handle, &pid) != BGWH_STOPPED)
+				continue;
+			pfree(workerentry->handle);
+			hash_search(disk_quota_worker_map, (void *) &dbid, HASH_REMOVE, NULL);
+		}
 		if (start_worker_by_dboid(dbid) < 1)
 		{
 			elog(WARNING, "[diskquota]: start worker process of database(%d) failed", dbid);
 		}
-		num++;
 	}
 	num_db = num;
+
+	/* the extension is dropped in these databases */
+	hash_seq_init(&iter, disk_quota_worker_map);
+	while ((workerentry = (DiskQuotaWorkerEntry *) hash_seq_search(&iter)) != NULL)
+	{
+		bool listed = false;
+
+		for (i = 0; i < SPI_processed && !listed; i++)
+			listed = (listed_dbid[i] == workerentry->dbid);
+		if (!listed)
+			try_kill_db_worker(workerentry->dbid);
+	}
 	SPI_finish();
 	PopActiveSnapshot();
 	CommitTransactionCommand();
@@ -456,7 +606,7 @@ try_kill_db_worker(Oid dbid)
 static void
 on_add_db(Oid dbid, MessageResult *code)
 {
-	if (num_db >= 10)
+	if (num_db >= MAX_NUM_MONITORED_DB)
 	{
 		*code = ERR_EXCEED;
 		elog(ERROR, "[diskquota] too database to monitor");
@@ -514,6 +664,7 @@ void
 disk_quota_launcher_main(Datum main_arg)
 {
 	HASHCTL		hash_ctl;
+	bool		monitor_db_table_pending = false;
 
 	/* Establish signal handlers before unblocking signals. */
 	pqsignal(SIGHUP, disk_quota_sighup);
@@ -526,7 +677,14 @@ disk_quota_launcher_main(Datum main_arg)
 	message_box->launcher_pid = MyProcPid;
 	/* Connect to our database */
 	BackgroundWorkerInitializeConnection("diskquota", NULL, 0);
-	create_monitor_db_table();
+	/*
+	 * On hot standby the table is replicated from primary, and could not be
+	 * created until promotion.
+	 */
+	if (RecoveryInProgress())
+		monitor_db_table_pending = true;
+	else
+		create_monitor_db_table();
 
 	memset(&hash_ctl, 0, sizeof(hash_ctl));
 	hash_ctl.keysize = sizeof(Oid);
@@ -560,6 +718,17 @@ disk_quota_launcher_main(Datum main_arg)
 		/* emergency bailout if postmaster has died */
 		if (rc & WL_POSTMASTER_DEATH)
 			proc_exit(1);
+		/*
+		 * promoted, workers started on standby keep running with their model,
+		 * and the workers of the databases whose extension is created or
+		 * dropped during recovery are started or terminated
+		 */
+		if (monitor_db_table_pending && !RecoveryInProgress())
+		{
+			create_monitor_db_table();
+			start_workers_from_dblist();
+			monitor_db_table_pending = false;
+		}
 		/* process message box, now someone is holding message_box_lock */
 		if (got_sigusr1)
 		{
@@ -599,7 +768,8 @@ start_worker_by_dboid(Oid dbid)
 	memset(&worker, 0, sizeof(BackgroundWorker));
 	worker.bgw_flags = BGWORKER_SHMEM_ACCESS |
 		BGWORKER_BACKEND_DATABASE_CONNECTION;
-	worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+	worker.bgw_start_time = diskquota_hot_standby ?
+		BgWorkerStart_ConsistentState : BgWorkerStart_RecoveryFinished;
 	worker.bgw_restart_time = BGW_NEVER_RESTART;
 	sprintf(worker.bgw_library_name, "diskquota");
 	sprintf(worker.bgw_function_name, "disk_quota_worker_main");
@@ -705,69 +875,312 @@ set_schema_quota(PG_FUNCTION_ARGS)
 	PG_RETURN_VOID();
 }
 
+/*
+ * Set disk quota limit for current database.  The usage of the database
+ * includes system catalogs and sequences as well as tables.
+ */
+Datum
+set_database_quota(PG_FUNCTION_ARGS)
+{
+	char *sizestr;
+	int64 quota_limit_mb;
+	if (!superuser())
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to set disk quota limit")));
+	}
+
+	sizestr = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	sizestr = str_tolower(sizestr, strlen(sizestr),  DEFAULT_COLLATION_OID);
+	quota_limit_mb = get_size_in_mb(sizestr);
+
+	set_quota_internal(MyDatabaseId, quota_limit_mb, DATABASE_QUOTA);
+	PG_RETURN_VOID();
+}
+
 /*
  * Write the quota limit info into quota_config table under
  * 'diskquota' schema of the current database.
  */
 static void
 set_quota_internal(Oid targetoid, int64 quota_limit_mb, QuotaType type)
+{
+	set_quotas_internal(&targetoid, &quota_limit_mb, 1, type);
+}
+
+/*
+ * Write the quota limit info of many targets into quota_config table
+ * in one statement. Targets whose quota limit is not positive are
+ * removed from quota_config. If a target is given more than once,
+ * the last quota limit wins.
+ */
+static void
+set_quotas_internal(Oid *targetoids, int64 *quota_limit_mbs, int num, QuotaType type)
 {
 	int ret;
-	StringInfoData buf;
-	
-	initStringInfo(&buf);
-	appendStringInfo(&buf,
-					"select * from diskquota.quota_config where targetoid = %u"
-					" and quotatype =%d",
-					targetoid, type);
+	Datum *oid_datums;
+	Datum *limit_datums;
+	Oid argtypes[3];
+	Datum values[3];
+	int i;
+	const char *sql =
+		"with t as (select distinct on (targetoid) targetoid, quotalimitmb"
+		" from unnest($1, $2) with ordinality as t(targetoid, quotalimitmb, ord)"
+		" order by targetoid, ord desc),"
+		" d as (delete from diskquota.quota_config as c using t"
+		" where c.targetoid = t.targetoid and c.quotatype = $3 and t.quotalimitmb <= 0)"
+		" insert into diskquota.quota_config"
+		" select targetoid, $3, quotalimitmb from t where quotalimitmb > 0"
+		" on conflict (targetoid, quotatype) do update set quotalimitmb = excluded.quotalimitmb";
+
+	oid_datums = (Datum *) palloc(num * sizeof(Datum));
+	limit_datums = (Datum *) palloc(num * sizeof(Datum));
+	for (i = 0; i < num; i++)
+	{
+		oid_datums[i] = ObjectIdGetDatum(targetoids[i]);
+		limit_datums[i] = Int64GetDatum(quota_limit_mbs[i]);
+	}
+
+	argtypes[0] = get_array_type(OIDOID);
+	argtypes[1] = get_array_type(INT8OID);
+	argtypes[2] = INT4OID;
+	values[0] = PointerGetDatum(construct_array(oid_datums, num, OIDOID,
+												sizeof(Oid), true, 'i'));
+	values[1] = PointerGetDatum(construct_array(limit_datums, num, INT8OID,
+												sizeof(int64), FLOAT8PASSBYVAL, 'd'));
+	values[2] = Int32GetDatum((int32) type);
 
 	SPI_connect();
 
-	ret = SPI_execute(buf.data, false, 0);
-	if (ret != SPI_OK_SELECT)
-		elog(ERROR, "cannot select quota setting table: error code %d", ret);
+	ret = SPI_execute_with_args(sql, 3, argtypes, values, NULL, false, 0);
+	if (ret != SPI_OK_INSERT)
+		elog(ERROR, "cannot update quota setting table, error code %d", ret);
+
+	/*
+	 * And finish our transaction.
+	 */
+	SPI_finish();
+	return;
+}
+
+/*
+ * Set disk quota limit for many schemas or roles in one call.
+ * sizes could have only one element, which is used for all the targets.
+ */
+static Datum
+set_quotas_common(FunctionCallInfo fcinfo, QuotaType type)
+{
+	ArrayType *namearr = PG_GETARG_ARRAYTYPE_P(0);
+	ArrayType *sizearr = PG_GETARG_ARRAYTYPE_P(1);
+	Datum *names;
+	Datum *sizes;
+	bool *namenulls;
+	bool *sizenulls;
+	int num_names;
+	int num_sizes;
+	Oid *targetoids;
+	int64 *quota_limit_mbs;
+	int i;
+
+	if (!superuser())
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to set disk quota limit")));
+	}
 
-	/* if the schema or role's quota has been set before*/
-	if (SPI_processed == 0 && quota_limit_mb > 0)
+	deconstruct_array(namearr, TEXTOID, -1, false, 'i',
+					  &names, &namenulls, &num_names);
+	deconstruct_array(sizearr, TEXTOID, -1, false, 'i',
+					  &sizes, &sizenulls, &num_sizes);
+	if (num_sizes != 1 && num_sizes != num_names)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("size array must have one element or as many elements as name array")));
+	if (num_names == 0)
+		PG_RETURN_VOID();
+
+	targetoids = (Oid *) palloc(num_names * sizeof(Oid));
+	quota_limit_mbs = (int64 *) palloc(num_names * sizeof(int64));
+	for (i = 0; i < num_names; i++)
 	{
-		resetStringInfo(&buf);
-		initStringInfo(&buf);
-		appendStringInfo(&buf,
-					"insert into diskquota.quota_config values(%u,%d,%ld);",
-					targetoid, type, quota_limit_mb);
-		ret = SPI_execute(buf.data, false, 0);
+		char *name;
+		char *sizestr;
+		int sizeidx = num_sizes == 1 ? 0 : i;
+
+		if (namenulls[i] || sizenulls[sizeidx])
+			ereport(ERROR,
+					(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+					 errmsg("name and size arrays must not contain nulls")));
+
+		name = TextDatumGetCString(names[i]);
+		name = str_tolower(name, strlen(name), DEFAULT_COLLATION_OID);
+		if (type == NAMESPACE_QUOTA)
+			targetoids[i] = get_namespace_oid(name, false);
+		else
+			targetoids[i] = get_role_oid(name, false);
+
+		sizestr = TextDatumGetCString(sizes[sizeidx]);
+		sizestr = str_tolower(sizestr, strlen(sizestr), DEFAULT_COLLATION_OID);
+		quota_limit_mbs[i] = get_size_in_mb(sizestr);
+	}
+
+	set_quotas_internal(targetoids, quota_limit_mbs, num_names, type);
+	PG_RETURN_VOID();
+}
+
+/*
+ * Set disk quota limit for many schemas.
+ */
+Datum
+set_schema_quotas(PG_FUNCTION_ARGS)
+{
+	return set_quotas_common(fcinfo, NAMESPACE_QUOTA);
+}
+
+/*
+ * Set disk quota limit for many roles.
+ */
+Datum
+set_role_quotas(PG_FUNCTION_ARGS)
+{
+	return set_quotas_common(fcinfo, ROLE_QUOTA);
+}
+
+/*
+ * Write the quota rule into quota_rule table under 'diskquota' schema
+ * of the current database. Rule is removed if quota limit is not positive.
+ */
+static void
+set_quota_rule_internal(char *pattern, int64 quota_limit_mb, QuotaType type)
+{
+	int ret;
+	Oid argtypes[3] = {INT4OID, TEXTOID, INT8OID};
+	Datum values[3];
+
+	values[0] = Int32GetDatum((int32) type);
+	values[1] = CStringGetTextDatum(pattern);
+	values[2] = Int64GetDatum(quota_limit_mb);
+
+	SPI_connect();
+
+	if (quota_limit_mb > 0)
+	{
+		ret = SPI_execute_with_args("insert into diskquota.quota_rule values($1, $2, $3)"
+									" on conflict (quotatype, pattern)"
+									" do update set quotalimitmb = excluded.quotalimitmb",
+									3, argtypes, values, NULL, false, 0);
 		if (ret != SPI_OK_INSERT)
-			elog(ERROR, "cannot insert into quota setting table, error code %d", ret);
+			elog(ERROR, "cannot insert into quota rule table, error code %d", ret);
 	}
-	else if (SPI_processed > 0 && quota_limit_mb <= 0)
+	else
 	{
-		resetStringInfo(&buf);
-		initStringInfo(&buf);
-		appendStringInfo(&buf,
-					"delete from diskquota.quota_config where targetoid=%u"
-					" and quotatype=%d;",
-					targetoid, type);
-		ret = SPI_execute(buf.data, false, 0);
+		ret = SPI_execute_with_args("delete from diskquota.quota_rule"
+									" where quotatype = $1 and pattern = $2",
+									2, argtypes, values, NULL, false, 0);
 		if (ret != SPI_OK_DELETE)
-			elog(ERROR, "cannot delete item from quota setting table, error code %d", ret);
+			elog(ERROR, "cannot delete item from quota rule table, error code %d", ret);
 	}
-	else if(SPI_processed > 0 && quota_limit_mb > 0)
+
+	SPI_finish();
+}
+
+/*
+ * Set disk quota limit for all the schemas or roles whose name matches
+ * a LIKE pattern. Quota limit set in quota_config takes precedence, and
+ * the longest matching pattern wins if there are many.
+ */
+static Datum
+set_quota_rule_common(FunctionCallInfo fcinfo, QuotaType type)
+{
+	char *pattern;
+	char *sizestr;
+	int64 quota_limit_mb;
+
+	if (!superuser())
 	{
-		resetStringInfo(&buf);
-		initStringInfo(&buf);
-		appendStringInfo(&buf,
-					"update diskquota.quota_config set quotalimitMB = %ld where targetoid=%u"
-					" and quotatype=%d;",
-					quota_limit_mb, targetoid, type);
-		ret = SPI_execute(buf.data, false, 0);
-		if (ret != SPI_OK_UPDATE)
-			elog(ERROR, "cannot update quota setting table, error code %d", ret);
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to set disk quota limit")));
+	}
+
+	pattern = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	pattern = str_tolower(pattern, strlen(pattern), DEFAULT_COLLATION_OID);
+
+	sizestr = text_to_cstring(PG_GETARG_TEXT_PP(1));
+	sizestr = str_tolower(sizestr, strlen(sizestr), DEFAULT_COLLATION_OID);
+	quota_limit_mb = get_size_in_mb(sizestr);
+
+	set_quota_rule_internal(pattern, quota_limit_mb, type);
+	PG_RETURN_VOID();
+}
+
+/*
+ * Set disk quota rule for schemas.
+ */
+Datum
+set_schema_quota_rule(PG_FUNCTION_ARGS)
+{
+	return set_quota_rule_common(fcinfo, NAMESPACE_QUOTA);
+}
+
+/*
+ * Set disk quota rule for roles.
+ */
+Datum
+set_role_quota_rule(PG_FUNCTION_ARGS)
+{
+	return set_quota_rule_common(fcinfo, ROLE_QUOTA);
+}
+
+/*
+ * Statement level trigger on quota_config and quota_rule.
+ * Diskquota worker reloads quota setting only after it is changed,
+ * see dq_xact_callback().
+ */
+Datum
+quota_config_changed(PG_FUNCTION_ARGS)
+{
+	if (!CALLED_AS_TRIGGER(fcinfo))
+		elog(ERROR, "quota_config_changed: not fired by trigger manager");
+
+	quota_config_is_changed = true;
+	return PointerGetDatum(NULL);
+}
+
+/*
+ * Bump the quota config version of current database after the
+ * transaction which modifies quota setting is committed. The callback
+ * is invoked after the transaction becomes visible, so diskquota
+ * worker will not miss the change when reloading.
+ */
+static void
+dq_xact_callback(XactEvent event, void *arg)
+{
+	DiskQuotaWorkerSlot *slot;
+
+	if (!quota_config_is_changed)
+		return;
+
+	switch (event)
+	{
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_PARALLEL_COMMIT:
+			LWLockAcquire(diskquota_locks.worker_slot_lock, LW_EXCLUSIVE);
+			slot = get_worker_slot(MyDatabaseId);
+			if (slot != NULL)
+				slot->config_version++;
+			LWLockRelease(diskquota_locks.worker_slot_lock);
+			quota_config_is_changed = false;
+			break;
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_ABORT:
+			quota_config_is_changed = false;
+			break;
+		default:
+			break;
 	}
-	/*
-	 * And finish our transaction.
-	 */
-	SPI_finish();
-	return;
 }
 
 /*
@@ -948,6 +1361,108 @@ diskquota_start_worker(PG_FUNCTION_ARGS)
 	PG_RETURN_VOID();
 }
 
+/*
+ * Ask diskquota worker of current database to refresh the disk quota model
+ * immediately. If wait is true, return after a refresh which started after
+ * the call is finished. If target is given, all the tables of the schema
+ * (quotatype 0) or role (quotatype 1) are re-measured by that refresh
+ * instead of relying on active table detection only.  Only superuser
+ * could ask for it, since a refresh re-measures tables of the database.
+ */
+Datum
+diskquota_refresh(PG_FUNCTION_ARGS)
+{
+	DiskQuotaWorkerSlot *slot;
+	bool wait = PG_ARGISNULL(1) ? true : PG_GETARG_BOOL(1);
+	int32 quotatype = PG_ARGISNULL(2) ? NAMESPACE_QUOTA : PG_GETARG_INT32(2);
+	uint64 wait_for;
+	int pid;
+
+	if (!superuser())
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to refresh disk quota model")));
+	}
+
+	if (quotatype != NAMESPACE_QUOTA && quotatype != ROLE_QUOTA)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid quota type: %d", quotatype)));
+
+	LWLockAcquire(diskquota_locks.worker_slot_lock, LW_EXCLUSIVE);
+	slot = get_worker_slot(MyDatabaseId);
+	if (slot == NULL)
+	{
+		LWLockRelease(diskquota_locks.worker_slot_lock);
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("[diskquota] worker process of current database is not running")));
+	}
+	if (!PG_ARGISNULL(0))
+	{
+		int i;
+		Oid targetoid = PG_GETARG_OID(0);
+
+		for (i = 0; i < slot->num_refresh_targets; i++)
+		{
+			if (slot->refresh_targets[i].targetoid == targetoid &&
+				slot->refresh_targets[i].type == (QuotaType) quotatype)
+				break;
+		}
+		if (i == slot->num_refresh_targets)
+		{
+			/* too many requested targets, re-measure all the tables */
+			if (slot->num_refresh_targets >= MAX_REFRESH_TARGETS)
+				slot->refresh_all = true;
+			else
+			{
+				slot->refresh_targets[i].targetoid = targetoid;
+				slot->refresh_targets[i].type = (QuotaType) quotatype;
+				slot->num_refresh_targets++;
+			}
+		}
+	}
+	/* the refresh in progress may have started before the call */
+	wait_for = slot->refresh_started + 1;
+	pid = slot->pid;
+	LWLockRelease(diskquota_locks.worker_slot_lock);
+
+	/* wake up the worker process, see disk_quota_sigusr1() */
+	if (kill(pid, SIGUSR1) != 0)
+		ereport(ERROR,
+				(errmsg("[diskquota] could not signal worker process %d: %m", pid)));
+
+	while (wait)
+	{
+		int rc;
+		bool done = false;
+
+		LWLockAcquire(diskquota_locks.worker_slot_lock, LW_SHARED);
+		slot = get_worker_slot(MyDatabaseId);
+		if (slot == NULL || slot->pid != pid)
+		{
+			LWLockRelease(diskquota_locks.worker_slot_lock);
+			ereport(ERROR,
+					(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+					 errmsg("[diskquota] worker process of current database exited during refresh")));
+		}
+		done = slot->refresh_finished >= wait_for;
+		LWLockRelease(diskquota_locks.worker_slot_lock);
+		if (done)
+			break;
+
+		rc = WaitLatch(&MyProc->procLatch,
+					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					   REFRESH_WAIT_INTERVAL, PG_WAIT_EXTENSION);
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+		ResetLatch(&MyProc->procLatch);
+		CHECK_FOR_INTERRUPTS();
+	}
+	PG_RETURN_VOID();
+}
+
 static void
 process_message_box_internal(MessageResult *code)
 {
@@ -1,12 +1,18 @@
 #ifndef DISK_QUOTA_H
 #define DISK_QUOTA_H
 
+#include "datatype/timestamp.h"
 #include "storage/lwlock.h"
+#include "storage/relfilenode.h"
+
+/* max number of databases which could be monitored at the same time */
+#define MAX_NUM_MONITORED_DB 10
 
 typedef enum
 {
 	NAMESPACE_QUOTA,
-	ROLE_QUOTA
+	ROLE_QUOTA,
+	DATABASE_QUOTA
 } QuotaType;
 
 struct DiskQuotaLocks
@@ -14,8 +20,48 @@ struct DiskQuotaLocks
 	LWLock *active_table_lock;
 	LWLock *black_map_lock;
 	LWLock *message_box_lock;
+	LWLock *usage_map_lock;
+	LWLock *worker_slot_lock;
+	LWLock *size_service_lock;
 };
 typedef struct DiskQuotaLocks DiskQuotaLocks;
+#define DISKQUOTA_LOCK_COUNT 6
+
+/* max number of targets could be requested to be re-measured in one refresh */
+#define MAX_REFRESH_TARGETS 8
+
+/* schema or role whose tables are re-measured by the next refresh */
+struct RefreshTarget
+{
+	Oid			targetoid;
+	QuotaType	type;
+};
+typedef struct RefreshTarget RefreshTarget;
+
+/*
+ * DiskQuotaWorkerSlot is used to publish the state of a diskquota worker
+ * process into shared memory, so that backends of the monitored database
+ * could inspect it without talking to the worker.
+ * Slots are protected by worker_slot_lock.
+ */
+struct DiskQuotaWorkerSlot
+{
+	Oid			dbid;				/* InvalidOid if the slot is free */
+	int			pid;				/* pid of the worker process */
+	TimestampTz	last_refresh_time;	/* end time of the last refresh */
+	int64		init_refresh_duration;	/* duration of the initial refresh, in us */
+	int64		last_refresh_duration;	/* duration of the last refresh, in us */
+	int64		num_tables;			/* number of tables in the model */
+	int64		database_size;		/* disk usage of the database, in bytes */
+	int64		database_quota;		/* quota limit of the database in MB, -1 if none */
+	uint32		config_version;		/* bumped when quota setting is changed */
+	uint64		refresh_started;	/* number of refreshes started */
+	uint64		refresh_finished;	/* number of refreshes finished */
+	bool		refresh_all;		/* re-measure all the tables in next refresh */
+	int			num_refresh_targets;
+	RefreshTarget refresh_targets[MAX_REFRESH_TARGETS];
+};
+typedef struct DiskQuotaWorkerSlot DiskQuotaWorkerSlot;
 
 /*
  * MessageBox is used to store a message for communication between
@@ -63,6 +109,7 @@ typedef enum MessageResult MessageResult;
 
 extern DiskQuotaLocks diskquota_locks;
 extern volatile MessageBox *message_box;
+extern DiskQuotaWorkerSlot *worker_slots;
 
 /* enforcement interface*/
 extern void init_disk_quota_enforcement(void);
@@ -73,11 +120,24 @@ extern void init_disk_quota_shmem(void);
 extern void init_disk_quota_model(void);
 extern void refresh_disk_quota_model(bool force);
 extern bool quota_check_common(Oid reloid);
+extern bool quota_check_targets(Oid nsOid, Oid ownerOid);
+extern bool get_target_headroom(Oid targetoid, QuotaType type, int64 *headroom);
+extern bool get_target_usage(Oid targetoid, QuotaType type, int64 *usage, int64 *limitsize);
+extern bool is_target_blacklisted(Oid nsOid, Oid ownerOid);
+extern DiskQuotaWorkerSlot *get_worker_slot(Oid dbid);
+extern Oid	get_table_oid_by_node(RelFileNode *node);
+
+/* C API interface for other extensions, see diskquota_api.h */
+extern void init_diskquota_api(void);
+extern void blacklist_generation_seen(uint32 generation);
 
 /* quotaspi interface */
 extern void init_disk_quota_hook(void);
 
 extern int   diskquota_naptime;
 extern int   diskquota_max_active_tables;
+extern bool  diskquota_hot_standby;
+extern int   diskquota_reclaim_threshold;
+extern bool  diskquota_utility_headroom_check;
 
 #endif
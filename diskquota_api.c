@@ -0,0 +1,130 @@
+/* -------------------------------------------------------------------------
+ *
+ * diskquota_api.c
+ *
+ * C API of diskquota for other extensions, see diskquota_api.h.  It is a
+ * thin layer over the usage map and the blacklist in shared memory.
+ *
+ * Copyright (C) 2013, PostgreSQL Global Development Group
+ *
+ *
+ * -------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "miscadmin.h"
+#include "utils/rel.h"
+#include "utils/relcache.h"
+
+#include "diskquota.h"
+#include "diskquota_api.h"
+
+/* max number of blacklist callbacks of a backend */
+#define MAX_BLACKLIST_CALLBACKS 8
+
+typedef struct BlacklistCallbackItem
+{
+	DiskQuotaBlacklistCallback callback;
+	void	   *arg;
+} BlacklistCallbackItem;
+
+static bool api_get_usage(Oid targetoid, int quotatype, int64 *usage, int64 *quota_mb);
+static bool api_get_headroom(Oid targetoid, int quotatype, int64 *headroom);
+static bool api_is_blacklisted(Oid relid);
+static bool api_register_blacklist_callback(DiskQuotaBlacklistCallback callback, void *arg);
+
+static DiskQuotaApi diskquota_api = {
+	DISKQUOTA_API_VERSION,
+	api_get_usage,
+	api_get_headroom,
+	api_is_blacklisted,
+	api_register_blacklist_callback
+};
+
+static BlacklistCallbackItem blacklist_callbacks[MAX_BLACKLIST_CALLBACKS];
+static int	num_blacklist_callbacks = 0;
+/* generation of the blacklist of current database last seen by the backend */
+static uint32 seen_blacklist_generation = 0;
+static bool blacklist_generation_known = false;
+
+/*
+ * Export the API through the rendezvous variable.
+ */
+void
+init_diskquota_api(void)
+{
+	DiskQuotaApi **api = (DiskQuotaApi **) find_rendezvous_variable(DISKQUOTA_API_RENDEZVOUS);
+
+	*api = &diskquota_api;
+}
+
+/*
+ * Called whenever the backend reads the blacklist of its database, call the
+ * callbacks if it is changed since it is seen last time.
+ */
+void
+blacklist_generation_seen(uint32 generation)
+{
+	int			i;
+
+	if (blacklist_generation_known && generation == seen_blacklist_generation)
+		return;
+	seen_blacklist_generation = generation;
+	if (!blacklist_generation_known)
+	{
+		blacklist_generation_known = true;
+		return;
+	}
+
+	for (i = 0; i < num_blacklist_callbacks; i++)
+		blacklist_callbacks[i].callback(blacklist_callbacks[i].arg);
+}
+
+static bool
+api_get_usage(Oid targetoid, int quotatype, int64 *usage, int64 *quota_mb)
+{
+	if (quotatype != NAMESPACE_QUOTA && quotatype != ROLE_QUOTA &&
+		quotatype != DATABASE_QUOTA)
+		return false;
+	return get_target_usage(targetoid, (QuotaType) quotatype, usage, quota_mb);
+}
+
+static bool
+api_get_headroom(Oid targetoid, int quotatype, int64 *headroom)
+{
+	if (quotatype != NAMESPACE_QUOTA && quotatype != ROLE_QUOTA &&
+		quotatype != DATABASE_QUOTA)
+		return false;
+	return get_target_headroom(targetoid, (QuotaType) quotatype, headroom);
+}
+
+static bool
+api_is_blacklisted(Oid relid)
+{
+	Relation	rel;
+	Oid			nsOid;
+	Oid			ownerOid;
+
+	rel = RelationIdGetRelation(relid);
+	if (!RelationIsValid(rel))
+		return false;
+	nsOid = rel->rd_rel->relnamespace;
+	ownerOid = rel->rd_rel->relowner;
+	RelationClose(rel);
+
+	return is_target_blacklisted(nsOid, ownerOid);
+}
+
+static bool
+api_register_blacklist_callback(DiskQuotaBlacklistCallback callback, void *arg)
+{
+	if (num_blacklist_callbacks >= MAX_BLACKLIST_CALLBACKS)
+		return false;
+	blacklist_callbacks[num_blacklist_callbacks].callback = callback;
+	blacklist_callbacks[num_blacklist_callbacks].arg = arg;
+	num_blacklist_callbacks++;
+
+	/* changes are reported from now on */
+	(void) is_target_blacklisted(InvalidOid, InvalidOid);
+	return true;
+}
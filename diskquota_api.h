@@ -0,0 +1,98 @@
+/* -------------------------------------------------------------------------
+ *
+ * diskquota_api.h
+ *
+ * C API of diskquota for other extensions.  It is installed into
+ * include/server/extension/diskquota/, and reads the state diskquota
+ * workers publish in shared memory, without SPI or catalog access, so it
+ * is cheap enough to be called for every row batch.
+ *
+ * diskquota exports a DiskQuotaApi through the rendezvous variable
+ * DISKQUOTA_API_RENDEZVOUS when it is loaded by shared_preload_libraries.
+ * A caller should get it by diskquota_get_api() with the version it is
+ * built for.  New functions are only appended, and version is bumped, so
+ * a caller built against an older version keeps working.
+ *
+ * Versions:
+ *	1	get_usage, get_headroom, is_blacklisted and register_blacklist_callback
+ *		of schemas and roles.
+ *	2	DISKQUOTA_DATABASE_QUOTA is accepted by get_usage and get_headroom,
+ *		and is_blacklisted is also true when current database exceeds its
+ *		quota.
+ *
+ * All the functions are about the database the backend is connected to,
+ * as of the last refresh of its diskquota worker.
+ *
+ * Copyright (C) 2013, PostgreSQL Global Development Group
+ *
+ *
+ * -------------------------------------------------------------------------
+ */
+#ifndef DISKQUOTA_API_H
+#define DISKQUOTA_API_H
+
+#include "fmgr.h"
+
+#define DISKQUOTA_API_RENDEZVOUS "diskquota_api"
+#define DISKQUOTA_API_VERSION 2
+
+/* quota types, same as diskquota.quota_config.quotatype */
+#define DISKQUOTA_NAMESPACE_QUOTA 0
+#define DISKQUOTA_ROLE_QUOTA 1
+#define DISKQUOTA_DATABASE_QUOTA 2	/* targetoid is MyDatabaseId, since version 2 */
+
+/*
+ * Called in a backend after it sees the blacklist of its database changed.
+ * The change is seen when the backend checks quota, i.e. before a query or
+ * a utility command writes data, or calls a function of the API.  It must
+ * not throw an error.
+ */
+typedef void (*DiskQuotaBlacklistCallback) (void *arg);
+
+typedef struct DiskQuotaApi
+{
+	int			version;		/* DISKQUOTA_API_VERSION of the loaded diskquota */
+
+	/*
+	 * Get the disk usage in bytes and the quota limit in MB of a schema, a
+	 * role or current database, quota_mb is -1 if it has no limit.  Return
+	 * false if the worker has not measured it.
+	 */
+	bool		(*get_usage) (Oid targetoid, int quotatype, int64 *usage, int64 *quota_mb);
+
+	/*
+	 * Get the headroom in bytes of a schema, a role or current database,
+	 * which is negative once the limit is exceeded.  Return false if it has
+	 * no limit.
+	 */
+	bool		(*get_headroom) (Oid targetoid, int quotatype, int64 *headroom);
+
+	/*
+	 * Check whether the schema or the owner of a relation, or current
+	 * database, is in blacklist, i.e. loading data into it would be
+	 * rejected.  The schema and owner are taken from relcache.
+	 */
+	bool		(*is_blacklisted) (Oid relid);
+
+	/*
+	 * Register a callback on blacklist changes for the rest of the backend
+	 * lifetime.  Return false if too many callbacks are registered.
+	 */
+	bool		(*register_blacklist_callback) (DiskQuotaBlacklistCallback callback, void *arg);
+} DiskQuotaApi;
+
+/*
+ * Get the API of the loaded diskquota, NULL if diskquota is not loaded or
+ * it is older than min_version.
+ */
+static inline DiskQuotaApi *
+diskquota_get_api(int min_version)
+{
+	DiskQuotaApi **api = (DiskQuotaApi **) find_rendezvous_variable(DISKQUOTA_API_RENDEZVOUS);
+
+	if (*api == NULL || (*api)->version < min_version)
+		return NULL;
+	return *api;
+}
+
+#endif
@@ -12,19 +12,55 @@
  */
 #include "postgres.h"
 
+#include "access/genam.h"
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "catalog/indexing.h"
+#include "catalog/namespace.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_index.h"
+#include "catalog/pg_type.h"
+#include "commands/dbcommands.h"
+#include "commands/defrem.h"
 #include "executor/executor.h"
+#include "miscadmin.h"
+#include "optimizer/clauses.h"
+#include "parser/parse_coerce.h"
+#include "parser/parse_expr.h"
+#include "parser/parse_type.h"
 #include "storage/bufmgr.h"
+#include "tcop/utility.h"
+#include "utils/fmgroids.h"
+#include "utils/lsyscache.h"
 #include "utils/rel.h"
+#include "utils/syscache.h"
 
 #include "diskquota.h"
+#include "pg_utils.h"
 
 static bool quota_check_ExecCheckRTPerms(List *rangeTable, bool ereport_on_violation);
+
+static void quota_check_ProcessUtility(PlannedStmt *pstmt, const char *queryString,
+									   ProcessUtilityContext context, ParamListInfo params,
+									   QueryEnvironment *queryEnv, DestReceiver *dest,
+									   char *completionTag);
+static void quota_check_utility_relation(RangeVar *relation, bool rewrite);
+static bool default_is_volatile(Node *raw_default);
+static bool add_column_writes(ColumnDef *coldef);
+static bool alter_column_type_rewrites(Oid relid, AlterTableCmd *cmd);
+static bool column_has_index(Oid relid, const char *colname);
+static bool alter_table_writes(Oid relid, List *cmds, bool *rewrite);
+
+static ExecutorCheckPerms_hook_type prev_ExecutorCheckPerms_hook;
+static ProcessUtility_hook_type prev_ProcessUtility_hook;
+
+#ifndef DISKQUOTA_NO_CORE_HOOKS
 static bool quota_check_ReadBufferExtendCheckPerms(Relation reln, ForkNumber forkNum,
 									   BlockNumber blockNum, ReadBufferMode mode,
 									   BufferAccessStrategy strategy);
 
-static ExecutorCheckPerms_hook_type prev_ExecutorCheckPerms_hook;
 static ReadBufferExtended_hook_type prev_ReadBufferExtended_hook;
+#endif
 
 /*
  * Initialize enforcement hooks.
@@ -36,9 +72,372 @@ init_disk_quota_enforcement(void)
 	prev_ExecutorCheckPerms_hook = ExecutorCheckPerms_hook;
 	ExecutorCheckPerms_hook = quota_check_ExecCheckRTPerms;
 
+	/* enforcement hook before utility command is writing data */
+	prev_ProcessUtility_hook = ProcessUtility_hook;
+	ProcessUtility_hook = quota_check_ProcessUtility;
+
+#ifndef DISKQUOTA_NO_CORE_HOOKS
 	/* enforcement hook during query is loading data*/
 	prev_ReadBufferExtended_hook = ReadBufferExtended_hook;
 	ReadBufferExtended_hook = quota_check_ReadBufferExtendCheckPerms;
+#endif
+}
+
+/*
+ * Enforcement hook function before utility command is running.  Commands
+ * which write a new relation or a new copy of a relation are not seen by
+ * ExecutorCheckPerms_hook, reject them before they start writing if the
+ * schema or owner of the destination is in blacklist.
+ */
+static void
+quota_check_ProcessUtility(PlannedStmt *pstmt, const char *queryString,
+						   ProcessUtilityContext context, ParamListInfo params,
+						   QueryEnvironment *queryEnv, DestReceiver *dest,
+						   char *completionTag)
+{
+	Node	   *parsetree = pstmt->utilityStmt;
+
+	switch (nodeTag(parsetree))
+	{
+		case T_IndexStmt:
+			quota_check_utility_relation(((IndexStmt *) parsetree)->relation, false);
+			break;
+		case T_ReindexStmt:
+			{
+				ReindexStmt *stmt = (ReindexStmt *) parsetree;
+
+				/* REINDEX SCHEMA, SYSTEM and DATABASE are not checked */
+				if (stmt->relation != NULL)
+					quota_check_utility_relation(stmt->relation, true);
+				break;
+			}
+		case T_ClusterStmt:
+			{
+				ClusterStmt *stmt = (ClusterStmt *) parsetree;
+
+				if (stmt->relation != NULL)
+					quota_check_utility_relation(stmt->relation, true);
+				break;
+			}
+		case T_VacuumStmt:
+			{
+				VacuumStmt *stmt = (VacuumStmt *) parsetree;
+				bool		full = false;
+				ListCell   *lc;
+
+				if (!stmt->is_vacuumcmd)
+					break;
+				foreach(lc, stmt->options)
+				{
+					DefElem    *opt = (DefElem *) lfirst(lc);
+
+					if (strcmp(opt->defname, "full") == 0)
+						full = defGetBoolean(opt);
+				}
+				if (!full)
+					break;
+				foreach(lc, stmt->rels)
+				{
+					VacuumRelation *vrel = (VacuumRelation *) lfirst(lc);
+
+					if (vrel->relation != NULL)
+						quota_check_utility_relation(vrel->relation, true);
+				}
+				break;
+			}
+		case T_AlterTableStmt:
+			{
+				AlterTableStmt *stmt = (AlterTableStmt *) parsetree;
+				Oid			relid = RangeVarGetRelid(stmt->relation, NoLock, true);
+				bool		rewrite = false;
+
+				if (alter_table_writes(relid, stmt->cmds, &rewrite))
+					quota_check_utility_relation(stmt->relation, rewrite);
+				break;
+			}
+		case T_CreateTableAsStmt:
+			{
+				IntoClause *into = ((CreateTableAsStmt *) parsetree)->into;
+
+				/* the new relation is owned by current user */
+				if (into->rel->relpersistence != RELPERSISTENCE_TEMP)
+					quota_check_targets(RangeVarGetCreationNamespace(into->rel), GetUserId());
+				break;
+			}
+		case T_RefreshMatViewStmt:
+			quota_check_utility_relation(((RefreshMatViewStmt *) parsetree)->relation, true);
+			break;
+		default:
+			break;
+	}
+
+	if (prev_ProcessUtility_hook)
+		(*prev_ProcessUtility_hook) (pstmt, queryString, context, params,
+									 queryEnv, dest, completionTag);
+	else
+		standard_ProcessUtility(pstmt, queryString, context, params,
+								queryEnv, dest, completionTag);
+}
+
+/*
+ * Check the quota of the schema and owner of an existing relation, which a
+ * utility command is going to write.  If the command writes a new copy of
+ * the relation and diskquota.utility_headroom_check is on, the current size
+ * of the relation is also compared with the headroom of them, and of the
+ * database.
+ */
+static void
+quota_check_utility_relation(RangeVar *relation, bool rewrite)
+{
+	Oid			relid;
+	HeapTuple	tuple;
+	Oid			nsOid;
+	Oid			ownerOid;
+	int64		size;
+	int64		headroom;
+
+	relid = RangeVarGetRelid(relation, NoLock, true);
+	if (!OidIsValid(relid))
+		return;
+
+	quota_check_common(relid);
+
+	if (!rewrite || !diskquota_utility_headroom_check)
+		return;
+
+	tuple = SearchSysCache1(RELOID, ObjectIdGetDatum(relid));
+	if (!HeapTupleIsValid(tuple))
+		return;
+	nsOid = ((Form_pg_class) GETSTRUCT(tuple))->relnamespace;
+	ownerOid = ((Form_pg_class) GETSTRUCT(tuple))->relowner;
+	ReleaseSysCache(tuple);
+
+	size = diskquota_get_table_size_by_oid(relid);
+	if (get_target_headroom(nsOid, NAMESPACE_QUOTA, &headroom) && size > headroom)
+		ereport(ERROR,
+				(errcode(ERRCODE_DISK_FULL),
+				 errmsg("schema's disk space quota is not enough to rewrite relation %s with name:%s",
+						relation->relname, get_namespace_name(nsOid))));
+	if (get_target_headroom(ownerOid, ROLE_QUOTA, &headroom) && size > headroom)
+		ereport(ERROR,
+				(errcode(ERRCODE_DISK_FULL),
+				 errmsg("role's disk space quota is not enough to rewrite relation %s with name:%s",
+						relation->relname, GetUserNameFromId(ownerOid, false))));
+	if (get_target_headroom(MyDatabaseId, DATABASE_QUOTA, &headroom) && size > headroom)
+		ereport(ERROR,
+				(errcode(ERRCODE_DISK_FULL),
+				 errmsg("database's disk space quota is not enough to rewrite relation %s with name:%s",
+						relation->relname, get_database_name(MyDatabaseId))));
+}
+
+/*
+ * Whether a column default is volatile.  Since PG11, a new column with a
+ * non-volatile default is not written, the default is kept in catalog.
+ */
+static bool
+default_is_volatile(Node *raw_default)
+{
+	ParseState *pstate;
+	Node	   *expr;
+	bool		volatile_default;
+
+	if (IsA(raw_default, A_Const))
+		return false;
+	pstate = make_parsestate(NULL);
+	expr = transformExpr(pstate, copyObject(raw_default), EXPR_KIND_COLUMN_DEFAULT);
+	volatile_default = contain_volatile_functions(expr);
+	free_parsestate(pstate);
+	return volatile_default;
+}
+
+/*
+ * Whether a new column is filled with data: a volatile default, an
+ * identity or a serial column, or a primary key or unique index on it.
+ */
+static bool
+add_column_writes(ColumnDef *coldef)
+{
+	ListCell   *lc;
+
+	if (coldef->identity != '\0')
+		return true;
+	if (coldef->raw_default != NULL && default_is_volatile(coldef->raw_default))
+		return true;
+	if (coldef->typeName != NULL && list_length(coldef->typeName->names) == 1)
+	{
+		char	   *typname = strVal(linitial(coldef->typeName->names));
+
+		if (strcmp(typname, "smallserial") == 0 || strcmp(typname, "serial2") == 0 ||
+			strcmp(typname, "serial") == 0 || strcmp(typname, "serial4") == 0 ||
+			strcmp(typname, "bigserial") == 0 || strcmp(typname, "serial8") == 0)
+			return true;
+	}
+	foreach(lc, coldef->constraints)
+	{
+		Constraint *constraint = (Constraint *) lfirst(lc);
+
+		switch (constraint->contype)
+		{
+			case CONSTR_DEFAULT:
+				if (constraint->raw_expr != NULL &&
+					default_is_volatile(constraint->raw_expr))
+					return true;
+				break;
+			case CONSTR_IDENTITY:
+			case CONSTR_PRIMARY:
+			case CONSTR_UNIQUE:
+				return true;
+			default:
+				break;
+		}
+	}
+	return false;
+}
+
+/*
+ * Whether changing the type of a column writes a new copy of the table.
+ * Like ATColumnChangeRequiresRewrite(), a binary coercible type without
+ * USING, e.g. varchar to text, or a longer varchar or varbit, does not.
+ */
+static bool
+alter_column_type_rewrites(Oid relid, AlterTableCmd *cmd)
+{
+	ColumnDef  *coldef = (ColumnDef *) cmd->def;
+	AttrNumber	attnum;
+	Oid			oldtypid;
+	int32		oldtypmod;
+	Oid			oldcollid;
+	Type		newtype;
+	Oid			newtypid;
+	int32		newtypmod;
+
+	if (!OidIsValid(relid) || coldef->raw_default != NULL)
+		return true;
+	attnum = get_attnum(relid, cmd->name);
+	if (attnum == InvalidAttrNumber)
+		return true;
+	get_atttypetypmodcoll(relid, attnum, &oldtypid, &oldtypmod, &oldcollid);
+
+	newtype = LookupTypeName(NULL, coldef->typeName, &newtypmod, true);
+	if (newtype == NULL)
+		return true;
+	newtypid = typeTypeId(newtype);
+	ReleaseSysCache(newtype);
+
+	if (newtypid == oldtypid)
+	{
+		if (newtypmod == oldtypmod)
+			return false;
+		/* only the length limit of these types is checked without rewrite */
+		if (newtypid == VARCHAROID || newtypid == VARBITOID)
+			return !(newtypmod == -1 || (oldtypmod != -1 && newtypmod > oldtypmod));
+		return true;
+	}
+	return !(newtypmod == -1 && IsBinaryCoercible(oldtypid, newtypid));
+}
+
+/*
+ * Whether a column is used by an index of the table, which is rebuilt
+ * when the type of the column is changed even without table rewrite.
+ * Indexes on expressions or with a predicate are taken as using it.
+ */
+static bool
+column_has_index(Oid relid, const char *colname)
+{
+	AttrNumber	attnum;
+	Relation	indexRel;
+	SysScanDesc scan;
+	ScanKeyData key;
+	HeapTuple	tuple;
+	bool		found = false;
+
+	if (!OidIsValid(relid))
+		return false;
+	attnum = get_attnum(relid, colname);
+	if (attnum == InvalidAttrNumber)
+		return false;
+
+	indexRel = heap_open(IndexRelationId, AccessShareLock);
+	ScanKeyInit(&key,
+				Anum_pg_index_indrelid,
+				BTEqualStrategyNumber, F_OIDEQ,
+				ObjectIdGetDatum(relid));
+	scan = systable_beginscan(indexRel, IndexIndrelidIndexId, true,
+							  NULL, 1, &key);
+	while (!found && HeapTupleIsValid(tuple = systable_getnext(scan)))
+	{
+		Form_pg_index index = (Form_pg_index) GETSTRUCT(tuple);
+		int			i;
+
+		if (!heap_attisnull(tuple, Anum_pg_index_indexprs, NULL) ||
+			!heap_attisnull(tuple, Anum_pg_index_indpred, NULL))
+			found = true;
+		for (i = 0; i < index->indnatts && !found; i++)
+			found = (index->indkey.values[i] == attnum);
+	}
+	systable_endscan(scan);
+	heap_close(indexRel, AccessShareLock);
+	return found;
+}
+
+/*
+ * Whether the subcommands of ALTER TABLE write data, and whether any of
+ * them writes a new copy of the table.  Subcommands which only change
+ * the catalog, e.g. adding a nullable column or a column with a constant
+ * default, a check or a foreign key, are not writes.
+ */
+static bool
+alter_table_writes(Oid relid, List *cmds, bool *rewrite)
+{
+	ListCell   *lc;
+	bool		writes = false;
+
+	foreach(lc, cmds)
+	{
+		AlterTableCmd *cmd = (AlterTableCmd *) lfirst(lc);
+
+		switch (cmd->subtype)
+		{
+			case AT_AlterColumnType:
+				if (alter_column_type_rewrites(relid, cmd))
+				{
+					*rewrite = true;
+					writes = true;
+				}
+				else if (column_has_index(relid, cmd->name))
+					writes = true;
+				break;
+			case AT_SetTableSpace:
+			case AT_SetLogged:
+			case AT_SetUnLogged:
+				*rewrite = true;
+				writes = true;
+				break;
+			case AT_AddColumn:
+				if (add_column_writes((ColumnDef *) cmd->def))
+					writes = true;
+				break;
+			case AT_AddIndex:
+				writes = true;
+				break;
+			case AT_AddConstraint:
+				{
+					Constraint *constraint = (Constraint *) cmd->def;
+
+					/* these constraints build an index, unless USING INDEX */
+					if (IsA(constraint, Constraint) &&
+						(constraint->contype == CONSTR_PRIMARY ||
+						 constraint->contype == CONSTR_UNIQUE ||
+						 constraint->contype == CONSTR_EXCLUSION) &&
+						constraint->indexname == NULL)
+						writes = true;
+					break;
+				}
+			default:
+				break;
+		}
+	}
+	return writes;
 }
 
 /*
@@ -73,6 +472,7 @@ quota_check_ExecCheckRTPerms(List *rangeTable, bool ereport_on_violation)
 	return true;
 }
 
+#ifndef DISKQUOTA_NO_CORE_HOOKS
 /*
  * Enformcent hook function when query is loading data. Throws an error if 
  * you try to extend a buffer page, and the quota has been exceeded.
@@ -88,4 +488,4 @@ quota_check_ReadBufferExtendCheckPerms(Relation reln, pg_attribute_unused() Fork
 	quota_check_common(reln->rd_id);
 	return true;
 }
-
+#endif
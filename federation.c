@@ -0,0 +1,351 @@
+/* -------------------------------------------------------------------------
+ *
+ * federation.c
+ *
+ * Host-level quota federation, see federation.h for the file format.
+ *
+ * When diskquota.federation_directory is set, each diskquota worker maps
+ * its own file in the directory and rewrites it after the usage of its
+ * schemas and roles is changed.  In every refresh it reads the files of
+ * the workers of the same database name in the other instances sharing the
+ * directory, and sums their usage by quota type and name.  The worker
+ * evaluates the quota limit of a schema or role against its local usage
+ * plus the usage of the same name elsewhere, so a tenant sharded across
+ * instances gets one budget without any network service.  The other
+ * databases of an instance are separate tenants and never summed.
+ *
+ * Files which have not been updated for FEDERATION_STALE_INTERVAL are
+ * ignored, they are left by workers which have gone away.  Workers on hot
+ * standby do not publish, the primary does it for them.
+ *
+ * Copyright (C) 2013, PostgreSQL Global Development Group
+ *
+ *
+ * -------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "access/hash.h"
+#include "access/xlog.h"
+#include "commands/dbcommands.h"
+#include "miscadmin.h"
+#include "port/atomics.h"
+#include "storage/fd.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+
+#include "federation.h"
+
+/* times to retry reading a file which is being written */
+#define FEDERATION_READ_RETRIES 3
+
+#define FEDERATION_FILE_SIZE \
+	(sizeof(FederationFileHeader) + sizeof(FederatedTarget) * MAX_FEDERATED_TARGETS)
+
+char	   *diskquota_federation_directory = NULL;
+
+/* the mapped file of this worker */
+static FederationFileHeader *federation_file = NULL;
+/* name of current database, which could not be renamed while the worker is connected */
+static char federation_dbname[NAMEDATALEN];
+
+static uint32 federation_instance_id(void);
+static void federation_file_name(char *path, Oid dbid);
+static const char *federation_database_name(void);
+static bool federation_map_file(void);
+static bool federation_read_file(const char *path, const char *dbname, HTAB *usage_map);
+
+/*
+ * Define GUCs of quota federation.
+ */
+void
+init_federation(void)
+{
+	DefineCustomStringVariable("diskquota.federation_directory",
+							   "Directory shared by the instances of a host to federate quota usage, "
+							   "empty to disable federation.",
+							   "Quota limits are evaluated against the usage of the schemas and "
+							   "roles of the same name published by all the instances.",
+							   &diskquota_federation_directory,
+							   "",
+							   PGC_POSTMASTER,
+							   0,
+							   NULL,
+							   NULL,
+							   NULL);
+}
+
+bool
+federation_enabled(void)
+{
+	return diskquota_federation_directory != NULL &&
+		diskquota_federation_directory[0] != '\0';
+}
+
+/*
+ * Identify this instance among the instances of the host.  Instances cloned
+ * by pg_basebackup share the system identifier, but not the data directory.
+ */
+static uint32
+federation_instance_id(void)
+{
+	return DatumGetUInt32(hash_any((const unsigned char *) DataDir, strlen(DataDir)));
+}
+
+static void
+federation_file_name(char *path, Oid dbid)
+{
+	snprintf(path, MAXPGPATH, "%s/" UINT64_FORMAT "_%08x_%u" FEDERATION_FILE_SUFFIX,
+			 diskquota_federation_directory, GetSystemIdentifier(),
+			 federation_instance_id(), dbid);
+}
+
+/*
+ * Get the name of current database, which is looked up on first call in a
+ * transaction.
+ */
+static const char *
+federation_database_name(void)
+{
+	if (federation_dbname[0] == '\0')
+	{
+		char	   *dbname = get_database_name(MyDatabaseId);
+
+		if (dbname == NULL)
+			elog(ERROR, "[diskquota] cache lookup failed for database %u", MyDatabaseId);
+		strlcpy(federation_dbname, dbname, NAMEDATALEN);
+		pfree(dbname);
+	}
+	return federation_dbname;
+}
+
+/*
+ * Create and map the file of this worker.
+ */
+static bool
+federation_map_file(void)
+{
+	char		path[MAXPGPATH];
+	int			fd;
+	void	   *addr;
+
+	federation_file_name(path, MyDatabaseId);
+	fd = open(path, O_RDWR | O_CREAT | PG_BINARY, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0)
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("[diskquota] could not open federation file \"%s\": %m", path)));
+		return false;
+	}
+	if (ftruncate(fd, FEDERATION_FILE_SIZE) != 0)
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("[diskquota] could not resize federation file \"%s\": %m", path)));
+		close(fd);
+		return false;
+	}
+	addr = mmap(NULL, FEDERATION_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("[diskquota] could not map federation file \"%s\": %m", path)));
+		return false;
+	}
+
+	federation_file = (FederationFileHeader *) addr;
+	/* a file left by a previous worker is taken over with its seq */
+	federation_file->seq += federation_file->seq % 2;
+	federation_file->magic = FEDERATION_MAGIC;
+	federation_file->version = FEDERATION_VERSION;
+	federation_file->system_identifier = GetSystemIdentifier();
+	federation_file->instance = federation_instance_id();
+	federation_file->dbid = MyDatabaseId;
+	strlcpy(federation_file->dbname, federation_database_name(), NAMEDATALEN);
+	federation_file->pid = MyProcPid;
+	return true;
+}
+
+/*
+ * Publish the usage of the schemas and roles of current database.
+ */
+void
+federation_publish(FederatedTarget *targets, int num_targets)
+{
+	if (!federation_enabled() || RecoveryInProgress())
+		return;
+	if (federation_file == NULL && !federation_map_file())
+		return;
+
+	if (num_targets > MAX_FEDERATED_TARGETS)
+	{
+		elog(WARNING, "[diskquota] only %d of %d schemas and roles are federated",
+			 MAX_FEDERATED_TARGETS, num_targets);
+		num_targets = MAX_FEDERATED_TARGETS;
+	}
+
+	federation_file->seq++;
+	pg_write_barrier();
+	memcpy(federation_file + 1, targets, sizeof(FederatedTarget) * num_targets);
+	federation_file->num_targets = num_targets;
+	federation_file->update_time = GetCurrentTimestamp();
+	pg_write_barrier();
+	federation_file->seq++;
+}
+
+/*
+ * Sum the usage published by the workers of the same database name in the
+ * other instances by quota type and name into a FederatedUsageEntry map,
+ * which is allocated in current memory context.
+ */
+HTAB *
+federation_collect(void)
+{
+	HASHCTL		ctl;
+	HTAB	   *usage_map;
+	DIR		   *dir;
+	struct dirent *de;
+	const char *dbname;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(FederatedKey);
+	ctl.entrysize = sizeof(FederatedUsageEntry);
+	ctl.hcxt = CurrentMemoryContext;
+	ctl.hash = tag_hash;
+
+	usage_map = hash_create("local map of federated usage",
+							1024,
+							&ctl,
+							HASH_ELEM | HASH_CONTEXT | HASH_FUNCTION);
+
+	if (!federation_enabled())
+		return usage_map;
+
+	dbname = federation_database_name();
+
+	dir = AllocateDir(diskquota_federation_directory);
+	while ((de = ReadDirExtended(dir, diskquota_federation_directory, LOG)) != NULL)
+	{
+		char		path[MAXPGPATH];
+		size_t		len = strlen(de->d_name);
+
+		if (len <= strlen(FEDERATION_FILE_SUFFIX) ||
+			strcmp(de->d_name + len - strlen(FEDERATION_FILE_SUFFIX), FEDERATION_FILE_SUFFIX) != 0)
+			continue;
+
+		snprintf(path, MAXPGPATH, "%s/%s", diskquota_federation_directory, de->d_name);
+		if (!federation_read_file(path, dbname, usage_map))
+			elog(DEBUG1, "[diskquota] federation file \"%s\" is skipped", path);
+	}
+	if (dir != NULL)
+		FreeDir(dir);
+
+	return usage_map;
+}
+
+/*
+ * Add the usage published in a file into usage_map.  Return false if the
+ * file is of this instance or of another database name, stale, invalid or
+ * being written in all the retries.
+ */
+static bool
+federation_read_file(const char *path, const char *dbname, HTAB *usage_map)
+{
+	int			fd;
+	struct stat st;
+	FederationFileHeader *file;
+	FederatedTarget *targets = NULL;
+	uint32		num_targets = 0;
+	bool		consistent = false;
+	int			retry;
+	uint32		i;
+
+	fd = open(path, O_RDONLY | PG_BINARY, 0);
+	if (fd < 0)
+		return false;
+	if (fstat(fd, &st) != 0 || st.st_size < FEDERATION_FILE_SIZE)
+	{
+		close(fd);
+		return false;
+	}
+	file = (FederationFileHeader *) mmap(NULL, FEDERATION_FILE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (file == MAP_FAILED)
+		return false;
+
+	if (file->magic != FEDERATION_MAGIC || file->version != FEDERATION_VERSION ||
+		file->instance == federation_instance_id() ||
+		strncmp(file->dbname, dbname, NAMEDATALEN) != 0 ||
+		TimestampDifferenceExceeds(file->update_time, GetCurrentTimestamp(),
+								   FEDERATION_STALE_INTERVAL * 1000))
+	{
+		munmap(file, FEDERATION_FILE_SIZE);
+		return false;
+	}
+
+	targets = (FederatedTarget *) palloc(sizeof(FederatedTarget) * MAX_FEDERATED_TARGETS);
+	for (retry = 0; retry < FEDERATION_READ_RETRIES && !consistent; retry++)
+	{
+		uint32		seq = file->seq;
+
+		if (seq % 2 != 0)
+		{
+			pg_usleep(1000L);
+			continue;
+		}
+		pg_read_barrier();
+		num_targets = Min(file->num_targets, MAX_FEDERATED_TARGETS);
+		memcpy(targets, file + 1, sizeof(FederatedTarget) * num_targets);
+		pg_read_barrier();
+		consistent = (file->seq == seq);
+	}
+	munmap(file, FEDERATION_FILE_SIZE);
+
+	if (consistent)
+	{
+		for (i = 0; i < num_targets; i++)
+		{
+			FederatedKey key;
+			FederatedUsageEntry *entry;
+			bool		found;
+
+			memset(&key, 0, sizeof(key));
+			key.type = targets[i].type;
+			strlcpy(key.name, targets[i].name, NAMEDATALEN);
+			entry = (FederatedUsageEntry *) hash_search(usage_map, &key, HASH_ENTER, &found);
+			if (!found)
+				entry->usage = 0;
+			entry->usage += targets[i].usage;
+		}
+	}
+	pfree(targets);
+	return consistent;
+}
+
+/*
+ * Remove the file of a database whose diskquota extension is dropped, so
+ * that its usage is not counted by the other instances any more.
+ */
+void
+federation_remove(Oid dbid)
+{
+	char		path[MAXPGPATH];
+
+	if (!federation_enabled())
+		return;
+	federation_file_name(path, dbid);
+	if (unlink(path) != 0 && errno != ENOENT)
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("[diskquota] could not remove federation file \"%s\": %m", path)));
+}
@@ -0,0 +1,84 @@
+/* -------------------------------------------------------------------------
+ *
+ * federation.h
+ *
+ * Host-level quota federation.  Diskquota workers of several PostgreSQL
+ * instances on the same host publish the usage of their schemas and roles
+ * into memory-mapped files of a shared directory, and evaluate quota limits
+ * against the sum of the workers of the same database name in all the
+ * other instances.
+ *
+ * Each worker owns one file named
+ * <system identifier>_<instance id>_<database oid>.dqfed, where the instance
+ * id is a hash of the data directory, so an instance cloned by pg_basebackup
+ * does not take over the files of its origin.
+ * It starts with a FederationFileHeader followed by MAX_FEDERATED_TARGETS
+ * FederatedTarget slots, of which the first num_targets are valid.  The
+ * owner rewrites it under a seqlock: seq is odd while the file is being
+ * written, readers retry if seq is odd or changed while they copied it.
+ *
+ * Copyright (C) 2013, PostgreSQL Global Development Group
+ *
+ *
+ * -------------------------------------------------------------------------
+ */
+#ifndef DISKQUOTA_FEDERATION_H
+#define DISKQUOTA_FEDERATION_H
+
+#include "datatype/timestamp.h"
+#include "utils/hsearch.h"
+
+#define FEDERATION_MAGIC 0x44454651	/* "QFED" */
+#define FEDERATION_VERSION 1
+#define FEDERATION_FILE_SUFFIX ".dqfed"
+/* max number of schemas and roles published by a worker */
+#define MAX_FEDERATED_TARGETS 4096
+/* files not updated for this interval are ignored, in seconds */
+#define FEDERATION_STALE_INTERVAL 300
+/* a worker rewrites its file at least once in this interval, in seconds */
+#define FEDERATION_PUBLISH_INTERVAL 60
+
+typedef struct FederationFileHeader
+{
+	uint32		magic;
+	uint32		version;
+	uint32		seq;			/* odd while the owner is writing */
+	uint32		num_targets;
+	uint64		system_identifier;
+	uint32		instance;		/* files of the same instance are not summed */
+	Oid			dbid;
+	char		dbname[NAMEDATALEN];	/* only the same name is summed */
+	int32		pid;			/* worker which owns the file */
+	TimestampTz update_time;	/* files not updated for a while are ignored */
+} FederationFileHeader;
+
+/* usage of a schema or role, which is identified by name across instances */
+typedef struct FederatedTarget
+{
+	uint32		type;			/* QuotaType */
+	char		name[NAMEDATALEN];
+	int64		usage;			/* disk usage in bytes */
+} FederatedTarget;
+
+/* key of the usage published by other workers */
+typedef struct FederatedKey
+{
+	uint32		type;
+	char		name[NAMEDATALEN];
+} FederatedKey;
+
+typedef struct FederatedUsageEntry
+{
+	FederatedKey key;			/* hash table key */
+	int64		usage;			/* sum of all the other workers */
+} FederatedUsageEntry;
+
+extern char *diskquota_federation_directory;
+
+extern void init_federation(void);
+extern bool federation_enabled(void);
+extern void federation_publish(FederatedTarget *targets, int num_targets);
+extern HTAB *federation_collect(void);
+extern void federation_remove(Oid dbid);
+
+#endif
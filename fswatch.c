@@ -0,0 +1,377 @@
+/* -------------------------------------------------------------------------
+ *
+ * fswatch.c
+ *
+ * Active table detection without the smgr hooks patch.  The diskquota
+ * worker watches the directories of its database in every tablespace with
+ * inotify, and maps the names of created, modified and deleted files back
+ * to relfilenodes.  Nothing is done in the write path of backends.
+ *
+ * The events are drained by the worker while it waits for the next
+ * refresh, and are handed to get_active_tables_stats() as if they were
+ * reported by the smgr hooks.  A file is modified by every write of a
+ * dirty buffer, so an active relfilenode here is one which is written,
+ * not only extended.  If the kernel queue overflows, or a new tablespace
+ * directory is watched, the next refresh re-measures all the tables since
+ * events may have been lost.
+ *
+ * Copyright (C) 2013, PostgreSQL Global Development Group
+ *
+ *
+ * -------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <ctype.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
+
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/transam.h"
+#include "catalog/pg_tablespace.h"
+#include "common/relpath.h"
+#include "miscadmin.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+
+#include "activetable.h"
+#include "fswatch.h"
+
+/* watched directory of current database in a tablespace */
+typedef struct WatchedDirectory
+{
+	int			wd;
+	Oid			spcoid;
+} WatchedDirectory;
+
+/* relfilenode seen in events since last refresh */
+typedef struct FsWatchEntry
+{
+	RelFileNode node;
+	ActiveType	type;
+} FsWatchEntry;
+
+static int	fswatch_fd = -1;
+static List *watched_directories = NIL;
+static HTAB *fswatch_events = NULL;
+/* set when events may have been lost since last refresh */
+static bool fswatch_lost_events = false;
+
+#if defined(__linux__)
+static bool parse_relation_file_name(const char *name, Oid *relnode,
+									 ForkNumber *fork, int *segno);
+static void add_event(Oid spcoid, const char *name, uint32 mask);
+#endif
+
+/*
+ * Start watching in diskquota worker process, returns the inotify file
+ * descriptor to be waited on.  Watches are added by the first refresh.
+ */
+int
+fswatch_start(void)
+{
+	HASHCTL		ctl;
+
+#if defined(__linux__)
+	fswatch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fswatch_fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("[diskquota] could not initialize inotify: %m")));
+#else
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("[diskquota] inotify active table detector is only supported on Linux")));
+#endif
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(RelFileNode);
+	ctl.entrysize = sizeof(FsWatchEntry);
+	ctl.hcxt = TopMemoryContext;
+	ctl.hash = tag_hash;
+	fswatch_events = hash_create("diskquota inotify events",
+								 1024,
+								 &ctl,
+								 HASH_ELEM | HASH_CONTEXT | HASH_FUNCTION);
+	return fswatch_fd;
+}
+
+/*
+ * Watch the directory of current database in every tablespace.  Called in
+ * transaction before fetching active tables, so that directories of newly
+ * created tablespaces are watched.  Returns true if events may have been
+ * lost since last call, then all the tables should be re-measured.
+ */
+bool
+fswatch_refresh_watches(void)
+{
+#if defined(__linux__)
+	Relation	spcRel;
+	HeapScanDesc scan;
+	HeapTuple	tuple;
+	MemoryContext oldcontext;
+	bool		lost;
+
+	/* take the events queued so far before re-measuring */
+	fswatch_drain();
+
+	spcRel = heap_open(TableSpaceRelationId, AccessShareLock);
+	scan = heap_beginscan_catalog(spcRel, 0, NULL);
+	while ((tuple = heap_getnext(scan, ForwardScanDirection)) != NULL)
+	{
+		Form_pg_tablespace spcForm = (Form_pg_tablespace) GETSTRUCT(tuple);
+		Oid			spcoid = spcForm->oid;
+		char	   *path;
+		int			wd;
+		ListCell   *lc;
+		bool		watched = false;
+
+		if (spcoid == GLOBALTABLESPACE_OID)
+			continue;
+
+		path = GetDatabasePath(MyDatabaseId, spcoid);
+		wd = inotify_add_watch(fswatch_fd, path,
+							   IN_CREATE | IN_MODIFY | IN_DELETE |
+							   IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR);
+		if (wd < 0)
+		{
+			/* current database has no directory in this tablespace */
+			if (errno != ENOENT && errno != ENOTDIR)
+				ereport(WARNING,
+						(errcode_for_file_access(),
+						 errmsg("[diskquota] could not watch directory \"%s\": %m", path)));
+			pfree(path);
+			continue;
+		}
+		pfree(path);
+
+		foreach(lc, watched_directories)
+		{
+			if (((WatchedDirectory *) lfirst(lc))->wd == wd)
+				watched = true;
+		}
+		if (!watched)
+		{
+			WatchedDirectory *dir;
+
+			oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+			dir = palloc(sizeof(WatchedDirectory));
+			dir->wd = wd;
+			dir->spcoid = spcoid;
+			watched_directories = lappend(watched_directories, dir);
+			MemoryContextSwitchTo(oldcontext);
+			/* files could be written before the directory is watched */
+			fswatch_lost_events = true;
+		}
+	}
+	heap_endscan(scan);
+	heap_close(spcRel, AccessShareLock);
+
+	lost = fswatch_lost_events;
+	fswatch_lost_events = false;
+	return lost;
+#else
+	return false;
+#endif
+}
+
+/*
+ * Read the queued inotify events and record the relfilenodes of them.
+ */
+void
+fswatch_drain(void)
+{
+#if defined(__linux__)
+	char		buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+	if (fswatch_fd < 0)
+		return;
+
+	for (;;)
+	{
+		ssize_t		len = read(fswatch_fd, buf, sizeof(buf));
+		char	   *ptr;
+
+		if (len < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				ereport(WARNING,
+						(errcode_for_file_access(),
+						 errmsg("[diskquota] could not read inotify events: %m")));
+			return;
+		}
+
+		for (ptr = buf; ptr < buf + len;
+			 ptr += sizeof(struct inotify_event) + ((struct inotify_event *) ptr)->len)
+		{
+			struct inotify_event *event = (struct inotify_event *) ptr;
+			ListCell   *lc;
+
+			if (event->mask & IN_Q_OVERFLOW)
+			{
+				fswatch_lost_events = true;
+				continue;
+			}
+
+			foreach(lc, watched_directories)
+			{
+				WatchedDirectory *dir = (WatchedDirectory *) lfirst(lc);
+
+				if (dir->wd != event->wd)
+					continue;
+				if (event->mask & IN_IGNORED)
+				{
+					/* directory is removed, e.g. tablespace is dropped */
+					watched_directories = list_delete_ptr(watched_directories, dir);
+					pfree(dir);
+				}
+				else if (event->len > 0)
+					add_event(dir->spcoid, event->name, event->mask);
+				break;
+			}
+		}
+	}
+#endif
+}
+
+#if defined(__linux__)
+/*
+ * Parse a relation file name "<relfilenode>[_<fork>][.<segno>]".  Other
+ * files in the database directory, including the ones of temporary
+ * relations, are not matched.
+ */
+static bool
+parse_relation_file_name(const char *name, Oid *relnode, ForkNumber *fork, int *segno)
+{
+	const char *p = name;
+	unsigned long value = 0;
+
+	if (!isdigit((unsigned char) *p))
+		return false;
+	while (isdigit((unsigned char) *p))
+	{
+		value = value * 10 + (*p - '0');
+		if (value > PG_UINT32_MAX)
+			return false;
+		p++;
+	}
+	*relnode = (Oid) value;
+
+	*fork = MAIN_FORKNUM;
+	if (*p == '_')
+	{
+		int			n = forkname_chars(p + 1, fork);
+
+		if (n == 0)
+			return false;
+		p += n + 1;
+	}
+
+	*segno = 0;
+	if (*p == '.')
+	{
+		p++;
+		if (!isdigit((unsigned char) *p))
+			return false;
+		*segno = atoi(p);
+		while (isdigit((unsigned char) *p))
+			p++;
+	}
+	return *p == '\0';
+}
+
+/*
+ * Record the relfilenode of an event.  Creation and removal of the first
+ * segment of the main fork is the creation and unlink of the relfilenode,
+ * other events change its size.
+ */
+static void
+add_event(Oid spcoid, const char *name, uint32 mask)
+{
+	RelFileNode node;
+	ForkNumber	fork;
+	int			segno;
+	FsWatchEntry *entry;
+	bool		found;
+	ActiveType	type = AT_EXTEND;
+
+	if (!parse_relation_file_name(name, &node.relNode, &fork, &segno))
+		return;
+
+	/* ignore the system table relfilenode, same as the smgr hooks */
+	if (node.relNode < FirstNormalObjectId)
+		return;
+	node.spcNode = spcoid;
+	node.dbNode = MyDatabaseId;
+
+	if (fork == MAIN_FORKNUM && segno == 0)
+	{
+		if (mask & (IN_CREATE | IN_MOVED_TO))
+			type = AT_CREATE;
+		else if (mask & (IN_DELETE | IN_MOVED_FROM))
+			type = AT_UNLINK;
+	}
+
+	entry = hash_search(fswatch_events, &node, HASH_FIND, &found);
+	if (entry == NULL)
+	{
+		if (hash_get_num_entries(fswatch_events) >= diskquota_max_active_tables)
+		{
+			/* We may miss the file size change of this relation, re-measure all. */
+			fswatch_lost_events = true;
+			return;
+		}
+		entry = hash_search(fswatch_events, &node, HASH_ENTER, &found);
+	}
+	entry->type = type;
+}
+#endif
+
+/*
+ * Move the relfilenodes recorded since last call into the local active
+ * table map of get_active_tables_stats(), or discard them if the map is
+ * NULL.
+ */
+void
+fswatch_move_events(HTAB *active_table_file_map)
+{
+	HASH_SEQ_STATUS iter;
+	FsWatchEntry *event;
+
+	if (fswatch_events == NULL)
+		return;
+
+	hash_seq_init(&iter, fswatch_events);
+	while ((event = (FsWatchEntry *) hash_seq_search(&iter)) != NULL)
+	{
+		if (active_table_file_map != NULL)
+		{
+			DiskQuotaActiveTableFileEntry *entry;
+
+			entry = hash_search(active_table_file_map, &event->node, HASH_ENTER, NULL);
+			entry->node = event->node;
+			entry->inXreloid = InvalidOid;
+			entry->inXnamespace = InvalidOid;
+			entry->inXowner = InvalidOid;
+			entry->ispushedback = false;
+			switch (event->type)
+			{
+				case AT_CREATE:
+					entry->tablestatus = TABLE_COMMIT_CREATE;
+					break;
+				case AT_UNLINK:
+					entry->tablestatus = TABLE_COMMIT_DELETE;
+					break;
+				default:
+					entry->tablestatus = TABLE_COMMIT_CHANGE;
+					break;
+			}
+		}
+		hash_search(fswatch_events, &event->node, HASH_REMOVE, NULL);
+	}
+}
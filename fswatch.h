@@ -0,0 +1,23 @@
+/* -------------------------------------------------------------------------
+ *
+ * fswatch.h
+ *
+ * Active table detection by watching the database directories with
+ * inotify, for servers without the smgr hooks patch.
+ *
+ * Copyright (C) 2013, PostgreSQL Global Development Group
+ *
+ *
+ * -------------------------------------------------------------------------
+ */
+#ifndef DISKQUOTA_FSWATCH_H
+#define DISKQUOTA_FSWATCH_H
+
+#include "utils/hsearch.h"
+
+extern int	fswatch_start(void);
+extern void fswatch_drain(void);
+extern bool fswatch_refresh_watches(void);
+extern void fswatch_move_events(HTAB *active_table_file_map);
+
+#endif
@@ -12,22 +12,39 @@
 
 #include "postgres.h"
 
+#include "access/hash.h"
+#include "access/heapam.h"
 #include "miscadmin.h"
 #include "fmgr.h"
-#include "utils/fmgrprotos.h"
+#include "nodes/pg_list.h"
+#include "storage/bufmgr.h"
+#include "storage/freespace.h"
+#include "storage/lmgr.h"
+#include "utils/guc.h"
+#include "utils/rel.h"
+#include "utils/relcache.h"
 
 #include "pg_utils.h"
+#include "sizeservice.h"
 
 #include <sys/stat.h>
 
-int64 diskquota_get_table_size_by_oid(Oid oid);
-int64 diskquota_get_table_size_by_relfilenode(RelFileNode *rfh);
+int         diskquota_size_provider = SIZE_PROVIDER_FILESYSTEM;
+int         diskquota_simulated_latency = 0;
+int         diskquota_simulated_min_size = 8;
+int         diskquota_simulated_max_size = 1024;
+
+static void size_batch_add_node(RelationSizeBatch *batch, RelFileNodeBackend *rnode, int64 *result);
+static void size_batch_add_relation_nodes(RelationSizeBatch *batch, Relation rel, int64 *result);
+
 /*
- * calculate size of (one fork of) a table in transaction
+ * calculate size of the given forks of a relfilenode by stat()ing its
+ * segment files.
  * This function is following calculate_relation_size()
  */
-int64
-diskquota_get_table_size_by_relfilenode(RelFileNode *rfn)
+static int64
+filesystem_relfilenode_size(RelFileNodeBackend *rnode, int forks,
+							int elevel, void (*before_probe) (void))
 {
     int64       totalsize = 0;
     ForkNumber  forkNum;
@@ -38,7 +55,10 @@ diskquota_get_table_size_by_relfilenode(RelFileNode *rfn)
 
     for (forkNum = 0; forkNum <= MAX_FORKNUM; forkNum++)
     {
-        relationpath = relpathperm(*rfn, forkNum);
+        if ((forks & (1 << forkNum)) == 0)
+            continue;
+
+        relationpath = relpath(*rnode, forkNum);
         size = 0;
 
         for (segcount = 0;; segcount++)
@@ -54,18 +74,23 @@ diskquota_get_table_size_by_relfilenode(RelFileNode *rfn)
                 snprintf(pathname, MAXPGPATH, "%s.%u",
                          relationpath, segcount);
 
+            if (before_probe)
+                before_probe();
+
             if (stat(pathname, &fst) < 0)
             {
                 if (errno == ENOENT)
                     break;
-                else
-                    ereport(ERROR,
-                            (errcode_for_file_access(),
-                                errmsg("could not stat file \"%s\": %m", pathname)));
+                ereport(elevel,
+                        (errcode_for_file_access(),
+                            errmsg("could not stat file \"%s\": %m", pathname)));
+                pfree(relationpath);
+                return -1;
             }
             size += fst.st_size;
         }
 
+        pfree(relationpath);
         totalsize += size;
     }
 
@@ -73,24 +98,298 @@ diskquota_get_table_size_by_relfilenode(RelFileNode *rfn)
 }
 
 /*
- * Function to calculate the total relation size
+ * Make up the size of a relfilenode for tests and benchmarks.  The size is
+ * stable for a relfilenode, and spread between diskquota.simulated_min_size
+ * and diskquota.simulated_max_size.  Each probe takes
+ * diskquota.simulated_latency, as one stat() on slow storage would.
+ */
+static int64
+simulated_relfilenode_size(RelFileNodeBackend *rnode, int forks,
+						   pg_attribute_unused() int elevel, void (*before_probe) (void))
+{
+    int64       min_size = (int64) diskquota_simulated_min_size * 1024;
+    int64       max_size = (int64) Max(diskquota_simulated_max_size,
+                                       diskquota_simulated_min_size) * 1024;
+    uint32      hash;
+
+    if (before_probe)
+        before_probe();
+    if (diskquota_simulated_latency > 0)
+        pg_usleep(diskquota_simulated_latency);
+
+    /* only the main fork has data */
+    if ((forks & (1 << MAIN_FORKNUM)) == 0)
+        return 0;
+
+    hash = DatumGetUInt32(hash_any((const unsigned char *) &rnode->node,
+                                   sizeof(RelFileNode)));
+    return min_size + (int64) (hash % (uint64) (max_size - min_size + 1));
+}
+
+static const SizeProvider size_providers[] = {
+    {"filesystem", filesystem_relfilenode_size},
+    {"simulated", simulated_relfilenode_size}
+};
+
+static const struct config_enum_entry size_provider_options[] = {
+    {"filesystem", SIZE_PROVIDER_FILESYSTEM, false},
+    {"simulated", SIZE_PROVIDER_SIMULATED, false},
+    {NULL, 0, false}
+};
+
+/*
+ * Define the GUCs of size providers.
+ * Called from _PG_init().
+ */
+void
+init_size_provider(void)
+{
+    DefineCustomEnumVariable("diskquota.size_provider",
+                             "Provider of relfilenode sizes, filesystem or simulated.",
+                             "simulated is only for tests and benchmarks.",
+                             &diskquota_size_provider,
+                             SIZE_PROVIDER_FILESYSTEM,
+                             size_provider_options,
+                             PGC_SIGHUP,
+                             0,
+                             NULL,
+                             NULL,
+                             NULL);
+
+    DefineCustomIntVariable("diskquota.simulated_latency",
+                            "Latency of each probe of the simulated size provider (in microseconds).",
+                            NULL,
+                            &diskquota_simulated_latency,
+                            0,
+                            0,
+                            INT_MAX,
+                            PGC_SIGHUP,
+                            0,
+                            NULL,
+                            NULL,
+                            NULL);
+
+    DefineCustomIntVariable("diskquota.simulated_min_size",
+                            "Min size of a relfilenode of the simulated size provider.",
+                            NULL,
+                            &diskquota_simulated_min_size,
+                            8,
+                            0,
+                            INT_MAX,
+                            PGC_SIGHUP,
+                            GUC_UNIT_KB,
+                            NULL,
+                            NULL,
+                            NULL);
+
+    DefineCustomIntVariable("diskquota.simulated_max_size",
+                            "Max size of a relfilenode of the simulated size provider.",
+                            NULL,
+                            &diskquota_simulated_max_size,
+                            1024,
+                            0,
+                            INT_MAX,
+                            PGC_SIGHUP,
+                            GUC_UNIT_KB,
+                            NULL,
+                            NULL,
+                            NULL);
+}
+
+const SizeProvider *
+get_size_provider(void)
+{
+    return &size_providers[diskquota_size_provider];
+}
+
+/*
+ * calculate size of the given forks of a relfilenode by the current provider
+ */
+int64
+diskquota_get_relfilenode_size(RelFileNodeBackend *rnode, int forks,
+							   int elevel, void (*before_probe) (void))
+{
+    return get_size_provider()->relfilenode_size(rnode, forks, elevel, before_probe);
+}
+
+/*
+ * Function to calculate the total relation size, including toast table
+ * and indexes, as pg_total_relation_size() does
  */
 int64
 diskquota_get_table_size_by_oid(Oid oid)
 {
-    FunctionCallInfoData fcinfo;
-    Datum       result;
+    RelationSizeBatch batch;
+    int64       size = 0;
 
-    InitFunctionCallInfoData(fcinfo, NULL, 1, InvalidOid, NULL, NULL);
+    size_batch_init(&batch);
+    size_batch_add_relation(&batch, oid, &size);
+    size_batch_execute(&batch);
 
-    fcinfo.arg[0] = ObjectIdGetDatum(oid);
-    fcinfo.argnull[0] = false;
+    return size;
+}
 
-    result = pg_total_relation_size(&fcinfo);
+/*
+ * Sum the free space recorded in the FSM of the heap of a table, and return
+ * the size of its heap in heapsize.  It reads one FSM slot per heap block
+ * without touching the heap.  Return -1 if the table is dropped, or locked
+ * by a concurrent command, the caller should try again later.
+ */
+int64
+diskquota_get_heap_free_space(Oid relid, int64 *heapsize)
+{
+    Relation    rel;
+    BlockNumber nblocks;
+    BlockNumber blkno;
+    int64       freespace = 0;
 
-    /* Check for null result, since caller is clearly not expecting one */
-    if (fcinfo.isnull)
-        return 0;
+    if (!ConditionalLockRelationOid(relid, AccessShareLock))
+        return -1;
+    rel = try_relation_open(relid, NoLock);
+    if (rel == NULL)
+    {
+        UnlockRelationOid(relid, AccessShareLock);
+        return -1;
+    }
+
+    nblocks = RelationGetNumberOfBlocks(rel);
+    for (blkno = 0; blkno < nblocks; blkno++)
+    {
+        if ((blkno % 1024) == 0)
+            CHECK_FOR_INTERRUPTS();
+        freespace += GetRecordedFreeSpace(rel, blkno);
+    }
+    *heapsize = (int64) nblocks * BLCKSZ;
+
+    relation_close(rel, AccessShareLock);
+    return freespace;
+}
+
+void
+size_batch_init(RelationSizeBatch *batch)
+{
+    batch->nnodes = 0;
+    batch->maxnodes = 64;
+    batch->nodes = palloc(sizeof(RelFileNodeBackend) * batch->maxnodes);
+    batch->results = palloc(sizeof(int64 *) * batch->maxnodes);
+}
+
+static void
+size_batch_add_node(RelationSizeBatch *batch, RelFileNodeBackend *rnode, int64 *result)
+{
+    if (batch->nnodes >= batch->maxnodes)
+    {
+        batch->maxnodes *= 2;
+        batch->nodes = repalloc(batch->nodes, sizeof(RelFileNodeBackend) * batch->maxnodes);
+        batch->results = repalloc(batch->results, sizeof(int64 *) * batch->maxnodes);
+    }
+    batch->nodes[batch->nnodes] = *rnode;
+    batch->results[batch->nnodes] = result;
+    batch->nnodes++;
+}
+
+/*
+ * Add the relfilenode of rel and of its indexes into the batch.
+ */
+static void
+size_batch_add_relation_nodes(RelationSizeBatch *batch, Relation rel, int64 *result)
+{
+    RelFileNodeBackend rnode;
+    List       *index_oids;
+    ListCell   *cell;
+
+    rnode.node = rel->rd_node;
+    rnode.backend = rel->rd_backend;
+    size_batch_add_node(batch, &rnode, result);
+
+    if (!rel->rd_rel->relhasindex)
+        return;
+
+    index_oids = RelationGetIndexList(rel);
+    foreach(cell, index_oids)
+    {
+        Relation    idxRel = relation_open(lfirst_oid(cell), AccessShareLock);
+
+        rnode.node = idxRel->rd_node;
+        rnode.backend = idxRel->rd_backend;
+        size_batch_add_node(batch, &rnode, result);
+        relation_close(idxRel, AccessShareLock);
+    }
+    list_free(index_oids);
+}
+
+/*
+ * Add a committed table into the batch: its heap, its indexes, and its
+ * toast table with the toast index.  Nothing is added if the table has
+ * been dropped, and its size is left untouched.
+ */
+void
+size_batch_add_relation(RelationSizeBatch *batch, Oid relid, int64 *result)
+{
+    Relation    rel;
+
+    rel = try_relation_open(relid, AccessShareLock);
+    if (rel == NULL)
+        return;
+
+    *result = 0;
+    size_batch_add_relation_nodes(batch, rel, result);
+    if (OidIsValid(rel->rd_rel->reltoastrelid))
+    {
+        Relation    toastRel = relation_open(rel->rd_rel->reltoastrelid, AccessShareLock);
+
+        size_batch_add_relation_nodes(batch, toastRel, result);
+        relation_close(toastRel, AccessShareLock);
+    }
+
+    relation_close(rel, AccessShareLock);
+}
+
+/*
+ * Add a single relfilenode into the batch, which is used for tables that
+ * are not committed yet and could not be opened.
+ */
+void
+size_batch_add_relfilenode(RelationSizeBatch *batch, RelFileNode *node, int64 *result)
+{
+    RelFileNodeBackend rnode;
+
+    rnode.node = *node;
+    rnode.backend = InvalidBackendId;
+    *result = 0;
+    size_batch_add_node(batch, &rnode, result);
+}
+
+/*
+ * Probe the sizes of all the relfilenodes in the batch and sum them up into
+ * the result of their tables.  The sizes are fetched from the size service
+ * if it is running, otherwise they are calculated by the current process.
+ */
+void
+size_batch_execute(RelationSizeBatch *batch)
+{
+    int64      *sizes;
+    int         i;
+
+    if (batch->nnodes > 0)
+    {
+        sizes = palloc(sizeof(int64) * batch->nnodes);
+        size_service_get_sizes(batch->nodes, sizes, batch->nnodes);
+
+        for (i = 0; i < batch->nnodes; i++)
+        {
+            /* the size service could not stat it, retry locally to report the error */
+            if (sizes[i] < 0)
+                sizes[i] = diskquota_get_relfilenode_size(&batch->nodes[i], SIZE_ALL_FORKS,
+                                                          ERROR, NULL);
+            *batch->results[i] += sizes[i];
+        }
+        pfree(sizes);
+    }
 
-    return DatumGetInt64(result);
+    pfree(batch->nodes);
+    pfree(batch->results);
+    batch->nodes = NULL;
+    batch->results = NULL;
+    batch->nnodes = batch->maxnodes = 0;
 }
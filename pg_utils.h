@@ -12,9 +12,66 @@
 #ifndef DISKQUOTA_PG_UTILS_H
 #define DISKQUOTA_PG_UTILS_H
 
+#include "common/relpath.h"
 #include "storage/relfilenode.h"
 
+/* fork mask of all the forks of a relfilenode */
+#define SIZE_ALL_FORKS ((1 << (MAX_FORKNUM + 1)) - 1)
+
+/*
+ * RelationSizeBatch collects the relfilenodes of several tables, so that
+ * their file sizes are probed in one round trip to the size service.
+ * The size of each table is the sum of its relfilenodes, and is written to
+ * the address given when the table is added by size_batch_execute().
+ */
+typedef struct RelationSizeBatch
+{
+	int			nnodes;
+	int			maxnodes;
+	RelFileNodeBackend *nodes;
+	int64	  **results;		/* result of the table each node belongs to */
+} RelationSizeBatch;
+
+/*
+ * SizeProvider probes the size of relfilenodes.  The filesystem provider
+ * stat()s the segment files, the simulated provider makes up the sizes
+ * with configurable latency, so that the refresh pipeline could be tested
+ * and benchmarked without physical files.
+ *
+ * relfilenode_size returns the total size of the given forks, or reports
+ * at elevel and returns -1 if the size could not be probed.  before_probe
+ * is called before each filesystem access if it is not NULL.
+ */
+typedef struct SizeProvider
+{
+	const char *name;
+	int64		(*relfilenode_size) (RelFileNodeBackend *rnode, int forks,
+									 int elevel, void (*before_probe) (void));
+} SizeProvider;
+
+typedef enum
+{
+	SIZE_PROVIDER_FILESYSTEM = 0,
+	SIZE_PROVIDER_SIMULATED
+} SizeProviderType;
+
+extern int	diskquota_size_provider;
+extern int	diskquota_simulated_latency;
+extern int	diskquota_simulated_min_size;
+extern int	diskquota_simulated_max_size;
+
+extern void init_size_provider(void);
+extern const SizeProvider *get_size_provider(void);
+
 extern int64 diskquota_get_table_size_by_oid(Oid oid);
-extern int64 diskquota_get_table_size_by_relfilenode(RelFileNode *rfh);
+extern int64 diskquota_get_relfilenode_size(RelFileNodeBackend *rnode, int forks,
+											int elevel, void (*before_probe) (void));
+
+extern int64 diskquota_get_heap_free_space(Oid relid, int64 *heapsize);
+
+extern void size_batch_init(RelationSizeBatch *batch);
+extern void size_batch_add_relation(RelationSizeBatch *batch, Oid relid, int64 *result);
+extern void size_batch_add_relfilenode(RelationSizeBatch *batch, RelFileNode *node, int64 *result);
+extern void size_batch_execute(RelationSizeBatch *batch);
 
 #endif //DISKQUOTA_PG_UTILS_H
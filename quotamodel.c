@@ -17,8 +17,10 @@
 #include "access/reloptions.h"
 #include "access/transam.h"
 #include "access/xact.h"
+#include "catalog/catalog.h"
 #include "catalog/namespace.h"
 #include "catalog/pg_class.h"
+#include "catalog/pg_collation.h"
 #include "catalog/pg_database.h"
 #include "catalog/pg_type.h"
 #include "commands/dbcommands.h"
@@ -27,42 +29,104 @@
 #include "lib/stringinfo.h"
 #include "miscadmin.h"
 #include "nodes/makefuncs.h"
+#include "pgstat.h"
 #include "storage/ipc.h"
 #include "storage/latch.h"
 #include "storage/lwlock.h"
 #include "storage/shmem.h"
+#include "utils/acl.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/fmgroids.h"
+#include "utils/inval.h"
 #include "utils/lsyscache.h"
+#include "utils/memutils.h"
 #include "utils/snapmgr.h"
 #include "utils/syscache.h"
+#include "utils/timestamp.h"
 
 #include "activetable.h"
 #include "diskquota.h"
+#include "federation.h"
+#include "pg_utils.h"
+#include "relactivity.h"
+#include "sizeservice.h"
+#include "walusage.h"
+
+/* disk quota usage function */
+PG_FUNCTION_INFO_V1(headroom);
+PG_FUNCTION_INFO_V1(worker_status);
+PG_FUNCTION_INFO_V1(wal_usage);
+PG_FUNCTION_INFO_V1(reclaimable_tables);
+PG_FUNCTION_INFO_V1(database_usage);
 
 /* cluster level max size of black list */
 #define MAX_DISK_QUOTA_BLACK_ENTRIES (1024 * 1024)
-/* cluster level init size of black list */
-#define INIT_DISK_QUOTA_BLACK_ENTRIES 8192
+/* max number of schemas and roles of a database in shared blacklist */
+#define MAX_BLACK_ENTRIES_PER_DB (MAX_DISK_QUOTA_BLACK_ENTRIES / MAX_NUM_MONITORED_DB)
 /* per database level max size of black list */
 #define MAX_LOCAL_DISK_QUOTA_BLACK_ENTRIES 8192
+/* cluster level max size of published target usage */
+#define MAX_DISK_QUOTA_TARGET_ENTRIES (256 * 1024)
+/* cluster level init size of published target usage */
+#define INIT_DISK_QUOTA_TARGET_ENTRIES 8192
+/* interval to check all the schemas and roles instead of the dirty ones, in seconds */
+#define FULL_EVALUATION_INTERVAL 600
+/* max number of tables with most reclaimable space published for a schema or role */
+#define MAX_RECLAIM_TABLES_PER_TARGET 8
+/* max number of tables with reclaimable space published for a database */
+#define MAX_RECLAIM_ENTRIES_PER_DB 1024
 
 typedef struct TableSizeEntry TableSizeEntry;
+typedef struct TableNodeEntry TableNodeEntry;
 typedef struct NamespaceSizeEntry NamespaceSizeEntry;
 typedef struct RoleSizeEntry RoleSizeEntry;
 typedef struct QuotaLimitEntry QuotaLimitEntry;
 typedef struct BlackMapEntry BlackMapEntry;
 typedef struct LocalBlackMapEntry LocalBlackMapEntry;
+typedef struct TargetUsageEntry TargetUsageEntry;
+typedef struct LocalTargetUsageEntry LocalTargetUsageEntry;
+typedef struct QuotaRule QuotaRule;
+typedef struct BlackListSlot BlackListSlot;
+typedef struct WalNodeEntry WalNodeEntry;
+typedef struct WalRateEntry WalRateEntry;
+typedef struct ReclaimEntry ReclaimEntry;
+typedef struct ReclaimSlot ReclaimSlot;
+typedef struct ReclaimTarget ReclaimTarget;
 
 /* local cache of table disk size and corresponding schema and owner */
 struct TableSizeEntry
 {
-	RelFileNode node;       /* hash table key */
-	Oid			reloid;
+	Oid			reloid;			/* hash table key */
+	RelFileNode node;			/* current relfilenode of the table */
 	Oid			namespaceoid;
 	Oid			owneroid;
 	int64		totalsize;
 
+	/* estimate of the space VACUUM could reclaim, see estimate_reclaimable() */
+	int64		reclaimable;
+	int64		heapsize;		/* heap size when FSM is scanned */
+	int64		freespace;		/* free space recorded in FSM */
+	int64		scannedsize;	/* totalsize when FSM is scanned, -1 if never */
+	PgStat_Counter vacuumcount;	/* vacuums of the table when FSM is scanned */
+
+	/* write times of the table, 0 if not seen, see relactivity.c */
+	TimestampTz first_seen;
+	TimestampTz last_extended;
+	TimestampTz last_truncated;
+
+	uint64		generation;		/* last refresh finding the table */
+};
+
+/*
+ * local index from relfilenode to table in table_size_map.
+ * TRUNCATE, VACUUM FULL, CLUSTER and table rewrite only swap the
+ * relfilenode of a table, which is a size update of the same entry.
+ */
+struct TableNodeEntry
+{
+	RelFileNode node;			/* hash table key */
+	Oid			reloid;
 };
 
 /* local cache of namespace disk size */
@@ -70,6 +134,7 @@ struct NamespaceSizeEntry
 {
 	Oid			namespaceoid;
 	int64		totalsize;
+	bool		isdirty;		/* in dirty_namespaces */
 };
 
 /* local cache of role disk size */
@@ -77,6 +142,7 @@ struct RoleSizeEntry
 {
 	Oid			owneroid;
 	int64		totalsize;
+	bool		isdirty;		/* in dirty_roles */
 };
 
 /* local cache of disk quota limit */
@@ -86,7 +152,15 @@ struct QuotaLimitEntry
 	int64		limitsize;
 };
 
-/* global blacklist for which exceed their quota limit */
+/* quota limit of schemas or roles whose name matches the pattern */
+struct QuotaRule
+{
+	QuotaType	type;
+	char	   *pattern;
+	int64		limitsize;
+};
+
+/* key of blacklist and usage entries of a schema or role */
 struct BlackMapEntry
 {
 	Oid			targetoid;
@@ -94,38 +168,265 @@ struct BlackMapEntry
 	uint32		targettype;
 };
 
-/* local blacklist for which exceed their quota limit */
+/*
+ * local blacklist for which exceed their quota limit.
+ * An entry is kept until its target is checked again and found under
+ * the limit, so only changed entries are flushed to the shared blacklist.
+ */
 struct LocalBlackMapEntry
 {
 	BlackMapEntry	keyitem;
 	bool			isexceeded;
+	bool			isflushed;	/* present in shared black map */
+};
+
+/*
+ * global blacklist of a database, for which exceed their quota limit.
+ * Blacklisted schemas and roles are two sorted arrays in targets, schemas
+ * first, so a check is a binary search in a few cache lines, and the
+ * list of a database is replaced or dropped at once.  The slot used by a
+ * worker has the same index as its worker slot.
+ */
+struct BlackListSlot
+{
+	Oid			dbid;			/* InvalidOid if the slot is free */
+	uint32		generation;		/* bumped whenever the list is changed */
+	bool		database_exceeded;	/* the database itself is over its quota */
+	int			num_namespaces;
+	int			num_roles;
+	Oid			targets[MAX_BLACK_ENTRIES_PER_DB];
+};
+
+/* global usage and quota limit of schemas and roles */
+struct TargetUsageEntry
+{
+	BlackMapEntry	keyitem;
+	int64			limitsize;	/* quota limit in MB, -1 means no limit */
+	int64			usage;		/* disk usage in bytes */
+	int64			remoteusage;	/* usage of the same name in other federated workers */
+	int64			walbytes;	/* WAL generated since worker started, in bytes */
+	double			walrate;	/* WAL generated per second in last refresh */
+	int64			reclaimable;	/* reclaimable space in bytes, -1 if not estimated */
+};
+
+/* local copy of target usage, only changed entries are flushed */
+struct LocalTargetUsageEntry
+{
+	TargetUsageEntry	item;
+	bool				ischanged;
+	bool				isremoved;
+};
+
+/* schema and owner of a relfilenode which is not a table in the model */
+struct WalNodeEntry
+{
+	RelFileNode node;			/* hash table key */
+	Oid			namespaceoid;
+	Oid			owneroid;
+};
+
+/* local WAL usage of a schema or role */
+struct WalRateEntry
+{
+	BlackMapEntry	keyitem;
+	int64			walbytes;	/* WAL generated since worker started */
+	int64			cyclebytes;	/* WAL generated since last refresh */
+	double			walrate;	/* bytes per second in last refresh */
+};
+
+/* table with reclaimable space in a schema or role near its quota limit */
+struct ReclaimEntry
+{
+	Oid			reloid;
+	Oid			targetoid;
+	uint32		targettype;
+	int64		tablesize;
+	int64		reclaimable;
+};
+
+/*
+ * Tables with most reclaimable space in the schemas and roles of a database
+ * which are near or over their quota limit.  The slot used by a worker has
+ * the same index as its worker slot.  Slots are protected by usage_map_lock.
+ */
+struct ReclaimSlot
+{
+	Oid			dbid;			/* InvalidOid if the slot is free */
+	int			num_entries;
+	ReclaimEntry entries[MAX_RECLAIM_ENTRIES_PER_DB];
+};
+
+/* local collection of the tables with most reclaimable space of a target */
+struct ReclaimTarget
+{
+	BlackMapEntry	keyitem;
+	int64			reclaimable;	/* sum of all the tables of the target */
+	int				num_tables;
+	TableSizeEntry *tables[MAX_RECLAIM_TABLES_PER_TARGET];	/* descending */
 };
 
 /* using hash table to support incremental update the table size entry.*/
 static HTAB *table_size_map = NULL;
+static HTAB *table_node_map = NULL;
 static HTAB *namespace_size_map = NULL;
 static HTAB *role_size_map = NULL;
+
+/*
+ * Schemas and roles whose usage is changed since last refresh, only they
+ * are checked against their quota limit.  All of them are checked when
+ * quota setting is reloaded, and every FULL_EVALUATION_INTERVAL to catch
+ * dropped or renamed schemas and roles.
+ */
+static List *dirty_namespaces = NIL;
+static List *dirty_roles = NIL;
+static bool full_evaluation_pending = true;
+static TimestampTz last_full_evaluation = 0;
 static HTAB *namespace_quota_limit_map = NULL;
 static HTAB *role_quota_limit_map = NULL;
 
+/* quota rules and the rule limit resolved for each schema and role */
+static List *quota_rules = NIL;
+static MemoryContext quota_rule_context = NULL;
+static HTAB *namespace_rule_limit_map = NULL;
+static HTAB *role_rule_limit_map = NULL;
+/* set when a schema or role is changed, e.g. renamed, see rule_limit_invalidate() */
+static bool namespace_rule_limit_stale = false;
+static bool role_rule_limit_stale = false;
+
+/* version of quota setting which is loaded, see load_quotas() */
+static bool quota_config_loaded = false;
+static uint32 loaded_config_version = 0;
+
 /* black list for database objects which exceed their quota limit */
-static HTAB *disk_quota_black_map = NULL;
+static BlackListSlot *black_list_slots = NULL;
 static HTAB *local_disk_quota_black_map = NULL;
+/* set when the blacklist of this worker is written to shared memory once */
+static bool black_list_published = false;
+
+/* usage and quota limit of schemas and roles, used by diskquota.headroom() */
+static HTAB *disk_quota_usage_map = NULL;
+static HTAB *local_disk_quota_usage_map = NULL;
+
+/*
+ * WAL usage of schemas and roles, see walusage.c.  Indexes and toast tables
+ * are accounted to the schema and owner of their table, which are cached
+ * in wal_node_map until the next full evaluation.
+ */
+static HTAB *wal_node_map = NULL;
+static HTAB *wal_rate_map = NULL;
+static TimestampTz last_wal_collect_time = 0;
+static int	evaluated_max_wal_rate = 0;
+
+/*
+ * usage of schemas and roles published by other workers sharing
+ * diskquota.federation_directory, by quota type and name
+ */
+static HTAB *federated_usage_map = NULL;
+/* set when local usage is changed since it is published */
+static bool federation_changed = true;
+static TimestampTz last_federation_publish = 0;
+
+/*
+ * disk usage of current database: the tables in the model, kept up to date
+ * as they are measured, plus the relations which are not tables in the
+ * model, i.e. system catalogs and sequences, measured in full evaluations.
+ * Quota limit of the database in MB, -1 means no limit.
+ */
+static int64 tables_total_size = 0;
+static int64 system_total_size = 0;
+static int64 database_quota_limit = -1;
+
+/* oid of diskquota schema cached by backends, see is_database_quota_exempt() */
+static Oid	diskquota_namespace_oid = InvalidOid;
+static bool diskquota_namespace_callback_registered = false;
+
+/*
+ * write times of tables, see relactivity.c.  Tables added into the model by
+ * the initial refresh take the times saved by a previous worker, and their
+ * size found by the initial refresh is a write only if it differs from the
+ * saved one.
+ */
+static HTAB *saved_activity_map = NULL;
+static TimestampTz activity_time = 0;	/* start time of current refresh */
+static bool activity_tracked = false;	/* set after the initial refresh */
+static bool activity_changed = true;	/* changed since last save */
+static TimestampTz last_activity_save = 0;
+
+/* count of refreshes, to find the tables dropped without unlink event */
+static uint64 table_generation = 0;
+
+/* tables with most reclaimable space of targets near their quota limit */
+static ReclaimSlot *reclaim_slots = NULL;
+/* set when the reclaim slot of this worker is not empty */
+static bool reclaim_published = false;
+
+/* per database state of worker processes */
+DiskQuotaWorkerSlot *worker_slots = NULL;
+static DiskQuotaWorkerSlot *my_worker_slot = NULL;
+
+/* targets requested by diskquota.refresh() to be re-measured in this refresh */
+static RefreshTarget refresh_targets[MAX_REFRESH_TARGETS];
+static int num_refresh_targets = 0;
 
 static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
 
 /* functions to refresh disk quota model*/
 static void refresh_disk_quota_usage(bool force);
 static void calculate_table_disk_usage(bool force);
-static void calculate_schema_disk_usage(void);
-static void calculate_role_disk_usage(void);
+static void save_table_activity(bool force);
+static void calculate_schema_disk_usage(bool full);
+static void calculate_role_disk_usage(bool full);
+static void calculate_database_disk_usage(bool full);
+static int64 calculate_system_disk_usage(void);
+static void calculate_wal_usage(bool full);
+static void calculate_reclaimable_space(void);
+static void calculate_federated_usage(void);
+static void mark_federated_target_dirty(FederatedKey *key);
+static int64 get_federated_usage(Oid targetoid, QuotaType type);
+static void publish_federated_usage(void);
+static void add_reclaim_table(ReclaimTarget *target, TableSizeEntry *tsentry);
+static void estimate_reclaimable(TableSizeEntry *tsentry);
+static ReclaimSlot *get_reclaim_slot(Oid dbid);
+static void init_table_size_entry(TableSizeEntry *tsentry, Oid reloid, Oid namespaceoid, Oid owneroid);
+static void resolve_wal_nodes(Datum *nodes, int num_nodes);
+static void add_wal_bytes(Oid targetoid, QuotaType type, int64 bytes);
+static void reset_wal_rates(void);
+static void search_black_list(Oid nsOid, Oid ownerOid, bool *ns_exceeded, bool *role_exceeded,
+							  bool *db_exceeded);
+static bool is_database_quota_exempt(Oid nsOid);
+static void diskquota_namespace_invalidate(Datum arg, int cacheid, uint32 hashvalue);
+static void mark_target_dirty(Oid targetoid, QuotaType type);
+static WalRateEntry *get_wal_rate(Oid targetoid, QuotaType type);
+static bool is_wal_rate_exceeded(double walrate);
+static bool is_wal_rate_blacklisted(Oid targetoid, QuotaType type);
+static void check_namespace(NamespaceSizeEntry *nsentry);
+static void check_role(RoleSizeEntry *rolentry);
+static void remove_local_black_map(Oid targetoid, QuotaType type);
+static BlackListSlot *get_black_list_slot(Oid dbid);
+static int	oid_compare(const void *a, const void *b);
 static void flush_local_black_map(void);
+static void flush_local_usage_map(void);
+static void update_local_usage_map(Oid targetoid, QuotaType type, int64 usage, int64 remoteusage,
+								   int64 limitsize, WalRateEntry *walentry);
+static void remove_local_usage_map(Oid targetoid, QuotaType type);
+static void attach_worker_slot(void);
+static bool is_refresh_target(Oid namespaceoid, Oid owneroid);
 static void check_disk_quota_by_oid(Oid targetOid, int64 current_usage, QuotaType type);
 static void update_namespace_map(Oid namespaceoid, int64 updatesize);
 static void update_role_map(Oid owneroid, int64 updatesize);
+static void mark_namespace_dirty(NamespaceSizeEntry *nsentry);
+static void mark_role_dirty(RoleSizeEntry *rolentry);
 static void remove_namespace_map(Oid namespaceoid);
 static void remove_role_map(Oid owneroid);
-static bool load_quotas(void);
+static TableSizeEntry *lookup_table_by_node(RelFileNode *node);
+static void set_table_node(TableSizeEntry *tsentry, RelFileNode *node);
+static void update_table_size(TableSizeEntry *tsentry, int64 newsize);
+static void remove_table_size_entry(TableSizeEntry *tsentry);
+static bool load_quotas(bool force, uint32 config_version);
+static bool load_quota_rules(void);
+static void clear_quota_limit_map(HTAB *quota_limit_map);
+static int64 get_rule_quota_limit(Oid targetoid, QuotaType type);
+static void rule_limit_invalidate(Datum arg, int cacheid, uint32 hashvalue);
 
 static Size DiskQuotaShmemSize(void);
 static void disk_quota_shmem_startup(void);
@@ -140,8 +441,12 @@ DiskQuotaShmemSize(void)
 	Size		size;
 
 	size = sizeof(MessageBox);
-	size = add_size(size, hash_estimate_size(MAX_DISK_QUOTA_BLACK_ENTRIES, sizeof(BlackMapEntry)));
+	size = add_size(size, mul_size(MAX_NUM_MONITORED_DB, sizeof(BlackListSlot)));
 	size = add_size(size, hash_estimate_size(diskquota_max_active_tables, sizeof(DiskQuotaActiveTableEntry)));
+	size = add_size(size, hash_estimate_size(MAX_DISK_QUOTA_TARGET_ENTRIES, sizeof(TargetUsageEntry)));
+	size = add_size(size, mul_size(MAX_NUM_MONITORED_DB, sizeof(DiskQuotaWorkerSlot)));
+	size = add_size(size, mul_size(MAX_NUM_MONITORED_DB, sizeof(ReclaimSlot)));
+	size = add_size(size, size_service_shmem_size());
 	return size;
 }
 
@@ -153,6 +458,9 @@ init_lwlocks(void)
 	diskquota_locks.active_table_lock = &base[0].lock;
 	diskquota_locks.black_map_lock = &base[1].lock;
 	diskquota_locks.message_box_lock = &base[2].lock;
+	diskquota_locks.usage_map_lock = &base[3].lock;
+	diskquota_locks.worker_slot_lock = &base[4].lock;
+	diskquota_locks.size_service_lock = &base[5].lock;
 }
 /*
  * DiskQuotaShmemInit
@@ -167,7 +475,7 @@ disk_quota_shmem_startup(void)
 	if (prev_shmem_startup_hook)
 		(*prev_shmem_startup_hook)();
 
-	disk_quota_black_map = NULL;
+	black_list_slots = NULL;
 
 	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
 
@@ -178,18 +486,37 @@ disk_quota_shmem_startup(void)
 	if (!found)
 		memset((void*)message_box, 0, sizeof(MessageBox));
 
+	black_list_slots = ShmemInitStruct("blacklist whose quota limitation is reached",
+								mul_size(MAX_NUM_MONITORED_DB, sizeof(BlackListSlot)),
+								&found);
+	if (!found)
+		memset((void *) black_list_slots, 0, mul_size(MAX_NUM_MONITORED_DB, sizeof(BlackListSlot)));
+
 	memset(&hash_ctl, 0, sizeof(hash_ctl));
 	hash_ctl.keysize = sizeof(BlackMapEntry);
-	hash_ctl.entrysize = sizeof(BlackMapEntry);
+	hash_ctl.entrysize = sizeof(TargetUsageEntry);
 	hash_ctl.hash = tag_hash;
 
-	disk_quota_black_map = ShmemInitHash("blackmap whose quota limitation is reached",
-									INIT_DISK_QUOTA_BLACK_ENTRIES,
-									MAX_DISK_QUOTA_BLACK_ENTRIES,
+	disk_quota_usage_map = ShmemInitHash("usage and quota limit of schemas and roles",
+									INIT_DISK_QUOTA_TARGET_ENTRIES,
+									MAX_DISK_QUOTA_TARGET_ENTRIES,
 									&hash_ctl,
 									HASH_ELEM | HASH_FUNCTION);
 
+	worker_slots = ShmemInitStruct("disk_quota_worker_slots",
+								mul_size(MAX_NUM_MONITORED_DB, sizeof(DiskQuotaWorkerSlot)),
+								&found);
+	if (!found)
+		memset((void *) worker_slots, 0, mul_size(MAX_NUM_MONITORED_DB, sizeof(DiskQuotaWorkerSlot)));
+
+	reclaim_slots = ShmemInitStruct("disk_quota_reclaim_slots",
+								mul_size(MAX_NUM_MONITORED_DB, sizeof(ReclaimSlot)),
+								&found);
+	if (!found)
+		memset((void *) reclaim_slots, 0, mul_size(MAX_NUM_MONITORED_DB, sizeof(ReclaimSlot)));
+
 	init_shm_worker_active_tables();
+	init_size_service_shmem();
 
 	LWLockRelease(AddinShmemInitLock);
 }
@@ -203,7 +530,7 @@ init_disk_quota_shmem(void)
 	 * resources in pgss_shmem_startup().
 	 */
 	RequestAddinShmemSpace(DiskQuotaShmemSize());
-	RequestNamedLWLockTranche("diskquota_locks", 3);
+	RequestNamedLWLockTranche("diskquota_locks", DISKQUOTA_LOCK_COUNT);
 
 	/*
 	 * Install startup hook to initialize our shared memory.
@@ -222,16 +549,27 @@ init_disk_quota_model(void)
 
 	/* init hash table for table/schema/role etc.*/
 	memset(&hash_ctl, 0, sizeof(hash_ctl));
-	hash_ctl.keysize = sizeof(RelFileNode);
+	hash_ctl.keysize = sizeof(Oid);
 	hash_ctl.entrysize = sizeof(TableSizeEntry);
 	hash_ctl.hcxt = CurrentMemoryContext;
-	hash_ctl.hash = tag_hash;
+	hash_ctl.hash = oid_hash;
 
 	table_size_map = hash_create("TableSizeEntry map",
 								1024 * 8,
 								&hash_ctl,
 								HASH_ELEM | HASH_CONTEXT | HASH_FUNCTION);
 
+	memset(&hash_ctl, 0, sizeof(hash_ctl));
+	hash_ctl.keysize = sizeof(RelFileNode);
+	hash_ctl.entrysize = sizeof(TableNodeEntry);
+	hash_ctl.hcxt = CurrentMemoryContext;
+	hash_ctl.hash = tag_hash;
+
+	table_node_map = hash_create("TableNodeEntry map",
+								1024 * 8,
+								&hash_ctl,
+								HASH_ELEM | HASH_CONTEXT | HASH_FUNCTION);
+
 	memset(&hash_ctl, 0, sizeof(hash_ctl));
 	hash_ctl.keysize = sizeof(Oid);
 	hash_ctl.entrysize = sizeof(NamespaceSizeEntry);
@@ -270,6 +608,24 @@ init_disk_quota_model(void)
 								&hash_ctl,
 								HASH_ELEM | HASH_CONTEXT | HASH_FUNCTION);
 
+	namespace_rule_limit_map = hash_create("Namespace rule QuotaLimitEntry map",
+								1024,
+								&hash_ctl,
+								HASH_ELEM | HASH_CONTEXT | HASH_FUNCTION);
+
+	role_rule_limit_map = hash_create("Role rule QuotaLimitEntry map",
+								1024,
+								&hash_ctl,
+								HASH_ELEM | HASH_CONTEXT | HASH_FUNCTION);
+
+	quota_rule_context = AllocSetContextCreate(CurrentMemoryContext,
+								"diskquota quota rules",
+								ALLOCSET_DEFAULT_SIZES);
+
+	/* rule limits are resolved by name, forget them when a name changes */
+	CacheRegisterSyscacheCallback(NAMESPACEOID, rule_limit_invalidate, (Datum) 0);
+	CacheRegisterSyscacheCallback(AUTHOID, rule_limit_invalidate, (Datum) 0);
+
 	memset(&hash_ctl, 0, sizeof(hash_ctl));
 	hash_ctl.keysize = sizeof(BlackMapEntry);
 	hash_ctl.entrysize = sizeof(LocalBlackMapEntry);
@@ -280,6 +636,104 @@ init_disk_quota_model(void)
 									MAX_LOCAL_DISK_QUOTA_BLACK_ENTRIES,
 									&hash_ctl,
 									HASH_ELEM | HASH_CONTEXT | HASH_FUNCTION);
+
+	memset(&hash_ctl, 0, sizeof(hash_ctl));
+	hash_ctl.keysize = sizeof(BlackMapEntry);
+	hash_ctl.entrysize = sizeof(LocalTargetUsageEntry);
+	hash_ctl.hcxt = CurrentMemoryContext;
+	hash_ctl.hash = tag_hash;
+
+	local_disk_quota_usage_map = hash_create("local usage and quota limit of schemas and roles",
+									1024,
+									&hash_ctl,
+									HASH_ELEM | HASH_CONTEXT | HASH_FUNCTION);
+
+	memset(&hash_ctl, 0, sizeof(hash_ctl));
+	hash_ctl.keysize = sizeof(RelFileNode);
+	hash_ctl.entrysize = sizeof(WalNodeEntry);
+	hash_ctl.hcxt = CurrentMemoryContext;
+	hash_ctl.hash = tag_hash;
+
+	wal_node_map = hash_create("schema and owner of relfilenodes generating WAL",
+									1024,
+									&hash_ctl,
+									HASH_ELEM | HASH_CONTEXT | HASH_FUNCTION);
+
+	memset(&hash_ctl, 0, sizeof(hash_ctl));
+	hash_ctl.keysize = sizeof(BlackMapEntry);
+	hash_ctl.entrysize = sizeof(WalRateEntry);
+	hash_ctl.hcxt = CurrentMemoryContext;
+	hash_ctl.hash = tag_hash;
+
+	wal_rate_map = hash_create("local WAL usage of schemas and roles",
+									1024,
+									&hash_ctl,
+									HASH_ELEM | HASH_CONTEXT | HASH_FUNCTION);
+
+	/* write times saved by the previous worker of the database */
+	saved_activity_map = load_relation_activity(MyDatabaseId);
+
+	attach_worker_slot();
+}
+
+/*
+ * Take the worker slot of current database, so that backends could
+ * find the state of this worker process.
+ */
+static void
+attach_worker_slot(void)
+{
+	DiskQuotaWorkerSlot *slot;
+	int			i;
+
+	LWLockAcquire(diskquota_locks.worker_slot_lock, LW_EXCLUSIVE);
+	/* reuse the slot left by a previous worker of the same database */
+	slot = get_worker_slot(MyDatabaseId);
+	for (i = 0; slot == NULL && i < MAX_NUM_MONITORED_DB; i++)
+	{
+		if (worker_slots[i].dbid == InvalidOid)
+			slot = &worker_slots[i];
+	}
+	if (slot == NULL)
+	{
+		LWLockRelease(diskquota_locks.worker_slot_lock);
+		elog(ERROR, "[diskquota] no free worker slot for database %u", MyDatabaseId);
+	}
+	memset(slot, 0, sizeof(DiskQuotaWorkerSlot));
+	slot->dbid = MyDatabaseId;
+	slot->pid = MyProcPid;
+	slot->database_quota = -1;
+	my_worker_slot = slot;
+	LWLockRelease(diskquota_locks.worker_slot_lock);
+
+	/* the blacklist slot is published by the first flush_local_black_map() */
+	black_list_published = false;
+
+	/* forget the tables published by a previous worker of the same database */
+	LWLockAcquire(diskquota_locks.usage_map_lock, LW_EXCLUSIVE);
+	reclaim_slots[my_worker_slot - worker_slots].dbid = MyDatabaseId;
+	reclaim_slots[my_worker_slot - worker_slots].num_entries = 0;
+	LWLockRelease(diskquota_locks.usage_map_lock);
+	reclaim_published = false;
+}
+
+/*
+ * Find the worker slot of a database.
+ * Caller should hold worker_slot_lock.
+ */
+DiskQuotaWorkerSlot *
+get_worker_slot(Oid dbid)
+{
+	int			i;
+
+	if (dbid == InvalidOid)
+		return NULL;
+	for (i = 0; i < MAX_NUM_MONITORED_DB; i++)
+	{
+		if (worker_slots[i].dbid == dbid)
+			return &worker_slots[i];
+	}
+	return NULL;
 }
 
 /*
@@ -290,21 +744,78 @@ init_disk_quota_model(void)
 void
 refresh_disk_quota_model(bool force)
 {
+	uint32		config_version;
+	uint64		refresh_id;
+	TimestampTz	start_time = GetCurrentTimestamp();
+	TimestampTz	end_time;
+
 	elog(DEBUG1,"check disk quota begin");
+	/*
+	 * Start a new refresh and take the targets requested by
+	 * diskquota.refresh(). Read config version before taking
+	 * snapshot, see load_quotas()
+	 */
+	LWLockAcquire(diskquota_locks.worker_slot_lock, LW_EXCLUSIVE);
+	refresh_id = ++my_worker_slot->refresh_started;
+	config_version = my_worker_slot->config_version;
+	if (my_worker_slot->refresh_all)
+		force = true;
+	num_refresh_targets = my_worker_slot->num_refresh_targets;
+	memcpy(refresh_targets, my_worker_slot->refresh_targets,
+		   sizeof(RefreshTarget) * num_refresh_targets);
+	my_worker_slot->refresh_all = false;
+	my_worker_slot->num_refresh_targets = 0;
+	LWLockRelease(diskquota_locks.worker_slot_lock);
+
 	StartTransactionCommand();
 	SPI_connect();
 	PushActiveSnapshot(GetTransactionSnapshot());
 	/* skip refresh model when load_quotas failed */
-	if (load_quotas())
+	if (load_quotas(force, config_version))
 	{
 		refresh_disk_quota_usage(force);
 	}
 	SPI_finish();
 	PopActiveSnapshot();
 	CommitTransactionCommand();
+
+	num_refresh_targets = 0;
+
+	end_time = GetCurrentTimestamp();
+	LWLockAcquire(diskquota_locks.worker_slot_lock, LW_EXCLUSIVE);
+	my_worker_slot->last_refresh_time = end_time;
+	my_worker_slot->last_refresh_duration = end_time - start_time;
+	if (refresh_id == 1)
+		my_worker_slot->init_refresh_duration = end_time - start_time;
+	my_worker_slot->num_tables = hash_get_num_entries(table_size_map);
+	my_worker_slot->database_size = tables_total_size + system_total_size;
+	my_worker_slot->database_quota = database_quota_limit;
+	my_worker_slot->refresh_finished = refresh_id;
+	LWLockRelease(diskquota_locks.worker_slot_lock);
 	elog(DEBUG1,"check disk quota end");
 }
 
+/*
+ * Check whether a table belongs to a schema or role requested
+ * by diskquota.refresh() to be re-measured.
+ */
+static bool
+is_refresh_target(Oid namespaceoid, Oid owneroid)
+{
+	int			i;
+
+	for (i = 0; i < num_refresh_targets; i++)
+	{
+		if (refresh_targets[i].type == NAMESPACE_QUOTA &&
+			refresh_targets[i].targetoid == namespaceoid)
+			return true;
+		if (refresh_targets[i].type == ROLE_QUOTA &&
+			refresh_targets[i].targetoid == owneroid)
+			return true;
+	}
+	return false;
+}
+
 /*
  * Update the disk usage of nameapsce and role.
  * Put the exceeded namespace and role into shared black map.
@@ -312,138 +823,386 @@ refresh_disk_quota_model(bool force)
 static void
 refresh_disk_quota_usage(bool force)
 {
+	bool		full;
+	TimestampTz now = GetCurrentTimestamp();
+
 	/* recalculate the disk usage of table, schema and role */
 	calculate_table_disk_usage(force);
-	calculate_schema_disk_usage();
-	calculate_role_disk_usage();
+	/* times are saved at once on request of diskquota.refresh() for targets */
+	save_table_activity(force || num_refresh_targets > 0);
+
+	full = force || full_evaluation_pending ||
+		TimestampDifferenceExceeds(last_full_evaluation, now, FULL_EVALUATION_INTERVAL * 1000);
+	if (full)
+	{
+		full_evaluation_pending = false;
+		last_full_evaluation = now;
+	}
+	/* WAL rates of schemas and roles are checked together with their usage */
+	calculate_wal_usage(full);
+	/* so is the usage of the same schemas and roles in other instances */
+	calculate_federated_usage();
+	calculate_schema_disk_usage(full);
+	calculate_role_disk_usage(full);
+	calculate_database_disk_usage(full);
+	/* estimate the space VACUUM could reclaim in targets near their limit */
+	calculate_reclaimable_space();
 	/* copy local black map back to shared black map */
 	flush_local_black_map();
+	/* publish the changed usage of schemas and roles */
+	flush_local_usage_map();
+	publish_federated_usage();
 }
 
 /*
  * Generate the new shared blacklist from the local_black_list which
  * exceed the quota limit.
  * local_balck_list is used to reduce the lock race.
+ * The shared blacklist of this database is only rewritten when a schema
+ * or role is added to or removed from the local one.
  */
 static void
 flush_local_black_map(void)
 {
 	HASH_SEQ_STATUS iter;
 	LocalBlackMapEntry* localblackentry;
-	BlackMapEntry* blackentry;
-	bool found;
-
-	LWLockAcquire(diskquota_locks.black_map_lock, LW_EXCLUSIVE);
+	BlackListSlot *slot;
+	Oid		   *namespaces;
+	Oid		   *roles;
+	int			num_namespaces = 0;
+	int			num_roles = 0;
+	bool		database_exceeded = false;
+	long		num_entries;
+	bool		changed = !black_list_published;
 
 	hash_seq_init(&iter, local_disk_quota_black_map);
 	while ((localblackentry = hash_seq_search(&iter)) != NULL)
 	{
-		if (localblackentry->isexceeded)
-		{
-			blackentry = (BlackMapEntry*) hash_search(disk_quota_black_map,
-							   (void *) &localblackentry->keyitem,
-							   HASH_ENTER_NULL, &found);
-			if (blackentry == NULL)
-			{
-				elog(WARNING, "shared disk quota black map size limit reached.");
-			}
-			else
-			{
-				/* new db objects which exceed quota limit */
-				if (!found)
-				{
-					blackentry->targetoid = localblackentry->keyitem.targetoid;
-					blackentry->databaseoid = MyDatabaseId;
-					blackentry->targettype = localblackentry->keyitem.targettype;
-				}
-			}
-			localblackentry->isexceeded = false;
-		}
-		else
+		if (!localblackentry->isexceeded)
 		{
 			/* db objects are removed or under quota limit in the new loop */
-			(void) hash_search(disk_quota_black_map,
-							   (void *) &localblackentry->keyitem,
-							   HASH_REMOVE, NULL);
 			(void) hash_search(local_disk_quota_black_map,
 							   (void *) &localblackentry->keyitem,
 							   HASH_REMOVE, NULL);
+			changed = true;
 		}
+		else if (!localblackentry->isflushed)
+			changed = true;
 	}
-	LWLockRelease(diskquota_locks.black_map_lock);
-}
+	if (!changed)
+		return;
 
-/*
- * Compare the disk quota limit and current usage of a database object.
- * Put them into local blacklist if quota limit is exceeded.
- */
-static void check_disk_quota_by_oid(Oid targetOid, int64 current_usage, QuotaType type)
-{
-	bool					found;
-	int32 					quota_limit_mb;
-	int32 					current_usage_mb;
-	LocalBlackMapEntry*		localblackentry;
-	BlackMapEntry 			keyitem;
+	num_entries = hash_get_num_entries(local_disk_quota_black_map);
+	namespaces = (Oid *) palloc(sizeof(Oid) * Max(num_entries, 1));
+	roles = (Oid *) palloc(sizeof(Oid) * Max(num_entries, 1));
 
-	QuotaLimitEntry* quota_entry;
-	if (type == NAMESPACE_QUOTA)
-	{
-		quota_entry = (QuotaLimitEntry *)hash_search(namespace_quota_limit_map,
-											&targetOid,
-											HASH_FIND, &found);
-	}
-	else if (type == ROLE_QUOTA)
-	{
-		quota_entry = (QuotaLimitEntry *)hash_search(role_quota_limit_map,
-											&targetOid,
-											HASH_FIND, &found);
-	}
-	else
+	hash_seq_init(&iter, local_disk_quota_black_map);
+	while ((localblackentry = hash_seq_search(&iter)) != NULL)
 	{
-		/* skip check if not namespace or role quota*/
-		return;
+		if (localblackentry->keyitem.targettype == DATABASE_QUOTA)
+		{
+			/* the database is a flag of the slot, not one of targets */
+			database_exceeded = true;
+			localblackentry->isflushed = true;
+			continue;
+		}
+		if (num_namespaces + num_roles >= MAX_BLACK_ENTRIES_PER_DB)
+		{
+			/* retried in next refresh */
+			localblackentry->isflushed = false;
+			continue;
+		}
+		if (localblackentry->keyitem.targettype == NAMESPACE_QUOTA)
+			namespaces[num_namespaces++] = localblackentry->keyitem.targetoid;
+		else
+			roles[num_roles++] = localblackentry->keyitem.targetoid;
+		localblackentry->isflushed = true;
 	}
+	if (num_namespaces + num_roles + (database_exceeded ? 1 : 0) < num_entries)
+		elog(WARNING, "shared disk quota black map size limit reached.");
 
-	if (!found)
-	{
-		/* default no limit */
-		return;
-	}
+	qsort(namespaces, num_namespaces, sizeof(Oid), oid_compare);
+	qsort(roles, num_roles, sizeof(Oid), oid_compare);
 
-	quota_limit_mb = quota_entry->limitsize;
-	current_usage_mb = current_usage / (1024 *1024);
-	if(current_usage_mb >= quota_limit_mb)
-	{
-		memset(&keyitem, 0, sizeof(BlackMapEntry));
-		keyitem.targetoid = targetOid;
-		keyitem.databaseoid = MyDatabaseId;
-		keyitem.targettype = (uint32)type;
-		elog(DEBUG1,"Put object %u to blacklist with quota limit:%d, current usage:%d",
-				targetOid, quota_limit_mb, current_usage_mb);
-		localblackentry = (LocalBlackMapEntry*) hash_search(local_disk_quota_black_map,
-					&keyitem,
-					HASH_ENTER, &found);
-		localblackentry->isexceeded = true;
-	}
+	LWLockAcquire(diskquota_locks.black_map_lock, LW_EXCLUSIVE);
+	slot = &black_list_slots[my_worker_slot - worker_slots];
+	slot->dbid = MyDatabaseId;
+	memcpy(slot->targets, namespaces, sizeof(Oid) * num_namespaces);
+	memcpy(slot->targets + num_namespaces, roles, sizeof(Oid) * num_roles);
+	slot->num_namespaces = num_namespaces;
+	slot->num_roles = num_roles;
+	slot->database_exceeded = database_exceeded;
+	slot->generation++;
+	LWLockRelease(diskquota_locks.black_map_lock);
 
+	black_list_published = true;
+	pfree(namespaces);
+	pfree(roles);
+}
+
+static int
+oid_compare(const void *a, const void *b)
+{
+	Oid			oa = *(const Oid *) a;
+	Oid			ob = *(const Oid *) b;
+
+	if (oa < ob)
+		return -1;
+	return oa > ob ? 1 : 0;
 }
 
 /*
- *  Remove a namespace from local namespace_size_map
+ * Find the blacklist slot of a database.
+ * Caller should hold black_map_lock.
  */
-static void
-remove_namespace_map(Oid namespaceoid)
+static BlackListSlot *
+get_black_list_slot(Oid dbid)
 {
-	hash_search(namespace_size_map,
-			&namespaceoid,
-			HASH_REMOVE, NULL);
+	int			i;
+
+	for (i = 0; i < MAX_NUM_MONITORED_DB; i++)
+	{
+		if (black_list_slots[i].dbid == dbid)
+			return &black_list_slots[i];
+	}
+	return NULL;
 }
 
 /*
- * Update the current disk usage of a namespace in namespace_size_map.
+ * Copy the changed entries of local usage map to the shared usage map.
+ * Unchanged entries are skipped to keep the lock holding time short.
  */
 static void
-update_namespace_map(Oid namespaceoid, int64 updatesize)
+flush_local_usage_map(void)
+{
+	HASH_SEQ_STATUS iter;
+	LocalTargetUsageEntry *localentry;
+	TargetUsageEntry *entry;
+
+	LWLockAcquire(diskquota_locks.usage_map_lock, LW_EXCLUSIVE);
+
+	hash_seq_init(&iter, local_disk_quota_usage_map);
+	while ((localentry = hash_seq_search(&iter)) != NULL)
+	{
+		if (!localentry->ischanged)
+			continue;
+
+		if (localentry->isremoved)
+		{
+			(void) hash_search(disk_quota_usage_map,
+							   (void *) &localentry->item.keyitem,
+							   HASH_REMOVE, NULL);
+			(void) hash_search(local_disk_quota_usage_map,
+							   (void *) &localentry->item.keyitem,
+							   HASH_REMOVE, NULL);
+			continue;
+		}
+
+		entry = (TargetUsageEntry *) hash_search(disk_quota_usage_map,
+							   (void *) &localentry->item.keyitem,
+							   HASH_ENTER_NULL, NULL);
+		if (entry == NULL)
+		{
+			elog(WARNING, "shared disk quota usage map size limit reached.");
+			hash_seq_term(&iter);
+			break;
+		}
+		*entry = localentry->item;
+		localentry->ischanged = false;
+	}
+	LWLockRelease(diskquota_locks.usage_map_lock);
+}
+
+/*
+ * Record the usage, quota limit and WAL usage of a schema or role in local
+ * usage map.  walentry is NULL if the target has not generated WAL.
+ */
+static void
+update_local_usage_map(Oid targetoid, QuotaType type, int64 usage, int64 remoteusage,
+					   int64 limitsize, WalRateEntry *walentry)
+{
+	bool found;
+	BlackMapEntry keyitem;
+	LocalTargetUsageEntry *localentry;
+	int64		walbytes = walentry ? walentry->walbytes : 0;
+	double		walrate = walentry ? walentry->walrate : 0;
+
+	memset(&keyitem, 0, sizeof(BlackMapEntry));
+	keyitem.targetoid = targetoid;
+	keyitem.databaseoid = MyDatabaseId;
+	keyitem.targettype = (uint32) type;
+
+	localentry = (LocalTargetUsageEntry *) hash_search(local_disk_quota_usage_map,
+							   &keyitem,
+							   HASH_ENTER, &found);
+	if (!found || localentry->isremoved ||
+		localentry->item.usage != usage ||
+		localentry->item.remoteusage != remoteusage ||
+		localentry->item.limitsize != limitsize ||
+		localentry->item.walbytes != walbytes ||
+		localentry->item.walrate != walrate)
+	{
+		if (!found || localentry->isremoved)
+			localentry->item.reclaimable = -1;
+		localentry->item.keyitem = keyitem;
+		if (!found || localentry->isremoved || localentry->item.usage != usage)
+			federation_changed = true;
+		localentry->item.usage = usage;
+		localentry->item.remoteusage = remoteusage;
+		localentry->item.limitsize = limitsize;
+		localentry->item.walbytes = walbytes;
+		localentry->item.walrate = walrate;
+		localentry->ischanged = true;
+		localentry->isremoved = false;
+	}
+}
+
+/*
+ * Mark a dropped schema or role to be removed from shared usage map.
+ */
+static void
+remove_local_usage_map(Oid targetoid, QuotaType type)
+{
+	BlackMapEntry keyitem;
+	LocalTargetUsageEntry *localentry;
+
+	memset(&keyitem, 0, sizeof(BlackMapEntry));
+	keyitem.targetoid = targetoid;
+	keyitem.databaseoid = MyDatabaseId;
+	keyitem.targettype = (uint32) type;
+
+	localentry = (LocalTargetUsageEntry *) hash_search(local_disk_quota_usage_map,
+							   &keyitem,
+							   HASH_FIND, NULL);
+	if (localentry != NULL)
+	{
+		localentry->ischanged = true;
+		localentry->isremoved = true;
+		federation_changed = true;
+	}
+}
+
+/*
+ * Compare the disk quota limit and current usage of a database object.
+ * Put them into local blacklist if quota limit is exceeded, or if they
+ * generate WAL faster than diskquota.max_wal_rate.
+ */
+static void check_disk_quota_by_oid(Oid targetOid, int64 current_usage, QuotaType type)
+{
+	bool					found;
+	int64					limitsize;
+	int32 					quota_limit_mb;
+	int32 					current_usage_mb;
+	LocalBlackMapEntry*		localblackentry;
+	BlackMapEntry 			keyitem;
+	WalRateEntry		   *walentry;
+	int64					remote_usage;
+	bool					exceeded;
+
+	QuotaLimitEntry* quota_entry;
+	if (type == NAMESPACE_QUOTA)
+	{
+		quota_entry = (QuotaLimitEntry *)hash_search(namespace_quota_limit_map,
+											&targetOid,
+											HASH_FIND, &found);
+	}
+	else if (type == ROLE_QUOTA)
+	{
+		quota_entry = (QuotaLimitEntry *)hash_search(role_quota_limit_map,
+											&targetOid,
+											HASH_FIND, &found);
+	}
+	else if (type == DATABASE_QUOTA)
+	{
+		/* quota rules do not apply to databases */
+		quota_entry = NULL;
+		found = false;
+	}
+	else
+	{
+		/* skip check if not namespace, role or database quota*/
+		return;
+	}
+
+	/* quota limit in quota_config takes precedence over quota rules */
+	if (found)
+		limitsize = quota_entry->limitsize;
+	else if (type == DATABASE_QUOTA)
+		limitsize = database_quota_limit;
+	else
+		limitsize = get_rule_quota_limit(targetOid, type);
+
+	walentry = get_wal_rate(targetOid, type);
+	remote_usage = get_federated_usage(targetOid, type);
+	update_local_usage_map(targetOid, type, current_usage, remote_usage, limitsize, walentry);
+
+	/* limitsize <= 0 means no limit */
+	quota_limit_mb = limitsize;
+	current_usage_mb = (current_usage + remote_usage) / (1024 *1024);
+	exceeded = limitsize > 0 && current_usage_mb >= quota_limit_mb;
+	if (walentry != NULL && is_wal_rate_exceeded(walentry->walrate))
+		exceeded = true;
+
+	if (exceeded)
+	{
+		memset(&keyitem, 0, sizeof(BlackMapEntry));
+		keyitem.targetoid = targetOid;
+		keyitem.databaseoid = MyDatabaseId;
+		keyitem.targettype = (uint32)type;
+		elog(DEBUG1,"Put object %u to blacklist with quota limit:%d, current usage:%d",
+				targetOid, quota_limit_mb, current_usage_mb);
+		localblackentry = (LocalBlackMapEntry*) hash_search(local_disk_quota_black_map,
+					&keyitem,
+					HASH_ENTER, &found);
+		if (!found)
+			localblackentry->isflushed = false;
+		localblackentry->isexceeded = true;
+	}
+	else
+	{
+		remove_local_black_map(targetOid, type);
+	}
+
+}
+
+/*
+ * Mark a schema or role to be removed from shared black map by the next
+ * flush_local_black_map(), if it is in local blacklist.
+ */
+static void
+remove_local_black_map(Oid targetoid, QuotaType type)
+{
+	BlackMapEntry keyitem;
+	LocalBlackMapEntry *localblackentry;
+
+	memset(&keyitem, 0, sizeof(BlackMapEntry));
+	keyitem.targetoid = targetoid;
+	keyitem.databaseoid = MyDatabaseId;
+	keyitem.targettype = (uint32) type;
+
+	localblackentry = (LocalBlackMapEntry *) hash_search(local_disk_quota_black_map,
+					&keyitem,
+					HASH_FIND, NULL);
+	if (localblackentry != NULL)
+		localblackentry->isexceeded = false;
+}
+
+/*
+ *  Remove a namespace from local namespace_size_map
+ */
+static void
+remove_namespace_map(Oid namespaceoid)
+{
+	hash_search(namespace_size_map,
+			&namespaceoid,
+			HASH_REMOVE, NULL);
+}
+
+/*
+ * Update the current disk usage of a namespace in namespace_size_map.
+ */
+static void
+update_namespace_map(Oid namespaceoid, int64 updatesize)
 {
 	bool found;
 	NamespaceSizeEntry* nsentry;
@@ -454,11 +1213,30 @@ update_namespace_map(Oid namespaceoid, int64 updatesize)
 	{
 		nsentry->namespaceoid = namespaceoid;
 		nsentry->totalsize = updatesize;
+		nsentry->isdirty = false;
 	}
 	else {
 		nsentry->totalsize += updatesize;
 	}
 
+	if (!found || updatesize != 0)
+		mark_namespace_dirty(nsentry);
+}
+
+/*
+ * Put a namespace into dirty_namespaces to be checked by next refresh.
+ */
+static void
+mark_namespace_dirty(NamespaceSizeEntry *nsentry)
+{
+	MemoryContext oldcontext;
+
+	if (nsentry->isdirty)
+		return;
+	oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+	dirty_namespaces = lappend_oid(dirty_namespaces, nsentry->namespaceoid);
+	MemoryContextSwitchTo(oldcontext);
+	nsentry->isdirty = true;
 }
 
 /*
@@ -487,11 +1265,184 @@ update_role_map(Oid owneroid, int64 updatesize)
 	{
 		rolentry->owneroid = owneroid;
 		rolentry->totalsize = updatesize;
+		rolentry->isdirty = false;
 	}
 	else {
 		rolentry->totalsize += updatesize;
 	}
 
+	if (!found || updatesize != 0)
+		mark_role_dirty(rolentry);
+}
+
+/*
+ * Put a role into dirty_roles to be checked by next refresh.
+ */
+static void
+mark_role_dirty(RoleSizeEntry *rolentry)
+{
+	MemoryContext oldcontext;
+
+	if (rolentry->isdirty)
+		return;
+	oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+	dirty_roles = lappend_oid(dirty_roles, rolentry->owneroid);
+	MemoryContextSwitchTo(oldcontext);
+	rolentry->isdirty = true;
+}
+
+/*
+ * Find the table whose current relfilenode is node.
+ */
+static TableSizeEntry *
+lookup_table_by_node(RelFileNode *node)
+{
+	TableNodeEntry *nodeentry;
+
+	nodeentry = (TableNodeEntry *) hash_search(table_node_map,
+											   node,
+											   HASH_FIND, NULL);
+	if (nodeentry == NULL)
+		return NULL;
+	return (TableSizeEntry *) hash_search(table_size_map,
+										  &nodeentry->reloid,
+										  HASH_FIND, NULL);
+}
+
+/*
+ * Get the oid of the table whose current relfilenode is node in the model,
+ * or InvalidOid if the relfilenode is not known yet.  It lets diskquota
+ * worker resolve active relfilenodes without catalog lookup.
+ */
+Oid
+get_table_oid_by_node(RelFileNode *node)
+{
+	TableSizeEntry *tsentry;
+
+	if (table_node_map == NULL)
+		return InvalidOid;
+	tsentry = lookup_table_by_node(node);
+	return tsentry ? tsentry->reloid : InvalidOid;
+}
+
+/*
+ * Set the current relfilenode of a table and maintain the relfilenode index.
+ * The old relfilenode is forgotten, so its unlink event is ignored later.
+ */
+static void
+set_table_node(TableSizeEntry *tsentry, RelFileNode *node)
+{
+	TableNodeEntry *nodeentry;
+
+	nodeentry = (TableNodeEntry *) hash_search(table_node_map,
+											   &tsentry->node,
+											   HASH_FIND, NULL);
+	if (nodeentry != NULL && nodeentry->reloid == tsentry->reloid)
+		hash_search(table_node_map, &tsentry->node, HASH_REMOVE, NULL);
+
+	tsentry->node = *node;
+	nodeentry = (TableNodeEntry *) hash_search(table_node_map,
+											   node,
+											   HASH_ENTER, NULL);
+	nodeentry->node = *node;
+	nodeentry->reloid = tsentry->reloid;
+}
+
+/*
+ * Init a new entry of table_size_map, its relfilenode is set by caller.
+ */
+static void
+init_table_size_entry(TableSizeEntry *tsentry, Oid reloid, Oid namespaceoid, Oid owneroid)
+{
+	tsentry->reloid = reloid;
+	tsentry->namespaceoid = namespaceoid;
+	tsentry->owneroid = owneroid;
+	tsentry->totalsize = 0;
+	memset(&tsentry->node, 0, sizeof(RelFileNode));
+	tsentry->reclaimable = 0;
+	tsentry->heapsize = 0;
+	tsentry->freespace = 0;
+	tsentry->scannedsize = -1;
+	tsentry->vacuumcount = 0;
+	tsentry->first_seen = activity_time;
+	tsentry->last_extended = 0;
+	tsentry->last_truncated = 0;
+	tsentry->generation = table_generation;
+	if (saved_activity_map != NULL)
+	{
+		RelationActivity *activity;
+
+		activity = (RelationActivity *) hash_search(saved_activity_map, &reloid, HASH_FIND, NULL);
+		if (activity != NULL)
+		{
+			tsentry->first_seen = activity->first_seen;
+			tsentry->last_extended = activity->last_extended;
+			tsentry->last_truncated = activity->last_truncated;
+		}
+	}
+	activity_changed = true;
+}
+
+/*
+ * Update the size of a table and the usage of its schema and owner.
+ * A table found grown or shrunk after the initial refresh is written.
+ * The initial refresh compares the size with the one saved by the
+ * previous worker instead, to find the writes while no worker ran.
+ */
+static void
+update_table_size(TableSizeEntry *tsentry, int64 newsize)
+{
+	int64 oldtotalsize = tsentry->totalsize;
+	int64 lastsize = oldtotalsize;
+	bool  compared = activity_tracked;
+
+	if (!activity_tracked && saved_activity_map != NULL)
+	{
+		RelationActivity *activity;
+
+		activity = (RelationActivity *) hash_search(saved_activity_map, &tsentry->reloid,
+													HASH_FIND, NULL);
+		if (activity != NULL)
+		{
+			lastsize = activity->size;
+			compared = true;
+		}
+	}
+
+	if (compared && newsize != lastsize)
+	{
+		if (newsize > lastsize)
+			tsentry->last_extended = activity_time;
+		else
+			tsentry->last_truncated = activity_time;
+		activity_changed = true;
+	}
+	tsentry->totalsize = newsize;
+	tables_total_size += tsentry->totalsize - oldtotalsize;
+	update_namespace_map(tsentry->namespaceoid, tsentry->totalsize - oldtotalsize);
+	update_role_map(tsentry->owneroid, tsentry->totalsize - oldtotalsize);
+}
+
+/*
+ * Remove a table from table_size_map and its relfilenode from the index.
+ */
+static void
+remove_table_size_entry(TableSizeEntry *tsentry)
+{
+	TableNodeEntry *nodeentry;
+	Oid			reloid = tsentry->reloid;
+
+	tables_total_size -= tsentry->totalsize;
+	activity_changed = true;
+	update_namespace_map(tsentry->namespaceoid, -1 * tsentry->totalsize);
+	update_role_map(tsentry->owneroid, -1 * tsentry->totalsize);
+
+	nodeentry = (TableNodeEntry *) hash_search(table_node_map,
+											   &tsentry->node,
+											   HASH_FIND, NULL);
+	if (nodeentry != NULL && nodeentry->reloid == reloid)
+		hash_search(table_node_map, &tsentry->node, HASH_REMOVE, NULL);
+	hash_search(table_size_map, &reloid, HASH_REMOVE, NULL);
 }
 
 /*
@@ -503,12 +1454,16 @@ update_role_map(Oid owneroid, int64 updatesize)
  *  Parameter 'force' set to true at initialization stage to recalculate 
  *  the file size of all the tables.
  *
+ *  table_size_map is keyed by table oid, so a relfilenode swap caused by
+ *  TRUNCATE, VACUUM FULL, CLUSTER or table rewrite is a size update of the
+ *  same entry instead of a pair of delete and insert.
  */
 static void
 calculate_table_disk_usage(bool force)
 {
 	bool found;
 	bool active_tbl_found = false;
+	bool node_swapped;
 	Relation	classRel;
 	HeapTuple	tuple;
 	HeapScanDesc relScan;
@@ -519,6 +1474,8 @@ calculate_table_disk_usage(bool force)
 	HTAB *local_active_table_stat_map;
 	DiskQuotaActiveTableEntry *active_table_entry;
 
+	activity_time = GetCurrentTimestamp();
+	table_generation++;
 	classRel = heap_open(RelationRelationId, AccessShareLock);
 	relScan = heap_beginscan_catalog(classRel, 0, NULL);
 
@@ -534,6 +1491,7 @@ calculate_table_disk_usage(bool force)
 	{
 		Form_pg_class classForm = (Form_pg_class) GETSTRUCT(tuple);
 		found = false;
+		node_swapped = false;
 
 		if (classForm->relkind != RELKIND_RELATION &&
 			classForm->relkind != RELKIND_MATVIEW)
@@ -560,20 +1518,23 @@ calculate_table_disk_usage(bool force)
 		node.relNode = classForm->relfilenode;
 
 		tsentry = (TableSizeEntry *)hash_search(table_size_map,
-		                                        &node,
+		                                        &relOid,
 		                                        HASH_ENTER, &found);
 
 
 		/* We need to check whether such table is in local cache yet. If not, we init the entry firstly. */
 		if(!found)
 		{
-			tsentry->node = node;
-			tsentry->reloid = relOid;
-			tsentry->namespaceoid = classForm->relnamespace;
-			tsentry->owneroid = classForm->relowner;
-			tsentry->totalsize = 0;
-
+			init_table_size_entry(tsentry, relOid, classForm->relnamespace, classForm->relowner);
+			set_table_node(tsentry, &node);
+		}
+		else if (!RelFileNodeEquals(tsentry->node, node))
+		{
+			/* relfilenode is swapped, the unlink of the old one will be ignored */
+			set_table_node(tsentry, &node);
+			node_swapped = true;
 		}
+		tsentry->generation = table_generation;
 
 		/* The worker is single thread, so it should be safe when using HASH_REMOVE as there is no other thread
 		 * on this hash table
@@ -583,22 +1544,21 @@ calculate_table_disk_usage(bool force)
 		/* skip to recalculate the tables which are not in active list and not at initializatio stage*/
 		if(active_tbl_found)
 		{
-			int64 oldtotalsize;
-
 			if (active_table_entry->type == AT_UNLINK)
 			{
 				/* in case of the relate file has been removed, but the relfilenode is still existing in catalog */
-				update_namespace_map(tsentry->namespaceoid, -1 * tsentry->totalsize);
-				update_role_map(tsentry->owneroid, -1 * tsentry->totalsize);
-				hash_search(table_size_map, &node, HASH_REMOVE, NULL);
-			}
-			else
-			{
-				oldtotalsize = tsentry->totalsize;
-				tsentry->totalsize = active_table_entry->tablesize;
-				update_namespace_map(tsentry->namespaceoid, tsentry->totalsize - oldtotalsize);
-				update_role_map(tsentry->owneroid, tsentry->totalsize - oldtotalsize);
+				remove_table_size_entry(tsentry);
+				continue;
 			}
+			update_table_size(tsentry, active_table_entry->tablesize);
+		}
+		else if (node_swapped || is_refresh_target(classForm->relnamespace, classForm->relowner))
+		{
+			/*
+			 * re-measure the table whose new relfilenode is not reported as active,
+			 * or the table of schema or role requested by diskquota.refresh()
+			 */
+			update_table_size(tsentry, diskquota_get_table_size_by_oid(relOid));
 		}
 
 		/* if schema change, transfer the file size */
@@ -624,127 +1584,956 @@ calculate_table_disk_usage(bool force)
 	hash_seq_init(&iter, local_active_table_stat_map);
 	while ((active_table_entry = (DiskQuotaActiveTableEntry *) hash_seq_search(&iter)) != NULL)
 	{
+		tsentry = lookup_table_by_node(&active_table_entry->node);
 
-		tsentry = (TableSizeEntry *)hash_search(table_size_map,
-		                                        &active_table_entry->node,
-		                                        HASH_ENTER, &found);
-
-
-
-		/* A new invisible table object found, we need to init it firstly and then do update */
-		if(!found && active_table_entry->type != AT_UNLINK)
+		if (active_table_entry->type == AT_UNLINK)
 		{
-			tsentry->node = active_table_entry->node;
-			tsentry->reloid = InvalidOid;
-			tsentry->namespaceoid = active_table_entry->namespace;
-			tsentry->owneroid = active_table_entry->owner;
-			tsentry->totalsize = active_table_entry->tablesize;
+			/*
+			 * The relfilenode is not found if it has been swapped out by a table rewrite,
+			 * or the table has been created, then dropped out in one cycle of diskquota
+			 * worker process
+			 */
+			if (tsentry == NULL)
+				continue;
+			remove_table_size_entry(tsentry);
+			ereport(DEBUG1, (errmsg("An active relfilenode %d:%d is deleted into local cache",
+			                     active_table_entry->node.relNode, active_table_entry->node.spcNode)));
+			continue;
+		}
 
-			update_namespace_map(tsentry->namespaceoid, tsentry->totalsize);
-			update_role_map(tsentry->reloid, tsentry->totalsize);
+		if (tsentry == NULL && active_table_entry->reloid != InvalidOid)
+		{
+			Oid			namespaceoid = active_table_entry->namespace;
+			Oid			owneroid = active_table_entry->owner;
 
-			ereport(DEBUG1, (errmsg("An active relfilenode %d:%d is added into local cache",
-			                       active_table_entry->node.relNode, active_table_entry->node.spcNode)));
+			/*
+			 * Committed relfilenode which is not scanned above is either not a table,
+			 * or the table is committed after the scan started.
+			 */
+			if (namespaceoid == InvalidOid)
+			{
+				HeapTuple	tp;
+				char		relkind;
+
+				tp = SearchSysCache1(RELOID, ObjectIdGetDatum(active_table_entry->reloid));
+				if (!HeapTupleIsValid(tp))
+					continue;
+				relkind = ((Form_pg_class) GETSTRUCT(tp))->relkind;
+				namespaceoid = ((Form_pg_class) GETSTRUCT(tp))->relnamespace;
+				owneroid = ((Form_pg_class) GETSTRUCT(tp))->relowner;
+				ReleaseSysCache(tp);
+				if (relkind != RELKIND_RELATION && relkind != RELKIND_MATVIEW)
+					continue;
+			}
 
+			tsentry = (TableSizeEntry *)hash_search(table_size_map,
+			                                        &active_table_entry->reloid,
+			                                        HASH_ENTER, &found);
+			/* A new invisible table object found, we need to init it firstly and then do update */
+			if (!found)
+			{
+				init_table_size_entry(tsentry, active_table_entry->reloid, namespaceoid, owneroid);
+				ereport(DEBUG1, (errmsg("An active relfilenode %d:%d is added into local cache",
+				                       active_table_entry->node.relNode, active_table_entry->node.spcNode)));
+			}
+			set_table_node(tsentry, &active_table_entry->node);
 		}
-		else if (found && active_table_entry->type != AT_UNLINK)
-		{
-			int64 oldtotalsize = tsentry->totalsize;
-			tsentry->totalsize = active_table_entry->tablesize;
-			update_namespace_map(tsentry->namespaceoid, tsentry->totalsize - oldtotalsize);
-			update_role_map(tsentry->owneroid, tsentry->totalsize - oldtotalsize);
-			ereport(DEBUG1, (errmsg("An active relfilenode %d:%d is updated into local cache",
-			                     active_table_entry->node.relNode, active_table_entry->node.spcNode)));
-		}
-		else if (found && active_table_entry->type == AT_UNLINK)
+
+		if (tsentry == NULL)
 		{
-			update_role_map(tsentry->owneroid, -1 * tsentry->totalsize);
-			update_namespace_map(tsentry->namespaceoid, -1 * tsentry->totalsize);
-			hash_search(table_size_map, &active_table_entry->node, HASH_REMOVE, NULL);
-			ereport(DEBUG1, (errmsg("An active relfilenode %d:%d is deleted into local cache",
+			ereport(DEBUG1, (errmsg("An active relfilenode %d:%d without table oid is ignored",
 			                     active_table_entry->node.relNode, active_table_entry->node.spcNode)));
-		}
-		else if (!found && active_table_entry->type == AT_UNLINK)
-		{
-			/* This case means the table has been created, the dropped out in one cycle of diskquota worker process */
 			continue;
 		}
-		else
-		{
-			ereport(ERROR, (errmsg("An active relfilenode %d:%d is under incorrect status",
-			                     active_table_entry->node.relNode, active_table_entry->node.spcNode)));
 
+		tsentry->generation = table_generation;
+		update_table_size(tsentry, active_table_entry->tablesize);
+		ereport(DEBUG1, (errmsg("An active relfilenode %d:%d is updated into local cache",
+		                     active_table_entry->node.relNode, active_table_entry->node.spcNode)));
+	}
+	hash_destroy(local_active_table_stat_map);
+
+	/*
+	 * The pgstat detector has no unlink event, remove the tables not found
+	 * above, which are dropped.  It only reports committed tables, so there
+	 * is no table invisible in catalog to keep.
+	 */
+	if (diskquota_active_table_detector == ACTIVE_TABLE_DETECTOR_PGSTAT)
+	{
+		hash_seq_init(&iter, table_size_map);
+		while ((tsentry = (TableSizeEntry *) hash_seq_search(&iter)) != NULL)
+		{
+			if (tsentry->generation != table_generation)
+				remove_table_size_entry(tsentry);
 		}
+	}
 
+	/* the saved times are taken by the tables which still exist */
+	if (!activity_tracked)
+	{
+		if (saved_activity_map != NULL)
+			hash_destroy(saved_activity_map);
+		saved_activity_map = NULL;
+		activity_tracked = true;
 	}
-	hash_destroy(local_active_table_stat_map);
 }
 
 /*
- * Check the namespace quota limit and current usage
- * Remove dropped namespace from namespace_size_map
+ * Save the write times of all the tables in the model if any of them is
+ * changed, at most every RELATION_ACTIVITY_SAVE_INTERVAL unless force.
  */
-static void calculate_schema_disk_usage(void)
+static void
+save_table_activity(bool force)
 {
-	HeapTuple	tuple;
 	HASH_SEQ_STATUS iter;
-	NamespaceSizeEntry* nsentry;
-	hash_seq_init(&iter, namespace_size_map);
+	TableSizeEntry *tsentry;
+	RelationActivity *entries;
+	int			num_entries = 0;
+	TimestampTz now = GetCurrentTimestamp();
+
+	if (!activity_changed)
+		return;
+	if (!force && !TimestampDifferenceExceeds(last_activity_save, now,
+											  RELATION_ACTIVITY_SAVE_INTERVAL * 1000))
+		return;
 
-	while ((nsentry = hash_seq_search(&iter)) != NULL)
+	entries = (RelationActivity *) palloc(sizeof(RelationActivity) *
+										  Max(hash_get_num_entries(table_size_map), 1));
+	hash_seq_init(&iter, table_size_map);
+	while ((tsentry = hash_seq_search(&iter)) != NULL)
 	{
-		/* check if namespace is already be deleted */
-		tuple = SearchSysCache1(NAMESPACEOID, ObjectIdGetDatum(nsentry->namespaceoid));
-		if (!HeapTupleIsValid(tuple))
-		{
-			remove_namespace_map(nsentry->namespaceoid);
-			continue;
-		}
-		ReleaseSysCache(tuple);
-		check_disk_quota_by_oid(nsentry->namespaceoid, nsentry->totalsize, NAMESPACE_QUOTA);
+		RelationActivity *entry = &entries[num_entries++];
+
+		entry->reloid = tsentry->reloid;
+		entry->size = tsentry->totalsize;
+		entry->first_seen = tsentry->first_seen;
+		entry->last_extended = tsentry->last_extended;
+		entry->last_truncated = tsentry->last_truncated;
 	}
+	save_relation_activity(entries, num_entries);
+	pfree(entries);
+
+	activity_changed = false;
+	last_activity_save = now;
 }
 
 /*
- * Check the role quota limit and current usage
- * Remove dropped role from roel_size_map
+ * Check the namespace quota limit and current usage of a namespace.
+ * Remove dropped namespace from namespace_size_map
  */
-static void calculate_role_disk_usage(void)
+static void
+check_namespace(NamespaceSizeEntry *nsentry)
 {
 	HeapTuple	tuple;
-	HASH_SEQ_STATUS iter;
-	RoleSizeEntry* rolentry;
-	hash_seq_init(&iter, role_size_map);
 
-	while ((rolentry = hash_seq_search(&iter)) != NULL)
+	nsentry->isdirty = false;
+	/* check if namespace is already be deleted */
+	tuple = SearchSysCache1(NAMESPACEOID, ObjectIdGetDatum(nsentry->namespaceoid));
+	if (!HeapTupleIsValid(tuple))
 	{
-		/* check if role is already be deleted */
-		tuple = SearchSysCache1(AUTHOID, ObjectIdGetDatum(rolentry->owneroid));
-		if (!HeapTupleIsValid(tuple))
-		{
-			remove_role_map(rolentry->owneroid);
+		remove_local_usage_map(nsentry->namespaceoid, NAMESPACE_QUOTA);
+		remove_local_black_map(nsentry->namespaceoid, NAMESPACE_QUOTA);
+		remove_namespace_map(nsentry->namespaceoid);
+		return;
+	}
+	ReleaseSysCache(tuple);
+	check_disk_quota_by_oid(nsentry->namespaceoid, nsentry->totalsize, NAMESPACE_QUOTA);
+}
+
+/*
+ * Check the namespaces whose usage is changed, or all of them if full.
+ */
+static void calculate_schema_disk_usage(bool full)
+{
+	HASH_SEQ_STATUS iter;
+	NamespaceSizeEntry* nsentry;
+	ListCell   *lc;
+
+	if (full)
+	{
+		hash_seq_init(&iter, namespace_size_map);
+		while ((nsentry = hash_seq_search(&iter)) != NULL)
+			check_namespace(nsentry);
+	}
+	else
+	{
+		foreach(lc, dirty_namespaces)
+		{
+			Oid			namespaceoid = lfirst_oid(lc);
+
+			nsentry = (NamespaceSizeEntry *) hash_search(namespace_size_map,
+														 &namespaceoid,
+														 HASH_FIND, NULL);
+			if (nsentry != NULL && nsentry->isdirty)
+				check_namespace(nsentry);
+		}
+	}
+	list_free(dirty_namespaces);
+	dirty_namespaces = NIL;
+}
+
+/*
+ * Check the role quota limit and current usage of a role.
+ * Remove dropped role from roel_size_map
+ */
+static void
+check_role(RoleSizeEntry *rolentry)
+{
+	HeapTuple	tuple;
+
+	rolentry->isdirty = false;
+	/* check if role is already be deleted */
+	tuple = SearchSysCache1(AUTHOID, ObjectIdGetDatum(rolentry->owneroid));
+	if (!HeapTupleIsValid(tuple))
+	{
+		remove_local_usage_map(rolentry->owneroid, ROLE_QUOTA);
+		remove_local_black_map(rolentry->owneroid, ROLE_QUOTA);
+		remove_role_map(rolentry->owneroid);
+		return;
+	}
+	ReleaseSysCache(tuple);
+	check_disk_quota_by_oid(rolentry->owneroid, rolentry->totalsize, ROLE_QUOTA);
+}
+
+/*
+ * Check the roles whose usage is changed, or all of them if full.
+ */
+static void calculate_role_disk_usage(bool full)
+{
+	HASH_SEQ_STATUS iter;
+	RoleSizeEntry* rolentry;
+	ListCell   *lc;
+
+	if (full)
+	{
+		hash_seq_init(&iter, role_size_map);
+		while ((rolentry = hash_seq_search(&iter)) != NULL)
+			check_role(rolentry);
+	}
+	else
+	{
+		foreach(lc, dirty_roles)
+		{
+			Oid			owneroid = lfirst_oid(lc);
+
+			rolentry = (RoleSizeEntry *) hash_search(role_size_map,
+													 &owneroid,
+													 HASH_FIND, NULL);
+			if (rolentry != NULL && rolentry->isdirty)
+				check_role(rolentry);
+		}
+	}
+	list_free(dirty_roles);
+	dirty_roles = NIL;
+}
+
+/*
+ * Measure the relations of current database which are not tables in the
+ * model: system catalogs and other relations created by initdb, with their
+ * indexes and toast tables, and sequences.  Shared catalogs are not part of
+ * any database, as in pg_database_size().
+ */
+static int64
+calculate_system_disk_usage(void)
+{
+	Relation	classRel;
+	HeapTuple	tuple;
+	HeapScanDesc relScan;
+	RelationSizeBatch batch;
+	int64		size = 0;
+
+	size_batch_init(&batch);
+	classRel = heap_open(RelationRelationId, AccessShareLock);
+	relScan = heap_beginscan_catalog(classRel, 0, NULL);
+	while ((tuple = heap_getnext(relScan, ForwardScanDirection)) != NULL)
+	{
+		Form_pg_class classForm = (Form_pg_class) GETSTRUCT(tuple);
+
+		if (classForm->relisshared)
+			continue;
+		if (classForm->relkind == RELKIND_SEQUENCE ||
+			((classForm->relkind == RELKIND_RELATION ||
+			  classForm->relkind == RELKIND_MATVIEW) &&
+			 classForm->oid < FirstNormalObjectId))
+		{
+			/* all of them are summed up into size, which is reset before execution */
+			size_batch_add_relation(&batch, classForm->oid, &size);
+		}
+	}
+	heap_endscan(relScan);
+	heap_close(classRel, AccessShareLock);
+	size_batch_execute(&batch);
+
+	return size;
+}
+
+/*
+ * Check the usage of current database against its quota limit.  The
+ * relations which are not tables in the model are measured again in full
+ * evaluations only, as they are rarely the ones to grow.
+ */
+static void
+calculate_database_disk_usage(bool full)
+{
+	if (full)
+		system_total_size = calculate_system_disk_usage();
+	check_disk_quota_by_oid(MyDatabaseId, tables_total_size + system_total_size, DATABASE_QUOTA);
+}
+
+/*
+ * Attribute the WAL generated since last refresh to schemas and roles, and
+ * update their WAL rates.  Schemas and roles whose rate is changed are
+ * checked again, since their rate may exceed diskquota.max_wal_rate.
+ */
+static void
+calculate_wal_usage(bool full)
+{
+	HTAB	   *wal_usage_map;
+	HASH_SEQ_STATUS iter;
+	WalUsageEntry *usageentry;
+	WalRateEntry *rateentry;
+	Datum	   *unknown_nodes;
+	int			num_unknown = 0;
+	TimestampTz now;
+	double		elapsed;
+	bool		limit_changed;
+
+	if (!diskquota_wal_accounting)
+	{
+		if (last_wal_collect_time != 0)
+		{
+			reset_wal_rates();
+			stop_wal_usage();
+			last_wal_collect_time = 0;
+		}
+		return;
+	}
+
+	now = GetCurrentTimestamp();
+	wal_usage_map = collect_wal_usage();
+	if (wal_usage_map == NULL)
+	{
+		last_wal_collect_time = now;
+		return;
+	}
+
+	/* schema and owner of indexes and toast tables may be changed */
+	if (full)
+	{
+		WalNodeEntry *nodeentry;
+
+		hash_seq_init(&iter, wal_node_map);
+		while ((nodeentry = hash_seq_search(&iter)) != NULL)
+			hash_search(wal_node_map, &nodeentry->node, HASH_REMOVE, NULL);
+	}
+
+	unknown_nodes = (Datum *) palloc(sizeof(Datum) *
+									 Max(hash_get_num_entries(wal_usage_map), 1));
+	hash_seq_init(&iter, wal_usage_map);
+	while ((usageentry = hash_seq_search(&iter)) != NULL)
+	{
+		TableSizeEntry *tsentry;
+
+		/* ignore system table */
+		if (usageentry->node.relNode < FirstNormalObjectId)
 			continue;
+		tsentry = lookup_table_by_node(&usageentry->node);
+		if (tsentry == NULL && hash_search(wal_node_map, &usageentry->node, HASH_FIND, NULL) == NULL)
+			unknown_nodes[num_unknown++] = ObjectIdGetDatum(usageentry->node.relNode);
+	}
+	if (num_unknown > 0)
+		resolve_wal_nodes(unknown_nodes, num_unknown);
+	pfree(unknown_nodes);
+
+	hash_seq_init(&iter, wal_usage_map);
+	while ((usageentry = hash_seq_search(&iter)) != NULL)
+	{
+		TableSizeEntry *tsentry;
+		WalNodeEntry *nodeentry;
+
+		if (usageentry->node.relNode < FirstNormalObjectId)
+			continue;
+		tsentry = lookup_table_by_node(&usageentry->node);
+		if (tsentry != NULL)
+		{
+			add_wal_bytes(tsentry->namespaceoid, NAMESPACE_QUOTA, usageentry->bytes);
+			add_wal_bytes(tsentry->owneroid, ROLE_QUOTA, usageentry->bytes);
+			continue;
+		}
+		nodeentry = (WalNodeEntry *) hash_search(wal_node_map, &usageentry->node, HASH_FIND, NULL);
+		if (nodeentry != NULL)
+		{
+			add_wal_bytes(nodeentry->namespaceoid, NAMESPACE_QUOTA, usageentry->bytes);
+			add_wal_bytes(nodeentry->owneroid, ROLE_QUOTA, usageentry->bytes);
 		}
-		ReleaseSysCache(tuple);
-		check_disk_quota_by_oid(rolentry->owneroid, rolentry->totalsize, ROLE_QUOTA);
+	}
+	hash_destroy(wal_usage_map);
+
+	elapsed = (now - last_wal_collect_time) / 1000000.0;
+	last_wal_collect_time = now;
+	limit_changed = evaluated_max_wal_rate != diskquota_max_wal_rate;
+	evaluated_max_wal_rate = diskquota_max_wal_rate;
+
+	hash_seq_init(&iter, wal_rate_map);
+	while ((rateentry = hash_seq_search(&iter)) != NULL)
+	{
+		double		walrate = elapsed > 0 ? rateentry->cyclebytes / elapsed : 0;
+
+		rateentry->walbytes += rateentry->cyclebytes;
+		rateentry->cyclebytes = 0;
+		if (walrate == rateentry->walrate && !limit_changed)
+			continue;
+		rateentry->walrate = walrate;
+		mark_target_dirty(rateentry->keyitem.targetoid, rateentry->keyitem.targettype);
+	}
+}
+
+/*
+ * Put a schema or role into the dirty list to be checked by this refresh.
+ */
+static void
+mark_target_dirty(Oid targetoid, QuotaType type)
+{
+	if (type == NAMESPACE_QUOTA)
+	{
+		NamespaceSizeEntry *nsentry;
+
+		nsentry = (NamespaceSizeEntry *) hash_search(namespace_size_map,
+													 &targetoid,
+													 HASH_FIND, NULL);
+		if (nsentry != NULL)
+			mark_namespace_dirty(nsentry);
+	}
+	else
+	{
+		RoleSizeEntry *rolentry;
+
+		rolentry = (RoleSizeEntry *) hash_search(role_size_map,
+												 &targetoid,
+												 HASH_FIND, NULL);
+		if (rolentry != NULL)
+			mark_role_dirty(rolentry);
+	}
+}
+
+/*
+ * Estimate the space VACUUM could reclaim in the schemas and roles whose
+ * usage reaches diskquota.reclaim_estimate_threshold percent of their quota
+ * limit, and publish the tables with most reclaimable space of each of
+ * them, so that operators could vacuum them instead of raising the limit.
+ * Tables of the other targets are not estimated at all.
+ */
+static void
+calculate_reclaimable_space(void)
+{
+	HASHCTL		ctl;
+	HTAB	   *reclaim_target_map;
+	HASH_SEQ_STATUS iter;
+	LocalTargetUsageEntry *localentry;
+	TableSizeEntry *tsentry;
+	ReclaimTarget *target;
+	ReclaimSlot *slot;
+	ReclaimEntry *entries;
+	int			num_entries = 0;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(BlackMapEntry);
+	ctl.entrysize = sizeof(ReclaimTarget);
+	ctl.hcxt = CurrentMemoryContext;
+	ctl.hash = tag_hash;
+
+	reclaim_target_map = hash_create("local map of targets near quota limit",
+									 64,
+									 &ctl,
+									 HASH_ELEM | HASH_CONTEXT | HASH_FUNCTION);
+
+	hash_seq_init(&iter, local_disk_quota_usage_map);
+	while ((localentry = hash_seq_search(&iter)) != NULL)
+	{
+		TargetUsageEntry *item = &localentry->item;
+
+		if (diskquota_reclaim_threshold > 0 && !localentry->isremoved &&
+			item->keyitem.targettype != DATABASE_QUOTA &&
+			item->limitsize > 0 &&
+			item->usage + item->remoteusage >=
+			item->limitsize * 1024 * 1024 / 100 * diskquota_reclaim_threshold)
+		{
+			target = (ReclaimTarget *) hash_search(reclaim_target_map, &item->keyitem,
+												   HASH_ENTER, NULL);
+			target->reclaimable = 0;
+			target->num_tables = 0;
+		}
+		else if (item->reclaimable != -1)
+		{
+			/* no longer near its limit */
+			item->reclaimable = -1;
+			localentry->ischanged = true;
+		}
+	}
+
+	if (hash_get_num_entries(reclaim_target_map) == 0 && !reclaim_published)
+	{
+		hash_destroy(reclaim_target_map);
+		return;
+	}
+
+	if (hash_get_num_entries(reclaim_target_map) > 0)
+	{
+		hash_seq_init(&iter, table_size_map);
+		while ((tsentry = hash_seq_search(&iter)) != NULL)
+		{
+			BlackMapEntry keyitem;
+			ReclaimTarget *nstarget;
+			ReclaimTarget *roletarget;
+
+			memset(&keyitem, 0, sizeof(BlackMapEntry));
+			keyitem.databaseoid = MyDatabaseId;
+			keyitem.targetoid = tsentry->namespaceoid;
+			keyitem.targettype = NAMESPACE_QUOTA;
+			nstarget = (ReclaimTarget *) hash_search(reclaim_target_map, &keyitem, HASH_FIND, NULL);
+			keyitem.targetoid = tsentry->owneroid;
+			keyitem.targettype = ROLE_QUOTA;
+			roletarget = (ReclaimTarget *) hash_search(reclaim_target_map, &keyitem, HASH_FIND, NULL);
+			if (nstarget == NULL && roletarget == NULL)
+				continue;
+
+			estimate_reclaimable(tsentry);
+			if (nstarget != NULL)
+				add_reclaim_table(nstarget, tsentry);
+			if (roletarget != NULL)
+				add_reclaim_table(roletarget, tsentry);
+		}
+	}
+
+	entries = (ReclaimEntry *) palloc(sizeof(ReclaimEntry) * MAX_RECLAIM_ENTRIES_PER_DB);
+	hash_seq_init(&iter, reclaim_target_map);
+	while ((target = hash_seq_search(&iter)) != NULL)
+	{
+		int			i;
+
+		localentry = (LocalTargetUsageEntry *) hash_search(local_disk_quota_usage_map,
+														   &target->keyitem,
+														   HASH_FIND, NULL);
+		if (localentry != NULL && localentry->item.reclaimable != target->reclaimable)
+		{
+			localentry->item.reclaimable = target->reclaimable;
+			localentry->ischanged = true;
+		}
+
+		for (i = 0; i < target->num_tables && num_entries < MAX_RECLAIM_ENTRIES_PER_DB; i++)
+		{
+			ReclaimEntry *entry = &entries[num_entries++];
+
+			entry->reloid = target->tables[i]->reloid;
+			entry->targetoid = target->keyitem.targetoid;
+			entry->targettype = target->keyitem.targettype;
+			entry->tablesize = target->tables[i]->totalsize;
+			entry->reclaimable = target->tables[i]->reclaimable;
+		}
+	}
+	hash_destroy(reclaim_target_map);
+
+	LWLockAcquire(diskquota_locks.usage_map_lock, LW_EXCLUSIVE);
+	slot = &reclaim_slots[my_worker_slot - worker_slots];
+	slot->dbid = MyDatabaseId;
+	memcpy(slot->entries, entries, sizeof(ReclaimEntry) * num_entries);
+	slot->num_entries = num_entries;
+	LWLockRelease(diskquota_locks.usage_map_lock);
+
+	reclaim_published = num_entries > 0;
+	pfree(entries);
+}
+
+/*
+ * Add the reclaimable space of a table to a target, and keep the table if
+ * it is one of the tables with most reclaimable space of the target.
+ */
+static void
+add_reclaim_table(ReclaimTarget *target, TableSizeEntry *tsentry)
+{
+	int			i;
+
+	target->reclaimable += tsentry->reclaimable;
+	if (tsentry->reclaimable <= 0)
+		return;
+	if (target->num_tables == MAX_RECLAIM_TABLES_PER_TARGET &&
+		target->tables[target->num_tables - 1]->reclaimable >= tsentry->reclaimable)
+		return;
+
+	/* insertion into the short sorted array */
+	i = Min(target->num_tables, MAX_RECLAIM_TABLES_PER_TARGET - 1);
+	while (i > 0 && target->tables[i - 1]->reclaimable < tsentry->reclaimable)
+	{
+		target->tables[i] = target->tables[i - 1];
+		i--;
+	}
+	target->tables[i] = tsentry;
+	if (target->num_tables < MAX_RECLAIM_TABLES_PER_TARGET)
+		target->num_tables++;
+}
+
+/*
+ * Estimate the space VACUUM could reclaim in a table: the free space in its
+ * heap recorded in FSM, and the share of dead tuples in the rest of the
+ * heap according to pgstat.  Indexes and toast tables are not estimated.
+ * Scanning FSM reads a slot per heap block, so it is only done again after
+ * the table is vacuumed, which is what changes the recorded free space, or
+ * shrunk, e.g. truncated.  The share of dead tuples is cheap and taken in
+ * every refresh.
+ */
+static void
+estimate_reclaimable(TableSizeEntry *tsentry)
+{
+	PgStat_StatTabEntry *tabentry;
+	PgStat_Counter vacuumcount = 0;
+	PgStat_Counter live_tuples = 0;
+	PgStat_Counter dead_tuples = 0;
+	int64		reclaimable;
+
+	tabentry = pgstat_fetch_stat_tabentry(tsentry->reloid);
+	if (tabentry != NULL)
+	{
+		vacuumcount = tabentry->vacuum_count + tabentry->autovac_vacuum_count;
+		live_tuples = tabentry->n_live_tuples;
+		dead_tuples = tabentry->n_dead_tuples;
+	}
+
+	if (tsentry->scannedsize < 0 || tsentry->totalsize < tsentry->scannedsize ||
+		tsentry->vacuumcount != vacuumcount)
+	{
+		int64		heapsize;
+		int64		freespace;
+
+		freespace = diskquota_get_heap_free_space(tsentry->reloid, &heapsize);
+		if (freespace < 0)
+			return;			/* keep the last estimate, scan it in next refresh */
+		tsentry->heapsize = heapsize;
+		tsentry->freespace = freespace;
+		tsentry->scannedsize = tsentry->totalsize;
+		tsentry->vacuumcount = vacuumcount;
+	}
+
+	reclaimable = tsentry->freespace;
+	if (dead_tuples > 0 && tsentry->heapsize > tsentry->freespace)
+		reclaimable += (int64) ((double) (tsentry->heapsize - tsentry->freespace) *
+								dead_tuples / (live_tuples + dead_tuples));
+	tsentry->reclaimable = reclaimable;
+}
+
+/*
+ * Find the reclaim slot of a database.
+ * Caller should hold usage_map_lock.
+ */
+static ReclaimSlot *
+get_reclaim_slot(Oid dbid)
+{
+	int			i;
+
+	for (i = 0; i < MAX_NUM_MONITORED_DB; i++)
+	{
+		if (reclaim_slots[i].dbid == dbid)
+			return &reclaim_slots[i];
+	}
+	return NULL;
+}
+
+/*
+ * Read the usage published by the other federated workers.  The schemas
+ * and roles whose federated usage is changed are checked again, since they
+ * may exceed or fall below their quota limit without any local change.
+ */
+static void
+calculate_federated_usage(void)
+{
+	HTAB	   *new_usage_map;
+	HASH_SEQ_STATUS iter;
+	FederatedUsageEntry *entry;
+	FederatedUsageEntry *oldentry;
+	MemoryContext oldcontext;
+
+	if (!federation_enabled())
+		return;
+
+	oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+	new_usage_map = federation_collect();
+	MemoryContextSwitchTo(oldcontext);
+
+	hash_seq_init(&iter, new_usage_map);
+	while ((entry = hash_seq_search(&iter)) != NULL)
+	{
+		oldentry = NULL;
+		if (federated_usage_map != NULL)
+			oldentry = (FederatedUsageEntry *) hash_search(federated_usage_map, &entry->key,
+														   HASH_FIND, NULL);
+		if (oldentry == NULL || oldentry->usage != entry->usage)
+			mark_federated_target_dirty(&entry->key);
+	}
+	if (federated_usage_map != NULL)
+	{
+		hash_seq_init(&iter, federated_usage_map);
+		while ((oldentry = hash_seq_search(&iter)) != NULL)
+		{
+			if (hash_search(new_usage_map, &oldentry->key, HASH_FIND, NULL) == NULL)
+				mark_federated_target_dirty(&oldentry->key);
+		}
+		hash_destroy(federated_usage_map);
+	}
+	federated_usage_map = new_usage_map;
+}
+
+/*
+ * Check the local schema or role of a federated name again in this refresh.
+ */
+static void
+mark_federated_target_dirty(FederatedKey *key)
+{
+	Oid			targetoid;
+
+	if (key->type == NAMESPACE_QUOTA)
+		targetoid = get_namespace_oid(key->name, true);
+	else
+		targetoid = get_role_oid(key->name, true);
+	if (targetoid != InvalidOid)
+		mark_target_dirty(targetoid, key->type);
+}
+
+/*
+ * Get the usage of the schema or role of the same name in the other
+ * federated workers, 0 if federation is disabled or for a database.
+ */
+static int64
+get_federated_usage(Oid targetoid, QuotaType type)
+{
+	FederatedKey key;
+	FederatedUsageEntry *entry;
+	char	   *name;
+
+	if (federated_usage_map == NULL || hash_get_num_entries(federated_usage_map) == 0 ||
+		type == DATABASE_QUOTA)
+		return 0;
+
+	if (type == NAMESPACE_QUOTA)
+		name = get_namespace_name(targetoid);
+	else
+		name = GetUserNameFromId(targetoid, true);
+	if (name == NULL)
+		return 0;
+
+	memset(&key, 0, sizeof(key));
+	key.type = (uint32) type;
+	strlcpy(key.name, name, NAMEDATALEN);
+	entry = (FederatedUsageEntry *) hash_search(federated_usage_map, &key, HASH_FIND, NULL);
+	return entry ? entry->usage : 0;
+}
+
+/*
+ * Publish the local usage of all the schemas and roles to the other
+ * federated workers, when it is changed, or before the file becomes stale.
+ */
+static void
+publish_federated_usage(void)
+{
+	HASH_SEQ_STATUS iter;
+	LocalTargetUsageEntry *localentry;
+	FederatedTarget *targets;
+	int			num_targets = 0;
+	TimestampTz now;
+
+	if (!federation_enabled())
+		return;
+	now = GetCurrentTimestamp();
+	if (!federation_changed &&
+		!TimestampDifferenceExceeds(last_federation_publish, now,
+									FEDERATION_PUBLISH_INTERVAL * 1000))
+		return;
+
+	targets = (FederatedTarget *) palloc(sizeof(FederatedTarget) *
+										 Max(hash_get_num_entries(local_disk_quota_usage_map), 1));
+	hash_seq_init(&iter, local_disk_quota_usage_map);
+	while ((localentry = hash_seq_search(&iter)) != NULL)
+	{
+		char	   *name;
+
+		/* databases are not federated */
+		if (localentry->isremoved ||
+			localentry->item.keyitem.targettype == DATABASE_QUOTA)
+			continue;
+		if (localentry->item.keyitem.targettype == NAMESPACE_QUOTA)
+			name = get_namespace_name(localentry->item.keyitem.targetoid);
+		else
+			name = GetUserNameFromId(localentry->item.keyitem.targetoid, true);
+		if (name == NULL)
+			continue;
+
+		memset(&targets[num_targets], 0, sizeof(FederatedTarget));
+		targets[num_targets].type = localentry->item.keyitem.targettype;
+		strlcpy(targets[num_targets].name, name, NAMEDATALEN);
+		targets[num_targets].usage = localentry->item.usage;
+		num_targets++;
+	}
+
+	federation_publish(targets, num_targets);
+	pfree(targets);
+	federation_changed = false;
+	last_federation_publish = now;
+}
+
+/*
+ * Look up the schema and owner of relfilenodes which are not tables in the
+ * model, i.e. indexes and toast tables, or tables created after last
+ * refresh.  Indexes and toast tables take the schema and owner of their
+ * table.  Relfilenodes which are not found are looked up again next time.
+ */
+static void
+resolve_wal_nodes(Datum *nodes, int num_nodes)
+{
+	Oid			argtypes[1];
+	Datum		values[1];
+	int			ret;
+	uint64		i;
+
+	argtypes[0] = get_array_type(OIDOID);
+	values[0] = PointerGetDatum(construct_array(nodes, num_nodes, OIDOID,
+												sizeof(Oid), true, 'i'));
+	ret = SPI_execute_with_args("select c.relfilenode, c.reltablespace,"
+								" coalesce(t.relnamespace, p.relnamespace), coalesce(t.relowner, p.relowner)"
+								" from pg_class c"
+								" left join pg_index i on i.indexrelid = c.oid"
+								" join pg_class p on p.oid = coalesce(i.indrelid, c.oid)"
+								" left join pg_class t on t.reltoastrelid = p.oid"
+								" where c.relfilenode = any($1)",
+								1, argtypes, values, NULL, true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "[diskquota] cannot look up relfilenodes in pg_class, error code %d", ret);
+
+	for (i = 0; i < SPI_processed; i++)
+	{
+		HeapTuple	tup = SPI_tuptable->vals[i];
+		TupleDesc	tupdesc = SPI_tuptable->tupdesc;
+		WalNodeEntry *nodeentry;
+		RelFileNode node;
+		bool		isnull;
+
+		node.relNode = DatumGetObjectId(SPI_getbinval(tup, tupdesc, 1, &isnull));
+		node.spcNode = DatumGetObjectId(SPI_getbinval(tup, tupdesc, 2, &isnull));
+		if (node.spcNode == InvalidOid)
+			node.spcNode = MyDatabaseTableSpace;
+		node.dbNode = MyDatabaseId;
+
+		nodeentry = (WalNodeEntry *) hash_search(wal_node_map, &node, HASH_ENTER, NULL);
+		nodeentry->node = node;
+		nodeentry->namespaceoid = DatumGetObjectId(SPI_getbinval(tup, tupdesc, 3, &isnull));
+		nodeentry->owneroid = DatumGetObjectId(SPI_getbinval(tup, tupdesc, 4, &isnull));
+	}
+}
+
+/*
+ * Add the WAL generated by a table to the usage of its schema or role.
+ */
+static void
+add_wal_bytes(Oid targetoid, QuotaType type, int64 bytes)
+{
+	BlackMapEntry keyitem;
+	WalRateEntry *rateentry;
+	bool		found;
+
+	memset(&keyitem, 0, sizeof(BlackMapEntry));
+	keyitem.targetoid = targetoid;
+	keyitem.databaseoid = MyDatabaseId;
+	keyitem.targettype = (uint32) type;
+
+	rateentry = (WalRateEntry *) hash_search(wal_rate_map, &keyitem, HASH_ENTER, &found);
+	if (!found)
+	{
+		rateentry->walbytes = 0;
+		rateentry->cyclebytes = 0;
+		rateentry->walrate = 0;
+	}
+	rateentry->cyclebytes += bytes;
+}
+
+/*
+ * Forget the WAL usage of all the schemas and roles when WAL accounting is
+ * turned off, and check them again to release them from blacklist.
+ */
+static void
+reset_wal_rates(void)
+{
+	HASH_SEQ_STATUS iter;
+	WalRateEntry *rateentry;
+
+	hash_seq_init(&iter, wal_rate_map);
+	while ((rateentry = hash_seq_search(&iter)) != NULL)
+	{
+		mark_target_dirty(rateentry->keyitem.targetoid, rateentry->keyitem.targettype);
+		hash_search(wal_rate_map, &rateentry->keyitem, HASH_REMOVE, NULL);
+	}
+}
+
+/*
+ * Get the local WAL usage of a schema or role, NULL if it has not
+ * generated WAL since WAL accounting is on.
+ */
+static WalRateEntry *
+get_wal_rate(Oid targetoid, QuotaType type)
+{
+	BlackMapEntry keyitem;
+
+	memset(&keyitem, 0, sizeof(BlackMapEntry));
+	keyitem.targetoid = targetoid;
+	keyitem.databaseoid = MyDatabaseId;
+	keyitem.targettype = (uint32) type;
+
+	return (WalRateEntry *) hash_search(wal_rate_map, &keyitem, HASH_FIND, NULL);
+}
+
+/*
+ * Check a WAL rate in bytes per second against diskquota.max_wal_rate.
+ */
+static bool
+is_wal_rate_exceeded(double walrate)
+{
+	return diskquota_wal_accounting && diskquota_max_wal_rate > 0 &&
+		walrate > diskquota_max_wal_rate * 1024.0;
+}
+
+/*
+ * Remove all the entries in a quota limit map.
+ */
+static void
+clear_quota_limit_map(HTAB *quota_limit_map)
+{
+	HASH_SEQ_STATUS iter;
+	QuotaLimitEntry* quota_entry;
+
+	hash_seq_init(&iter, quota_limit_map);
+	while ((quota_entry = hash_seq_search(&iter)) != NULL)
+	{
+		(void) hash_search(quota_limit_map,
+				(void *) &quota_entry->targetoid,
+				HASH_REMOVE, NULL);
 	}
 }
 
 /*
  * Load quotas from diskquota configuration table(quota_config).
+ * Quota setting is only reloaded when it is changed, i.e. config_version
+ * is bumped by the backend which modifies quota_config or quota_rule.
+ * config_version must be read before the snapshot is taken, otherwise
+ * a change committed in between could be missed.
 */
 static bool
-load_quotas(void)
+load_quotas(bool force, uint32 config_version)
 {
 	int			ret;
 	TupleDesc	tupdesc;
 	int			i;
 	bool		found;
 	QuotaLimitEntry* quota_entry;
-	HASH_SEQ_STATUS iter;
 
 	RangeVar   *rv;
 	Relation	rel;
+	bool		rules_installed;
 
 	rv = makeRangeVar("diskquota", "quota_config", -1);
 	rel = heap_openrv_extended(rv, AccessShareLock, true);
@@ -758,34 +2547,127 @@ load_quotas(void)
 	}
 	heap_close(rel, NoLock);
 
+	/*
+	 * Quota rules and the trigger bumping config_version are added by
+	 * version 1.1 of the extension.  Until ALTER EXTENSION diskquota UPDATE
+	 * is run, quota setting is reloaded in every refresh without rules.
+	 */
+	rv = makeRangeVar("diskquota", "quota_rule", -1);
+	rel = heap_openrv_extended(rv, AccessShareLock, true);
+	rules_installed = (rel != NULL);
+	if (rel)
+		heap_close(rel, NoLock);
+
+	/* quota setting is not changed since last load */
+	if (!force && rules_installed && quota_config_loaded &&
+		config_version == loaded_config_version)
+		return true;
+
 	/* clear entries in quota limit map*/
-	hash_seq_init(&iter, namespace_quota_limit_map);
-	while ((quota_entry = hash_seq_search(&iter)) != NULL)
+	clear_quota_limit_map(namespace_quota_limit_map);
+	clear_quota_limit_map(role_quota_limit_map);
+	database_quota_limit = -1;
+
+	ret = SPI_execute("select targetoid, quotatype, quotalimitMB from diskquota.quota_config", true, 0);
+	if (ret != SPI_OK_SELECT)
+		elog(FATAL, "SPI_execute failed: error code %d", ret);
+
+	tupdesc = SPI_tuptable->tupdesc;
+	if (tupdesc->natts != 3 ||
+		TupleDescAttr(tupdesc, 0)->atttypid != OIDOID ||
+		TupleDescAttr(tupdesc, 1)->atttypid != INT4OID ||
+		TupleDescAttr(tupdesc, 2)->atttypid != INT8OID)
 	{
-		(void) hash_search(namespace_quota_limit_map,
-				(void *) &quota_entry->targetoid,
-				HASH_REMOVE, NULL);
+		elog(LOG, "configuration table \"quota_config\" is corruptted in database \"%s\"," 
+				" please recreate diskquota extension",
+			 get_database_name(MyDatabaseId));
+		return false;
 	}
 
-	hash_seq_init(&iter, role_quota_limit_map);
-	while ((quota_entry = hash_seq_search(&iter)) != NULL)
+	for (i = 0; i < SPI_processed; i++)
 	{
-		(void) hash_search(role_quota_limit_map,
-				(void *) &quota_entry->targetoid,
-				HASH_REMOVE, NULL);
+		HeapTuple	tup = SPI_tuptable->vals[i];
+		Datum		dat;
+		Oid			targetOid;
+		int64		quota_limit_mb;
+		QuotaType	quotatype;
+		bool		isnull;
+
+		dat = SPI_getbinval(tup, tupdesc, 1, &isnull);
+		if (isnull)
+			continue;
+		targetOid = DatumGetObjectId(dat);
+		
+		dat = SPI_getbinval(tup, tupdesc, 2, &isnull);
+		if (isnull)
+			continue;
+		quotatype = (QuotaType)DatumGetInt32(dat);
+
+		dat = SPI_getbinval(tup, tupdesc, 3, &isnull);
+		if (isnull)
+			continue;
+		quota_limit_mb = DatumGetInt64(dat);
+
+		if (quotatype == NAMESPACE_QUOTA)
+		{
+			quota_entry = (QuotaLimitEntry *)hash_search(namespace_quota_limit_map,
+												&targetOid,
+												HASH_ENTER, &found);
+			quota_entry->limitsize = quota_limit_mb;
+		}
+		else if (quotatype == ROLE_QUOTA)
+		{
+			quota_entry = (QuotaLimitEntry *)hash_search(role_quota_limit_map,
+												&targetOid,
+												HASH_ENTER, &found);
+			quota_entry->limitsize = quota_limit_mb;
+		}
+		else if (quotatype == DATABASE_QUOTA && targetOid == MyDatabaseId)
+		{
+			database_quota_limit = quota_limit_mb;
+		}
 	}
 
-	ret = SPI_execute("select targetoid, quotatype, quotalimitMB from diskquota.quota_config", true, 0);
+	if (rules_installed && !load_quota_rules())
+		return false;
+
+	/* quota limits may be changed, check all the schemas and roles */
+	full_evaluation_pending = true;
+	quota_config_loaded = true;
+	loaded_config_version = config_version;
+	return true;
+}
+
+/*
+ * Load quota rules from diskquota rule table(quota_rule).
+ * Rules are matched lazily against schema and role names,
+ * see get_rule_quota_limit().
+ */
+static bool
+load_quota_rules(void)
+{
+	int			ret;
+	TupleDesc	tupdesc;
+	int			i;
+	MemoryContext old_ctx;
+
+	/* forget rules and resolved rule limits of last load */
+	MemoryContextReset(quota_rule_context);
+	quota_rules = NIL;
+	clear_quota_limit_map(namespace_rule_limit_map);
+	clear_quota_limit_map(role_rule_limit_map);
+
+	ret = SPI_execute("select quotatype, pattern, quotalimitMB from diskquota.quota_rule", true, 0);
 	if (ret != SPI_OK_SELECT)
 		elog(FATAL, "SPI_execute failed: error code %d", ret);
 
 	tupdesc = SPI_tuptable->tupdesc;
 	if (tupdesc->natts != 3 ||
-		TupleDescAttr(tupdesc, 0)->atttypid != OIDOID ||
-		TupleDescAttr(tupdesc, 1)->atttypid != INT4OID ||
+		TupleDescAttr(tupdesc, 0)->atttypid != INT4OID ||
+		TupleDescAttr(tupdesc, 1)->atttypid != TEXTOID ||
 		TupleDescAttr(tupdesc, 2)->atttypid != INT8OID)
 	{
-		elog(LOG, "configuration table \"quota_config\" is corruptted in database \"%s\"," 
+		elog(LOG, "rule table \"quota_rule\" is corruptted in database \"%s\","
 				" please recreate diskquota extension",
 			 get_database_name(MyDatabaseId));
 		return false;
@@ -795,42 +2677,122 @@ load_quotas(void)
 	{
 		HeapTuple	tup = SPI_tuptable->vals[i];
 		Datum		dat;
-		Oid			targetOid;
-		int64		quota_limit_mb;
-		QuotaType	quotatype;
 		bool		isnull;
+		QuotaRule  *rule;
+		QuotaType	quotatype;
+		char	   *pattern;
+		int64		quota_limit_mb;
 
 		dat = SPI_getbinval(tup, tupdesc, 1, &isnull);
 		if (isnull)
 			continue;
-		targetOid = DatumGetObjectId(dat);
-		
+		quotatype = (QuotaType) DatumGetInt32(dat);
+
 		dat = SPI_getbinval(tup, tupdesc, 2, &isnull);
 		if (isnull)
 			continue;
-		quotatype = (QuotaType)DatumGetInt32(dat);
+		pattern = TextDatumGetCString(dat);
 
 		dat = SPI_getbinval(tup, tupdesc, 3, &isnull);
 		if (isnull)
 			continue;
 		quota_limit_mb = DatumGetInt64(dat);
 
-		if (quotatype == NAMESPACE_QUOTA)
-		{
-			quota_entry = (QuotaLimitEntry *)hash_search(namespace_quota_limit_map,
-												&targetOid,
+		old_ctx = MemoryContextSwitchTo(quota_rule_context);
+		rule = (QuotaRule *) palloc(sizeof(QuotaRule));
+		rule->type = quotatype;
+		rule->pattern = pstrdup(pattern);
+		rule->limitsize = quota_limit_mb;
+		quota_rules = lappend(quota_rules, rule);
+		MemoryContextSwitchTo(old_ctx);
+	}
+	return true;
+}
+
+/*
+ * Syscache callback of pg_namespace and pg_authid.  A renamed schema or
+ * role may match another rule, so the resolved rule limits are forgotten
+ * on next get_rule_quota_limit(), and all the targets are checked again.
+ * The maps are not touched here, since invalidation may be processed in
+ * the middle of get_rule_quota_limit().
+ */
+static void
+rule_limit_invalidate(pg_attribute_unused() Datum arg, int cacheid,
+					  pg_attribute_unused() uint32 hashvalue)
+{
+	if (quota_rules == NIL)
+		return;
+	if (cacheid == NAMESPACEOID)
+		namespace_rule_limit_stale = true;
+	else
+		role_rule_limit_stale = true;
+	full_evaluation_pending = true;
+}
+
+/*
+ * Get the quota limit of a schema or role from quota rules.
+ * The longest pattern which matches the name wins. The result is
+ * cached until quota setting is reloaded or a schema or role is
+ * changed, so the name of each target is only looked up once.
+ * Names are matched byte-wise in C collation. Return -1 if no rule
+ * matches.
+ */
+static int64
+get_rule_quota_limit(Oid targetoid, QuotaType type)
+{
+	bool		found;
+	HTAB	   *rule_limit_map;
+	QuotaLimitEntry *rule_entry;
+	ListCell   *cell;
+	char	   *name;
+	int			matched_len = -1;
+
+	if (quota_rules == NIL)
+		return -1;
+
+	if (type == NAMESPACE_QUOTA && namespace_rule_limit_stale)
+	{
+		clear_quota_limit_map(namespace_rule_limit_map);
+		namespace_rule_limit_stale = false;
+	}
+	else if (type == ROLE_QUOTA && role_rule_limit_stale)
+	{
+		clear_quota_limit_map(role_rule_limit_map);
+		role_rule_limit_stale = false;
+	}
+
+	rule_limit_map = type == NAMESPACE_QUOTA ? namespace_rule_limit_map : role_rule_limit_map;
+	rule_entry = (QuotaLimitEntry *) hash_search(rule_limit_map,
+												&targetoid,
 												HASH_ENTER, &found);
-			quota_entry->limitsize = quota_limit_mb;
-		}
-		else if (quotatype == ROLE_QUOTA)
+	if (found)
+		return rule_entry->limitsize;
+
+	rule_entry->limitsize = -1;
+	if (type == NAMESPACE_QUOTA)
+		name = get_namespace_name(targetoid);
+	else
+		name = GetUserNameFromId(targetoid, true);
+	if (name == NULL)
+		return -1;
+
+	foreach(cell, quota_rules)
+	{
+		QuotaRule  *rule = (QuotaRule *) lfirst(cell);
+		int			len = strlen(rule->pattern);
+
+		if (rule->type != type || len <= matched_len)
+			continue;
+		if (DatumGetBool(DirectFunctionCall2Coll(textlike,
+												 C_COLLATION_OID,
+												 CStringGetTextDatum(name),
+												 CStringGetTextDatum(rule->pattern))))
 		{
-			quota_entry = (QuotaLimitEntry *)hash_search(role_quota_limit_map,
-												&targetOid,
-												HASH_ENTER, &found);
-			quota_entry->limitsize = quota_limit_mb;
+			rule_entry->limitsize = rule->limitsize;
+			matched_len = len;
 		}
 	}
-	return true;
+	return rule_entry->limitsize;
 }
 
 /*
@@ -862,66 +2824,653 @@ quota_check_common(Oid reloid)
 {
 	Oid ownerOid = InvalidOid;
 	Oid nsOid = InvalidOid;
-	bool found;
-	BlackMapEntry keyitem;
-	memset(&keyitem, 0, sizeof(BlackMapEntry));
+
 	get_rel_owner_schema(reloid, &ownerOid, &nsOid);
-	LWLockAcquire(diskquota_locks.black_map_lock, LW_SHARED);
+	return quota_check_targets(nsOid, ownerOid);
+}
+
+/*
+ * Check whether quota limit of a schema or a role is reached, for objects
+ * which do not exist yet.  Either of them could be InvalidOid.
+ * Do enforcemet if quota exceeds.
+ */
+bool
+quota_check_targets(Oid nsOid, Oid ownerOid)
+{
+	bool ns_exceeded = false;
+	bool role_exceeded = false;
+	bool db_exceeded = false;
+
+	search_black_list(nsOid, ownerOid, &ns_exceeded, &role_exceeded, &db_exceeded);
 
-	if ( nsOid != InvalidOid)
+	if (ns_exceeded && is_wal_rate_blacklisted(nsOid, NAMESPACE_QUOTA))
 	{
-		keyitem.targetoid = nsOid;
-		keyitem.databaseoid = MyDatabaseId;
-		keyitem.targettype = NAMESPACE_QUOTA;
-		hash_search(disk_quota_black_map,
-				&keyitem,
-				HASH_FIND, &found);
-		if (found)
-		{
-			ereport(ERROR,
-					(errcode(ERRCODE_DISK_FULL),
-					 errmsg("schema's disk space quota exceeded with name:%s", get_namespace_name(nsOid))));
-			return false;
-		}
+		ereport(ERROR,
+				(errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+				 errmsg("schema's WAL generation rate limit exceeded with name:%s", get_namespace_name(nsOid))));
+		return false;
+	}
+	if (ns_exceeded)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DISK_FULL),
+				 errmsg("schema's disk space quota exceeded with name:%s", get_namespace_name(nsOid))));
+		return false;
+	}
+	if (role_exceeded && is_wal_rate_blacklisted(ownerOid, ROLE_QUOTA))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+				 errmsg("role's WAL generation rate limit exceeded with name:%s", GetUserNameFromId(ownerOid, false))));
+		return false;
+	}
+	if (role_exceeded)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DISK_FULL),
+				 errmsg("role's disk space quota exceeded with name:%s", GetUserNameFromId(ownerOid, false))));
+		return false;
+	}
+	if (db_exceeded)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DISK_FULL),
+				 errmsg("database's disk space quota exceeded with name:%s", get_database_name(MyDatabaseId))));
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Look up a schema and a role in the blacklist of current database, either
+ * of them could be InvalidOid, and check whether the database itself is in
+ * it.  The generation of the blacklist is reported to the C API, which
+ * calls the callbacks on blacklist changes.
+ */
+static void
+search_black_list(Oid nsOid, Oid ownerOid, bool *ns_exceeded, bool *role_exceeded,
+				  bool *db_exceeded)
+{
+	BlackListSlot *slot;
+	uint32		generation = 0;
 
+	*ns_exceeded = false;
+	*role_exceeded = false;
+	*db_exceeded = false;
+	LWLockAcquire(diskquota_locks.black_map_lock, LW_SHARED);
+	slot = get_black_list_slot(MyDatabaseId);
+	if (slot != NULL)
+	{
+		if (nsOid != InvalidOid)
+			*ns_exceeded = bsearch(&nsOid, slot->targets, slot->num_namespaces,
+								   sizeof(Oid), oid_compare) != NULL;
+		if (ownerOid != InvalidOid)
+			*role_exceeded = bsearch(&ownerOid, slot->targets + slot->num_namespaces,
+									 slot->num_roles, sizeof(Oid), oid_compare) != NULL;
+		*db_exceeded = slot->database_exceeded;
+		generation = slot->generation;
 	}
+	LWLockRelease(diskquota_locks.black_map_lock);
+
+	if (*db_exceeded && is_database_quota_exempt(nsOid))
+		*db_exceeded = false;
+
+	blacklist_generation_seen(generation);
+}
 
-	if ( ownerOid != InvalidOid)
+/*
+ * The quota of a database is not enforced on system catalogs and toast
+ * tables, which are written by every DDL and by vacuum, nor on the quota
+ * setting of diskquota, so that the quota could still be raised or dropped
+ * after it is exceeded.  Toast tables of user tables are checked with their
+ * table before query.  The oid of diskquota schema is cached until
+ * pg_namespace is invalidated.
+ */
+static bool
+is_database_quota_exempt(Oid nsOid)
+{
+	if (nsOid == InvalidOid)
+		return false;
+	if (IsSystemNamespace(nsOid) || IsToastNamespace(nsOid))
+		return true;
+
+	if (!OidIsValid(diskquota_namespace_oid))
 	{
-		keyitem.targetoid = ownerOid;
-		keyitem.databaseoid = MyDatabaseId;
-		keyitem.targettype = ROLE_QUOTA;
-		hash_search(disk_quota_black_map,
-				&keyitem,
-				HASH_FIND, &found);
-		if (found)
+		if (!diskquota_namespace_callback_registered)
 		{
-			ereport(ERROR,
-					(errcode(ERRCODE_DISK_FULL),
-					 errmsg("role's disk space quota exceeded with name:%s", GetUserNameFromId(ownerOid, false))));
-			return false;
+			CacheRegisterSyscacheCallback(NAMESPACEOID, diskquota_namespace_invalidate, (Datum) 0);
+			diskquota_namespace_callback_registered = true;
 		}
+		diskquota_namespace_oid = get_namespace_oid("diskquota", true);
 	}
-	LWLockRelease(diskquota_locks.black_map_lock);
-	return true;
+	return nsOid == diskquota_namespace_oid;
+}
+
+/*
+ * Syscache callback of pg_namespace, the diskquota schema is looked up
+ * again after any schema is changed, e.g. the extension is recreated.
+ */
+static void
+diskquota_namespace_invalidate(pg_attribute_unused() Datum arg,
+							   pg_attribute_unused() int cacheid,
+							   pg_attribute_unused() uint32 hashvalue)
+{
+	diskquota_namespace_oid = InvalidOid;
+}
+
+/*
+ * Check whether a schema or a role of current database, or the database
+ * itself, is in blacklist, without reporting an error.  Either of them
+ * could be InvalidOid.
+ */
+bool
+is_target_blacklisted(Oid nsOid, Oid ownerOid)
+{
+	bool		ns_exceeded;
+	bool		role_exceeded;
+	bool		db_exceeded;
+
+	search_black_list(nsOid, ownerOid, &ns_exceeded, &role_exceeded, &db_exceeded);
+	return ns_exceeded || role_exceeded || db_exceeded;
+}
+
+/*
+ * Check whether a blacklisted schema or role is put into blacklist for its
+ * WAL rate rather than its disk usage, to report the right reason.
+ */
+static bool
+is_wal_rate_blacklisted(Oid targetoid, QuotaType type)
+{
+	BlackMapEntry keyitem;
+	TargetUsageEntry *entry;
+	bool		result = false;
+
+	memset(&keyitem, 0, sizeof(BlackMapEntry));
+	keyitem.targetoid = targetoid;
+	keyitem.databaseoid = MyDatabaseId;
+	keyitem.targettype = (uint32) type;
+
+	LWLockAcquire(diskquota_locks.usage_map_lock, LW_SHARED);
+	entry = (TargetUsageEntry *) hash_search(disk_quota_usage_map,
+							   &keyitem,
+							   HASH_FIND, NULL);
+	if (entry != NULL && is_wal_rate_exceeded(entry->walrate) &&
+		(entry->limitsize <= 0 ||
+		 (entry->usage + entry->remoteusage) / (1024 * 1024) < entry->limitsize))
+		result = true;
+	LWLockRelease(diskquota_locks.usage_map_lock);
+	return result;
 }
 
 /*
  * invalidate all black entry with a specific dbid in SHM
+ * usage entries and the worker slot of the database are released as well.
  */
 void
 diskquota_invalidate_db(Oid dbid)
 {
-	BlackMapEntry * entry;
+	BlackListSlot *blackslot;
+	ReclaimSlot *reclaimslot;
+	TargetUsageEntry *usageentry;
+	DiskQuotaWorkerSlot *slot;
 	HASH_SEQ_STATUS iter;
 	LWLockAcquire(diskquota_locks.black_map_lock, LW_EXCLUSIVE);
-	hash_seq_init(&iter, disk_quota_black_map);
-	while ((entry = hash_seq_search(&iter)) != NULL)
+	blackslot = get_black_list_slot(dbid);
+	if (blackslot != NULL)
 	{
-		if (entry->databaseoid == dbid)
+		blackslot->dbid = InvalidOid;
+		blackslot->num_namespaces = 0;
+		blackslot->num_roles = 0;
+		blackslot->database_exceeded = false;
+		blackslot->generation++;
+	}
+	LWLockRelease(diskquota_locks.black_map_lock);
+
+	LWLockAcquire(diskquota_locks.usage_map_lock, LW_EXCLUSIVE);
+	reclaimslot = get_reclaim_slot(dbid);
+	if (reclaimslot != NULL)
+	{
+		reclaimslot->dbid = InvalidOid;
+		reclaimslot->num_entries = 0;
+	}
+	hash_seq_init(&iter, disk_quota_usage_map);
+	while ((usageentry = hash_seq_search(&iter)) != NULL)
+	{
+		if (usageentry->keyitem.databaseoid == dbid)
 		{
-			hash_search(disk_quota_black_map, entry, HASH_REMOVE, NULL);
+			hash_search(disk_quota_usage_map, &usageentry->keyitem, HASH_REMOVE, NULL);
 		}
 	}
-	LWLockRelease(diskquota_locks.black_map_lock);
+	LWLockRelease(diskquota_locks.usage_map_lock);
+
+	LWLockAcquire(diskquota_locks.worker_slot_lock, LW_EXCLUSIVE);
+	slot = get_worker_slot(dbid);
+	if (slot != NULL)
+		memset(slot, 0, sizeof(DiskQuotaWorkerSlot));
+	LWLockRelease(diskquota_locks.worker_slot_lock);
+
+	/* stop counting the usage of the database in other instances */
+	federation_remove(dbid);
+	remove_relation_activity(dbid);
+}
+
+/*
+ * Get the headroom in bytes of a schema or role in current database, or of
+ * current database itself, as of the last refresh.  Returns false if it has no quota limit.
+ */
+bool
+get_target_headroom(Oid targetoid, QuotaType type, int64 *headroom)
+{
+	BlackMapEntry keyitem;
+	TargetUsageEntry *entry;
+	bool		limited = false;
+
+	memset(&keyitem, 0, sizeof(BlackMapEntry));
+	keyitem.targetoid = targetoid;
+	keyitem.databaseoid = MyDatabaseId;
+	keyitem.targettype = (uint32) type;
+
+	LWLockAcquire(diskquota_locks.usage_map_lock, LW_SHARED);
+	entry = (TargetUsageEntry *) hash_search(disk_quota_usage_map,
+							   &keyitem,
+							   HASH_FIND, NULL);
+	if (entry != NULL && entry->limitsize > 0)
+	{
+		*headroom = entry->limitsize * 1024 * 1024 - entry->usage - entry->remoteusage;
+		limited = true;
+	}
+	LWLockRelease(diskquota_locks.usage_map_lock);
+	return limited;
+}
+
+/*
+ * Get the usage in bytes and the quota limit in MB of a schema or role in
+ * current database, as of the last refresh.  Usage of the same schema or
+ * role in federated instances is included.  Returns false if it has not
+ * been measured.
+ */
+bool
+get_target_usage(Oid targetoid, QuotaType type, int64 *usage, int64 *limitsize)
+{
+	BlackMapEntry keyitem;
+	TargetUsageEntry *entry;
+	bool		found = false;
+
+	memset(&keyitem, 0, sizeof(BlackMapEntry));
+	keyitem.targetoid = targetoid;
+	keyitem.databaseoid = MyDatabaseId;
+	keyitem.targettype = (uint32) type;
+
+	LWLockAcquire(diskquota_locks.usage_map_lock, LW_SHARED);
+	entry = (TargetUsageEntry *) hash_search(disk_quota_usage_map,
+							   &keyitem,
+							   HASH_FIND, NULL);
+	if (entry != NULL)
+	{
+		*usage = entry->usage + entry->remoteusage;
+		*limitsize = entry->limitsize > 0 ? entry->limitsize : -1;
+		found = true;
+	}
+	LWLockRelease(diskquota_locks.usage_map_lock);
+	return found;
+}
+
+/*
+ * Return the quota limit, last measured usage, headroom and staleness
+ * of a schema or role in current database, or of current database itself.
+ * Only shared memory is read, so it is cheap enough to be called before
+ * every batch of data loading.
+ */
+Datum
+headroom(PG_FUNCTION_ARGS)
+{
+	Oid			targetoid = PG_GETARG_OID(0);
+	int32		quotatype = PG_GETARG_INT32(1);
+	TupleDesc	tupdesc;
+	Datum		values[4];
+	bool		nulls[4];
+	BlackMapEntry keyitem;
+	TargetUsageEntry *entry;
+	DiskQuotaWorkerSlot *slot;
+	TimestampTz last_refresh_time = 0;
+
+	if (quotatype != NAMESPACE_QUOTA && quotatype != ROLE_QUOTA &&
+		quotatype != DATABASE_QUOTA)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid quota type: %d", quotatype)));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+	tupdesc = BlessTupleDesc(tupdesc);
+
+	memset(values, 0, sizeof(values));
+	memset(nulls, true, sizeof(nulls));
+	memset(&keyitem, 0, sizeof(BlackMapEntry));
+	keyitem.targetoid = targetoid;
+	keyitem.databaseoid = MyDatabaseId;
+	keyitem.targettype = (uint32) quotatype;
+
+	LWLockAcquire(diskquota_locks.usage_map_lock, LW_SHARED);
+	entry = (TargetUsageEntry *) hash_search(disk_quota_usage_map,
+							   &keyitem,
+							   HASH_FIND, NULL);
+	if (entry != NULL)
+	{
+		/* usage of the same schema or role in federated instances counts */
+		values[1] = Int64GetDatum(entry->usage + entry->remoteusage);
+		nulls[1] = false;
+		if (entry->limitsize > 0)
+		{
+			values[0] = Int64GetDatum(entry->limitsize);
+			nulls[0] = false;
+			values[2] = Int64GetDatum(entry->limitsize * 1024 * 1024 - entry->usage - entry->remoteusage);
+			nulls[2] = false;
+		}
+	}
+	LWLockRelease(diskquota_locks.usage_map_lock);
+
+	LWLockAcquire(diskquota_locks.worker_slot_lock, LW_SHARED);
+	slot = get_worker_slot(MyDatabaseId);
+	if (slot != NULL)
+		last_refresh_time = slot->last_refresh_time;
+	LWLockRelease(diskquota_locks.worker_slot_lock);
+
+	if (last_refresh_time != 0)
+	{
+		values[3] = DirectFunctionCall2(timestamp_mi,
+										TimestampTzGetDatum(GetCurrentTimestamp()),
+										TimestampTzGetDatum(last_refresh_time));
+		nulls[3] = false;
+	}
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
+
+/*
+ * Return the state of all the diskquota worker processes, including the
+ * duration of the initial and the last refresh of the disk quota model.
+ */
+Datum
+worker_status(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	DiskQuotaWorkerSlot *slots;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		TupleDesc	tupdesc;
+		MemoryContext oldcontext;
+		int			i;
+		int			num_slots = 0;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			elog(ERROR, "return type must be a row type");
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+		/* copy the slots, so that the lock is not held between calls */
+		slots = palloc(sizeof(DiskQuotaWorkerSlot) * MAX_NUM_MONITORED_DB);
+		LWLockAcquire(diskquota_locks.worker_slot_lock, LW_SHARED);
+		for (i = 0; i < MAX_NUM_MONITORED_DB; i++)
+		{
+			if (worker_slots[i].dbid != InvalidOid)
+				slots[num_slots++] = worker_slots[i];
+		}
+		LWLockRelease(diskquota_locks.worker_slot_lock);
+
+		funcctx->user_fctx = slots;
+		funcctx->max_calls = num_slots;
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	slots = (DiskQuotaWorkerSlot *) funcctx->user_fctx;
+
+	if (funcctx->call_cntr < funcctx->max_calls)
+	{
+		DiskQuotaWorkerSlot *slot = &slots[funcctx->call_cntr];
+		Datum		values[7];
+		bool		nulls[7];
+		HeapTuple	tuple;
+
+		memset(nulls, false, sizeof(nulls));
+		values[0] = ObjectIdGetDatum(slot->dbid);
+		values[1] = Int32GetDatum(slot->pid);
+		values[2] = Int64GetDatum((int64) slot->refresh_finished);
+		values[3] = TimestampTzGetDatum(slot->last_refresh_time);
+		nulls[3] = (slot->last_refresh_time == 0);
+		values[4] = Float8GetDatum(slot->init_refresh_duration / 1000.0);
+		nulls[4] = (slot->refresh_finished == 0);
+		values[5] = Float8GetDatum(slot->last_refresh_duration / 1000.0);
+		nulls[5] = (slot->refresh_finished == 0);
+		values[6] = Int64GetDatum(slot->num_tables);
+
+		tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
+
+/*
+ * Return the disk usage and quota limit of all the monitored databases, as
+ * of the last refresh of their workers.  It could be called in any of them
+ * in place of pg_database_size(), without touching any file.
+ */
+Datum
+database_usage(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	DiskQuotaWorkerSlot *slots;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		TupleDesc	tupdesc;
+		MemoryContext oldcontext;
+		int			i;
+		int			num_slots = 0;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			elog(ERROR, "return type must be a row type");
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+		/* copy the slots, so that the lock is not held between calls */
+		slots = palloc(sizeof(DiskQuotaWorkerSlot) * MAX_NUM_MONITORED_DB);
+		LWLockAcquire(diskquota_locks.worker_slot_lock, LW_SHARED);
+		for (i = 0; i < MAX_NUM_MONITORED_DB; i++)
+		{
+			if (worker_slots[i].dbid != InvalidOid)
+				slots[num_slots++] = worker_slots[i];
+		}
+		LWLockRelease(diskquota_locks.worker_slot_lock);
+
+		funcctx->user_fctx = slots;
+		funcctx->max_calls = num_slots;
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	slots = (DiskQuotaWorkerSlot *) funcctx->user_fctx;
+
+	if (funcctx->call_cntr < funcctx->max_calls)
+	{
+		DiskQuotaWorkerSlot *slot = &slots[funcctx->call_cntr];
+		Datum		values[4];
+		bool		nulls[4];
+		HeapTuple	tuple;
+
+		memset(nulls, false, sizeof(nulls));
+		values[0] = ObjectIdGetDatum(slot->dbid);
+		values[1] = Int64GetDatum(slot->database_size);
+		nulls[1] = (slot->refresh_finished == 0);
+		values[2] = Int64GetDatum(slot->database_quota);
+		nulls[2] = (slot->database_quota <= 0);
+		values[3] = TimestampTzGetDatum(slot->last_refresh_time);
+		nulls[3] = (slot->last_refresh_time == 0);
+
+		tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
+
+/*
+ * Return the WAL usage of the schemas and roles in current database, as of
+ * the last refresh.  Only the ones which have generated WAL since WAL
+ * accounting is on are returned.
+ */
+Datum
+wal_usage(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	TargetUsageEntry *entries;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		TupleDesc	tupdesc;
+		MemoryContext oldcontext;
+		HASH_SEQ_STATUS iter;
+		TargetUsageEntry *entry;
+		int			num_entries = 0;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			elog(ERROR, "return type must be a row type");
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+		/* copy the entries, so that the lock is not held between calls */
+		LWLockAcquire(diskquota_locks.usage_map_lock, LW_SHARED);
+		entries = palloc(sizeof(TargetUsageEntry) *
+						 Max(hash_get_num_entries(disk_quota_usage_map), 1));
+		hash_seq_init(&iter, disk_quota_usage_map);
+		while ((entry = hash_seq_search(&iter)) != NULL)
+		{
+			if (entry->keyitem.databaseoid == MyDatabaseId && entry->walbytes > 0)
+				entries[num_entries++] = *entry;
+		}
+		LWLockRelease(diskquota_locks.usage_map_lock);
+
+		funcctx->user_fctx = entries;
+		funcctx->max_calls = num_entries;
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	entries = (TargetUsageEntry *) funcctx->user_fctx;
+
+	if (funcctx->call_cntr < funcctx->max_calls)
+	{
+		TargetUsageEntry *entry = &entries[funcctx->call_cntr];
+		Datum		values[4];
+		bool		nulls[4];
+		HeapTuple	tuple;
+
+		memset(nulls, false, sizeof(nulls));
+		values[0] = ObjectIdGetDatum(entry->keyitem.targetoid);
+		values[1] = Int32GetDatum((int32) entry->keyitem.targettype);
+		values[2] = Int64GetDatum(entry->walbytes);
+		values[3] = Float8GetDatum(entry->walrate);
+
+		tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
+
+/*
+ * Return the tables with most reclaimable space in the schemas and roles of
+ * current database which are near or over their quota limit, as of the last
+ * refresh, together with the usage, quota limit and reclaimable space of the
+ * schema or role.
+ */
+Datum
+reclaimable_tables(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	ReclaimEntry *entries;
+	TargetUsageEntry *targets;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		TupleDesc	tupdesc;
+		MemoryContext oldcontext;
+		ReclaimSlot *slot;
+		int			num_entries = 0;
+		int			i;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			elog(ERROR, "return type must be a row type");
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+		/* copy the entries and their targets, so that the lock is not held between calls */
+		entries = palloc(sizeof(ReclaimEntry) * MAX_RECLAIM_ENTRIES_PER_DB);
+		targets = palloc(sizeof(TargetUsageEntry) * MAX_RECLAIM_ENTRIES_PER_DB);
+		LWLockAcquire(diskquota_locks.usage_map_lock, LW_SHARED);
+		slot = get_reclaim_slot(MyDatabaseId);
+		for (i = 0; slot != NULL && i < slot->num_entries; i++)
+		{
+			BlackMapEntry keyitem;
+			TargetUsageEntry *target;
+
+			memset(&keyitem, 0, sizeof(BlackMapEntry));
+			keyitem.targetoid = slot->entries[i].targetoid;
+			keyitem.databaseoid = MyDatabaseId;
+			keyitem.targettype = slot->entries[i].targettype;
+			target = (TargetUsageEntry *) hash_search(disk_quota_usage_map,
+													  &keyitem,
+													  HASH_FIND, NULL);
+			if (target == NULL)
+				continue;
+			entries[num_entries] = slot->entries[i];
+			targets[num_entries] = *target;
+			num_entries++;
+		}
+		LWLockRelease(diskquota_locks.usage_map_lock);
+
+		funcctx->user_fctx = list_make2(entries, targets);
+		funcctx->max_calls = num_entries;
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	entries = (ReclaimEntry *) linitial((List *) funcctx->user_fctx);
+	targets = (TargetUsageEntry *) lsecond((List *) funcctx->user_fctx);
+
+	if (funcctx->call_cntr < funcctx->max_calls)
+	{
+		ReclaimEntry *entry = &entries[funcctx->call_cntr];
+		TargetUsageEntry *target = &targets[funcctx->call_cntr];
+		Datum		values[8];
+		bool		nulls[8];
+		HeapTuple	tuple;
+
+		memset(nulls, false, sizeof(nulls));
+		values[0] = ObjectIdGetDatum(entry->targetoid);
+		values[1] = Int32GetDatum((int32) entry->targettype);
+		values[2] = Int64GetDatum(target->limitsize);
+		values[3] = Int64GetDatum(target->usage);
+		values[4] = Int64GetDatum(target->reclaimable);
+		nulls[4] = (target->reclaimable < 0);
+		values[5] = ObjectIdGetDatum(entry->reloid);
+		values[6] = Int64GetDatum(entry->tablesize);
+		values[7] = Int64GetDatum(entry->reclaimable);
+
+		tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+	}
+
+	SRF_RETURN_DONE(funcctx);
 }
@@ -0,0 +1,264 @@
+/* -------------------------------------------------------------------------
+ *
+ * relactivity.c
+ *
+ * Last write time of tables, see relactivity.h for the file format.
+ *
+ * Every refresh, the diskquota worker compares the new size of the active
+ * tables with their size in the model: a table found grown is extended,
+ * a table found shrunk, e.g. by TRUNCATE or by VACUUM cutting its tail, is
+ * truncated.  The times are as precise as diskquota.naptime, and writes
+ * which neither grow nor shrink a table are not seen, which is enough to
+ * find the tables not written for months.
+ *
+ * The worker saves the times of all its tables when any of them is changed,
+ * at most every RELATION_ACTIVITY_SAVE_INTERVAL, and loads them back when
+ * it starts, so the times are kept across restarts and only the writes of
+ * the last interval are lost on a crash.  The new worker compares the size
+ * of each table with the saved one, to find the writes while no worker ran.
+ * diskquota.relation_activity() reads the file of current database.
+ *
+ * Copyright (C) 2013, PostgreSQL Global Development Group
+ *
+ *
+ * -------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <unistd.h>
+
+#include "access/htup_details.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/fd.h"
+#include "utils/builtins.h"
+#include "utils/timestamp.h"
+
+#include "relactivity.h"
+
+#define RELATION_ACTIVITY_DIR "pg_stat"
+
+PG_FUNCTION_INFO_V1(relation_activity);
+
+static void relation_activity_file_name(char *path, Oid dbid);
+static RelationActivity *read_relation_activity(Oid dbid, int *num_entries);
+
+static void
+relation_activity_file_name(char *path, Oid dbid)
+{
+	snprintf(path, MAXPGPATH, RELATION_ACTIVITY_DIR "/diskquota_%u.activity", dbid);
+}
+
+/*
+ * Read the saved write times of a database into an array allocated in
+ * current memory context.  Return NULL if the file is missing or invalid.
+ */
+static RelationActivity *
+read_relation_activity(Oid dbid, int *num_entries)
+{
+	char		path[MAXPGPATH];
+	FILE	   *file;
+	RelationActivityFileHeader header;
+	RelationActivity *entries;
+
+	*num_entries = 0;
+	relation_activity_file_name(path, dbid);
+	file = AllocateFile(path, PG_BINARY_R);
+	if (file == NULL)
+	{
+		if (errno != ENOENT)
+			ereport(LOG,
+					(errcode_for_file_access(),
+					 errmsg("[diskquota] could not open relation activity file \"%s\": %m", path)));
+		return NULL;
+	}
+
+	if (fread(&header, sizeof(header), 1, file) != 1 ||
+		header.magic != RELATION_ACTIVITY_MAGIC ||
+		header.version != RELATION_ACTIVITY_VERSION ||
+		header.dbid != dbid)
+	{
+		ereport(LOG,
+				(errmsg("[diskquota] ignore invalid relation activity file \"%s\"", path)));
+		FreeFile(file);
+		return NULL;
+	}
+
+	entries = (RelationActivity *) palloc(sizeof(RelationActivity) * Max(header.num_entries, 1));
+	if (fread(entries, sizeof(RelationActivity), header.num_entries, file) != header.num_entries)
+	{
+		ereport(LOG,
+				(errmsg("[diskquota] ignore truncated relation activity file \"%s\"", path)));
+		pfree(entries);
+		FreeFile(file);
+		return NULL;
+	}
+	FreeFile(file);
+
+	*num_entries = header.num_entries;
+	return entries;
+}
+
+/*
+ * Load the saved write times of a database into a RelationActivity map
+ * keyed by table oid, which is allocated in current memory context.
+ * Return NULL if nothing is saved.
+ */
+HTAB *
+load_relation_activity(Oid dbid)
+{
+	HASHCTL		ctl;
+	HTAB	   *activity_map;
+	RelationActivity *entries;
+	int			num_entries;
+	int			i;
+
+	entries = read_relation_activity(dbid, &num_entries);
+	if (entries == NULL)
+		return NULL;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(Oid);
+	ctl.entrysize = sizeof(RelationActivity);
+	ctl.hcxt = CurrentMemoryContext;
+	ctl.hash = oid_hash;
+
+	activity_map = hash_create("local map of saved relation activity",
+							   Max(num_entries, 1024),
+							   &ctl,
+							   HASH_ELEM | HASH_CONTEXT | HASH_FUNCTION);
+	for (i = 0; i < num_entries; i++)
+	{
+		RelationActivity *entry;
+
+		entry = (RelationActivity *) hash_search(activity_map, &entries[i].reloid, HASH_ENTER, NULL);
+		*entry = entries[i];
+	}
+	pfree(entries);
+
+	return activity_map;
+}
+
+/*
+ * Save the write times of all the tables of current database, replacing
+ * the file saved last time.
+ */
+void
+save_relation_activity(RelationActivity *entries, int num_entries)
+{
+	char		path[MAXPGPATH];
+	char		tmppath[MAXPGPATH];
+	FILE	   *file;
+	RelationActivityFileHeader header;
+
+	relation_activity_file_name(path, MyDatabaseId);
+	snprintf(tmppath, MAXPGPATH, "%s.tmp", path);
+
+	file = AllocateFile(tmppath, PG_BINARY_W);
+	if (file == NULL)
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("[diskquota] could not create relation activity file \"%s\": %m", tmppath)));
+		return;
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = RELATION_ACTIVITY_MAGIC;
+	header.version = RELATION_ACTIVITY_VERSION;
+	header.dbid = MyDatabaseId;
+	header.num_entries = num_entries;
+	header.save_time = GetCurrentTimestamp();
+
+	if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+		(num_entries > 0 &&
+		 fwrite(entries, sizeof(RelationActivity), num_entries, file) != num_entries))
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("[diskquota] could not write relation activity file \"%s\": %m", tmppath)));
+		FreeFile(file);
+		unlink(tmppath);
+		return;
+	}
+	if (FreeFile(file) != 0)
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("[diskquota] could not close relation activity file \"%s\": %m", tmppath)));
+		unlink(tmppath);
+		return;
+	}
+
+	(void) durable_rename(tmppath, path, LOG);
+}
+
+/*
+ * Remove the file of a database whose diskquota extension is dropped.
+ */
+void
+remove_relation_activity(Oid dbid)
+{
+	char		path[MAXPGPATH];
+
+	relation_activity_file_name(path, dbid);
+	if (unlink(path) != 0 && errno != ENOENT)
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("[diskquota] could not remove relation activity file \"%s\": %m", path)));
+}
+
+/*
+ * Return the size and the write times of the tables of current database,
+ * as of the last save of its diskquota worker.
+ */
+Datum
+relation_activity(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	RelationActivity *entries;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		TupleDesc	tupdesc;
+		MemoryContext oldcontext;
+		int			num_entries;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			elog(ERROR, "return type must be a row type");
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+		entries = read_relation_activity(MyDatabaseId, &num_entries);
+		funcctx->user_fctx = entries;
+		funcctx->max_calls = entries ? num_entries : 0;
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	entries = (RelationActivity *) funcctx->user_fctx;
+
+	if (funcctx->call_cntr < funcctx->max_calls)
+	{
+		RelationActivity *entry = &entries[funcctx->call_cntr];
+		Datum		values[5];
+		bool		nulls[5];
+		HeapTuple	tuple;
+
+		memset(nulls, false, sizeof(nulls));
+		values[0] = ObjectIdGetDatum(entry->reloid);
+		values[1] = Int64GetDatum(entry->size);
+		values[2] = TimestampTzGetDatum(entry->first_seen);
+		values[3] = TimestampTzGetDatum(entry->last_extended);
+		nulls[3] = (entry->last_extended == 0);
+		values[4] = TimestampTzGetDatum(entry->last_truncated);
+		nulls[4] = (entry->last_truncated == 0);
+
+		tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
@@ -0,0 +1,51 @@
+/* -------------------------------------------------------------------------
+ *
+ * relactivity.h
+ *
+ * Last write time of the tables of a monitored database, to tell cold
+ * tables from hot ones.  The diskquota worker keeps the times in its model
+ * and saves them into pg_stat/diskquota_<database oid>.activity, which
+ * starts with a RelationActivityFileHeader followed by num_entries
+ * RelationActivity.  The file is replaced by rename, so readers never see
+ * a partial one, and it survives the restart of the worker and the server.
+ *
+ * Copyright (C) 2013, PostgreSQL Global Development Group
+ *
+ *
+ * -------------------------------------------------------------------------
+ */
+#ifndef DISKQUOTA_RELACTIVITY_H
+#define DISKQUOTA_RELACTIVITY_H
+
+#include "datatype/timestamp.h"
+#include "utils/hsearch.h"
+
+#define RELATION_ACTIVITY_MAGIC 0x54434144	/* "DACT" */
+#define RELATION_ACTIVITY_VERSION 1
+/* the worker saves changed write times at most once in this interval, in seconds */
+#define RELATION_ACTIVITY_SAVE_INTERVAL 60
+
+typedef struct RelationActivityFileHeader
+{
+	uint32		magic;
+	uint32		version;
+	Oid			dbid;
+	uint32		num_entries;
+	TimestampTz save_time;
+} RelationActivityFileHeader;
+
+/* write times of a table, 0 if not seen */
+typedef struct RelationActivity
+{
+	Oid			reloid;			/* hash table key */
+	int64		size;			/* total size of the table when it is saved */
+	TimestampTz first_seen;		/* the table is tracked since */
+	TimestampTz last_extended;	/* last refresh finding the table grown */
+	TimestampTz last_truncated;	/* last refresh finding the table shrunk */
+} RelationActivity;
+
+extern HTAB *load_relation_activity(Oid dbid);
+extern void save_relation_activity(RelationActivity *entries, int num_entries);
+extern void remove_relation_activity(Oid dbid);
+
+#endif
@@ -0,0 +1,497 @@
+/* -------------------------------------------------------------------------
+ *
+ * sizeservice.c
+ *
+ * The size service is a set of background processes without database
+ * connection which probe the file size of relfilenodes for all the diskquota
+ * worker processes.  Workers submit batches of relfilenodes through request
+ * slots in shared memory and wait on their latch for the sizes.  As all the
+ * stat() calls of the cluster are done by the service, the filesystem load of
+ * diskquota is bounded by the number of service processes and the stat budget,
+ * no matter how many databases are monitored.
+ *
+ * If the service is not running, or all the request slots are in use, the
+ * sizes are calculated by the requester itself.
+ *
+ * Copyright (C) 2013, PostgreSQL Global Development Group
+ *
+ *
+ * -------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "utils/guc.h"
+#include "utils/timestamp.h"
+
+#include "pg_utils.h"
+#include "sizeservice.h"
+
+/* interval to check whether the requested sizes are ready, in ms */
+#define SIZE_SERVICE_POLL_INTERVAL 100
+/* interval to check for new requests when there is none, in ms */
+#define SIZE_SERVICE_IDLE_INTERVAL 1000
+
+/* GUC variables */
+int			diskquota_size_service_workers = 1;
+int			diskquota_size_service_stat_budget = 0;
+
+static SizeServiceShmem *size_service = NULL;
+
+/* flags set by signal handlers */
+static volatile sig_atomic_t got_sighup = false;
+static volatile sig_atomic_t got_sigterm = false;
+
+/* index of the current server process, and its stat budget accounting */
+static int	my_server = -1;
+static TimestampTz budget_window_start = 0;
+static int	budget_used = 0;
+
+void		disk_quota_size_service_main(Datum main_arg);
+
+static void size_service_sigterm(SIGNAL_ARGS);
+static void size_service_sighup(SIGNAL_ARGS);
+static void size_service_detach(int code, Datum arg);
+static void size_service_throttle(void);
+static SizeServiceSlot *claim_size_request(void);
+static bool any_server_running(void);
+static bool submit_size_request(RelFileNodeBackend *nodes, int64 *sizes, int n);
+
+/*
+ * Shared memory needed by the size service
+ */
+Size
+size_service_shmem_size(void)
+{
+	return sizeof(SizeServiceShmem);
+}
+
+/*
+ * Init size service shared memory
+ */
+void
+init_size_service_shmem(void)
+{
+	bool		found;
+
+	size_service = ShmemInitStruct("disk_quota_size_service",
+								   sizeof(SizeServiceShmem),
+								   &found);
+	if (!found)
+		memset((void *) size_service, 0, sizeof(SizeServiceShmem));
+}
+
+/*
+ * Define the GUCs of the size service and register its processes.
+ * Called from _PG_init().
+ */
+void
+init_size_service(void)
+{
+	BackgroundWorker worker;
+	int			i;
+
+	DefineCustomIntVariable("diskquota.size_service_workers",
+							"Number of processes probing table file sizes for all diskquota workers, 0 to let each worker probe its own tables.",
+							NULL,
+							&diskquota_size_service_workers,
+							1,
+							0,
+							MAX_SIZE_SERVICE_WORKERS,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("diskquota.size_service_stat_budget",
+							"Max number of stat() calls per second done by the size service, 0 means no limit.",
+							NULL,
+							&diskquota_size_service_stat_budget,
+							0,
+							0,
+							INT_MAX,
+							PGC_SIGHUP,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	memset(&worker, 0, sizeof(BackgroundWorker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+	worker.bgw_start_time = BgWorkerStart_ConsistentState;
+	worker.bgw_restart_time = 5;
+	sprintf(worker.bgw_library_name, "diskquota");
+	sprintf(worker.bgw_function_name, "disk_quota_size_service_main");
+	worker.bgw_notify_pid = 0;
+
+	for (i = 0; i < diskquota_size_service_workers; i++)
+	{
+		snprintf(worker.bgw_name, BGW_MAXLEN, "[diskquota] - size service %d", i);
+		worker.bgw_main_arg = Int32GetDatum(i);
+		RegisterBackgroundWorker(&worker);
+	}
+}
+
+/*
+ * Signal handler for SIGTERM
+ */
+static void
+size_service_sigterm(SIGNAL_ARGS)
+{
+	int			save_errno = errno;
+
+	got_sigterm = true;
+	if (MyProc)
+		SetLatch(&MyProc->procLatch);
+
+	errno = save_errno;
+}
+
+/*
+ * Signal handler for SIGHUP
+ */
+static void
+size_service_sighup(SIGNAL_ARGS)
+{
+	int			save_errno = errno;
+
+	got_sighup = true;
+	if (MyProc)
+		SetLatch(&MyProc->procLatch);
+
+	errno = save_errno;
+}
+
+/*
+ * Unregister the server at exit.  Requests it is processing are handed back
+ * to other servers, or to the requesters if no server is left.
+ */
+static void
+size_service_detach(int code, Datum arg)
+{
+	int			server = DatumGetInt32(arg);
+	int			i;
+
+	LWLockAcquire(diskquota_locks.size_service_lock, LW_EXCLUSIVE);
+	size_service->server_pid[server] = 0;
+	size_service->server_latch[server] = NULL;
+	for (i = 0; i < MAX_NUM_MONITORED_DB; i++)
+	{
+		SizeServiceSlot *slot = &size_service->slots[i];
+
+		if (slot->state == SIZE_SLOT_PROCESSING && slot->server == server)
+		{
+			slot->state = SIZE_SLOT_SUBMITTED;
+			if (slot->requester_latch)
+				SetLatch(slot->requester_latch);
+		}
+	}
+	LWLockRelease(diskquota_locks.size_service_lock);
+}
+
+/*
+ * Sleep until the next second if the stat budget of this second is used up.
+ * With the simulated size provider, each probe of a relfilenode counts.
+ * The budget is shared evenly by all the server processes.
+ */
+static void
+size_service_throttle(void)
+{
+	int			budget;
+	TimestampTz now;
+
+	if (diskquota_size_service_stat_budget <= 0)
+		return;
+
+	budget = Max(diskquota_size_service_stat_budget / diskquota_size_service_workers, 1);
+	now = GetCurrentTimestamp();
+	if (TimestampDifferenceExceeds(budget_window_start, now, 1000))
+	{
+		budget_window_start = now;
+		budget_used = 0;
+	}
+
+	if (budget_used >= budget)
+	{
+		long		secs;
+		int			usecs;
+		int			rc;
+
+		TimestampDifference(now, TimestampTzPlusMilliseconds(budget_window_start, 1000),
+							&secs, &usecs);
+		rc = WaitLatch(NULL, WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					   secs * 1000L + usecs / 1000 + 1, PG_WAIT_EXTENSION);
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+
+		budget_window_start = GetCurrentTimestamp();
+		budget_used = 0;
+	}
+	budget_used++;
+}
+
+/*
+ * Claim a submitted request slot.  Slots are scanned round-robin, so
+ * that a database with many tables could not starve the others.
+ */
+static SizeServiceSlot *
+claim_size_request(void)
+{
+	SizeServiceSlot *claimed = NULL;
+	int			i;
+
+	LWLockAcquire(diskquota_locks.size_service_lock, LW_EXCLUSIVE);
+	for (i = 0; i < MAX_NUM_MONITORED_DB; i++)
+	{
+		int			idx = (size_service->next_slot + i) % MAX_NUM_MONITORED_DB;
+		SizeServiceSlot *slot = &size_service->slots[idx];
+
+		if (slot->state == SIZE_SLOT_SUBMITTED)
+		{
+			slot->state = SIZE_SLOT_PROCESSING;
+			slot->server = my_server;
+			size_service->next_slot = (idx + 1) % MAX_NUM_MONITORED_DB;
+			claimed = slot;
+			break;
+		}
+	}
+	LWLockRelease(diskquota_locks.size_service_lock);
+
+	return claimed;
+}
+
+/* ---- Functions for size service process ---- */
+
+/*
+ * Size service process probes the file size of the submitted relfilenodes.
+ */
+void
+disk_quota_size_service_main(Datum main_arg)
+{
+	my_server = DatumGetInt32(main_arg);
+
+	/* Establish signal handlers before unblocking signals. */
+	pqsignal(SIGHUP, size_service_sighup);
+	pqsignal(SIGTERM, size_service_sigterm);
+
+	/* We're now ready to receive signals */
+	BackgroundWorkerUnblockSignals();
+
+	LWLockAcquire(diskquota_locks.size_service_lock, LW_EXCLUSIVE);
+	size_service->server_pid[my_server] = MyProcPid;
+	size_service->server_latch[my_server] = &MyProc->procLatch;
+	LWLockRelease(diskquota_locks.size_service_lock);
+	on_shmem_exit(size_service_detach, Int32GetDatum(my_server));
+
+	elog(LOG, "[diskquota]:start size service process %d", my_server);
+
+	while (!got_sigterm)
+	{
+		SizeServiceSlot *slot;
+		int			i;
+
+		if (got_sighup)
+		{
+			got_sighup = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		slot = claim_size_request();
+		if (slot == NULL)
+		{
+			int			rc;
+
+			rc = WaitLatch(&MyProc->procLatch,
+						   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+						   SIZE_SERVICE_IDLE_INTERVAL, PG_WAIT_EXTENSION);
+			ResetLatch(&MyProc->procLatch);
+
+			/* emergency bailout if postmaster has died */
+			if (rc & WL_POSTMASTER_DEATH)
+				proc_exit(1);
+			continue;
+		}
+
+		for (i = 0; i < slot->nrequests; i++)
+		{
+			SizeRequest *req = &slot->requests[i];
+
+			req->size = diskquota_get_relfilenode_size(&req->rnode, req->forks,
+													   LOG, size_service_throttle);
+		}
+
+		LWLockAcquire(diskquota_locks.size_service_lock, LW_EXCLUSIVE);
+		if (slot->requester_pid == 0)
+		{
+			/* the requester has given up waiting */
+			slot->state = SIZE_SLOT_FREE;
+		}
+		else
+		{
+			slot->state = SIZE_SLOT_DONE;
+			SetLatch(slot->requester_latch);
+		}
+		LWLockRelease(diskquota_locks.size_service_lock);
+	}
+
+	proc_exit(0);
+}
+
+/* ---- Functions for requesters ---- */
+
+/*
+ * Caller must hold size_service_lock
+ */
+static bool
+any_server_running(void)
+{
+	int			i;
+
+	for (i = 0; i < MAX_SIZE_SERVICE_WORKERS; i++)
+	{
+		if (size_service->server_pid[i] != 0)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Submit a batch of at most SIZE_SERVICE_BATCH_SIZE relfilenodes to the size
+ * service and wait for the sizes.  Return false if the service could not
+ * serve the request, then the sizes are not set.
+ */
+static bool
+submit_size_request(RelFileNodeBackend *nodes, int64 *sizes, int n)
+{
+	SizeServiceSlot *slot = NULL;
+	Latch	   *server_latch[MAX_SIZE_SERVICE_WORKERS];
+	bool		served = false;
+	int			i;
+
+	Assert(n <= SIZE_SERVICE_BATCH_SIZE);
+
+	LWLockAcquire(diskquota_locks.size_service_lock, LW_EXCLUSIVE);
+	if (any_server_running())
+	{
+		for (i = 0; i < MAX_NUM_MONITORED_DB; i++)
+		{
+			if (size_service->slots[i].state == SIZE_SLOT_FREE)
+			{
+				slot = &size_service->slots[i];
+				break;
+			}
+		}
+	}
+	if (slot == NULL)
+	{
+		LWLockRelease(diskquota_locks.size_service_lock);
+		return false;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		slot->requests[i].rnode = nodes[i];
+		slot->requests[i].forks = SIZE_ALL_FORKS;
+		slot->requests[i].size = 0;
+	}
+	slot->nrequests = n;
+	slot->requester_pid = MyProcPid;
+	slot->requester_latch = &MyProc->procLatch;
+	slot->state = SIZE_SLOT_SUBMITTED;
+	memcpy(server_latch, size_service->server_latch, sizeof(server_latch));
+	LWLockRelease(diskquota_locks.size_service_lock);
+
+	for (i = 0; i < MAX_SIZE_SERVICE_WORKERS; i++)
+	{
+		if (server_latch[i])
+			SetLatch(server_latch[i]);
+	}
+
+	PG_TRY();
+	{
+		for (;;)
+		{
+			int			rc;
+			bool		finished = false;
+
+			LWLockAcquire(diskquota_locks.size_service_lock, LW_EXCLUSIVE);
+			if (slot->state == SIZE_SLOT_DONE)
+			{
+				for (i = 0; i < n; i++)
+					sizes[i] = slot->requests[i].size;
+				served = true;
+				finished = true;
+			}
+			else if (slot->state == SIZE_SLOT_SUBMITTED && !any_server_running())
+				finished = true;
+
+			if (finished)
+			{
+				slot->requester_latch = NULL;
+				slot->requester_pid = 0;
+				slot->state = SIZE_SLOT_FREE;
+			}
+			LWLockRelease(diskquota_locks.size_service_lock);
+
+			if (finished)
+				break;
+
+			rc = WaitLatch(&MyProc->procLatch,
+						   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+						   SIZE_SERVICE_POLL_INTERVAL, PG_WAIT_EXTENSION);
+			ResetLatch(&MyProc->procLatch);
+
+			/* emergency bailout if postmaster has died */
+			if (rc & WL_POSTMASTER_DEATH)
+				proc_exit(1);
+
+			CHECK_FOR_INTERRUPTS();
+		}
+	}
+	PG_CATCH();
+	{
+		/* the server may still be writing the slot, leave it to the server to free */
+		LWLockAcquire(diskquota_locks.size_service_lock, LW_EXCLUSIVE);
+		slot->requester_latch = NULL;
+		slot->requester_pid = 0;
+		if (slot->state == SIZE_SLOT_SUBMITTED || slot->state == SIZE_SLOT_DONE)
+			slot->state = SIZE_SLOT_FREE;
+		LWLockRelease(diskquota_locks.size_service_lock);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	return served;
+}
+
+/*
+ * Get the size of all the forks of the relfilenodes.  Sizes are probed by
+ * the size service if it is running, otherwise by the current process.
+ * A size is -1 if the size service could not stat a segment file of it.
+ */
+void
+size_service_get_sizes(RelFileNodeBackend *nodes, int64 *sizes, int n)
+{
+	int			start;
+	int			i;
+
+	for (start = 0; start < n; start += SIZE_SERVICE_BATCH_SIZE)
+	{
+		int			num = Min(n - start, SIZE_SERVICE_BATCH_SIZE);
+
+		if (size_service != NULL &&
+			submit_size_request(&nodes[start], &sizes[start], num))
+			continue;
+
+		for (i = start; i < start + num; i++)
+			sizes[i] = diskquota_get_relfilenode_size(&nodes[i], SIZE_ALL_FORKS,
+													  ERROR, NULL);
+	}
+}
@@ -0,0 +1,72 @@
+/* -------------------------------------------------------------------------
+ *
+ * sizeservice.h
+ *
+ * Cluster level service probing the file size of relfilenodes for all the
+ * diskquota worker processes.
+ *
+ * Copyright (C) 2013, PostgreSQL Global Development Group
+ *
+ *
+ * -------------------------------------------------------------------------
+ */
+#ifndef DISKQUOTA_SIZE_SERVICE_H
+#define DISKQUOTA_SIZE_SERVICE_H
+
+#include "storage/latch.h"
+#include "storage/relfilenode.h"
+
+#include "diskquota.h"
+
+/* max number of size service processes */
+#define MAX_SIZE_SERVICE_WORKERS 8
+/* max number of relfilenodes in one request */
+#define SIZE_SERVICE_BATCH_SIZE 256
+
+typedef enum
+{
+	SIZE_SLOT_FREE = 0,
+	SIZE_SLOT_SUBMITTED,		/* filled by requester, waiting for a server */
+	SIZE_SLOT_PROCESSING,		/* claimed by a server */
+	SIZE_SLOT_DONE				/* sizes are filled, waiting for requester */
+} SizeSlotState;
+
+typedef struct SizeRequest
+{
+	RelFileNodeBackend rnode;
+	int			forks;			/* mask of forks to be sized */
+	int64		size;			/* -1 if any segment file could not be stat'ed */
+} SizeRequest;
+
+/*
+ * A request slot is owned by one requester at a time.  The state is
+ * protected by size_service_lock, the requests are accessed without lock
+ * by the process which the state hands the slot to.
+ */
+typedef struct SizeServiceSlot
+{
+	SizeSlotState state;
+	int			requester_pid;
+	Latch	   *requester_latch;
+	int			server;			/* index of the server processing the slot */
+	int			nrequests;
+	SizeRequest requests[SIZE_SERVICE_BATCH_SIZE];
+} SizeServiceSlot;
+
+typedef struct SizeServiceShmem
+{
+	int			server_pid[MAX_SIZE_SERVICE_WORKERS];	/* 0 if not running */
+	Latch	   *server_latch[MAX_SIZE_SERVICE_WORKERS];
+	int			next_slot;		/* where the next server scan starts */
+	SizeServiceSlot slots[MAX_NUM_MONITORED_DB];
+} SizeServiceShmem;
+
+extern int	diskquota_size_service_workers;
+extern int	diskquota_size_service_stat_budget;
+
+extern Size size_service_shmem_size(void);
+extern void init_size_service_shmem(void);
+extern void init_size_service(void);
+extern void size_service_get_sizes(RelFileNodeBackend *nodes, int64 *sizes, int n);
+
+#endif
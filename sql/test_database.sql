@@ -0,0 +1,29 @@
+-- Test database usage and quota
+select diskquota.set_database_quota('10 GB');
+create table t_database(i int);
+insert into t_database select generate_series(1,100000);
+select diskquota.refresh();
+-- expect system catalogs counted, close to pg_database_size()
+select usage_in_bytes > pg_total_relation_size('t_database') + pg_total_relation_size('pg_class') as has_catalogs,
+	usage_in_bytes between pg_database_size(current_database()) * 0.9
+		and pg_database_size(current_database()) * 1.1 as is_close,
+	quota_in_mb
+	from diskquota.database_usage()
+	where dbid = (select oid from pg_database where datname = current_database());
+
+-- expect insert fail after quota exceeded
+select diskquota.set_database_quota('1 MB');
+select diskquota.refresh();
+select headroom_in_bytes < 0 as is_exceeded
+	from diskquota.headroom((select oid from pg_database where datname = current_database()), 2);
+insert into t_database select generate_series(1,100);
+
+-- expect insert succeed after quota dropped
+select diskquota.set_database_quota('-1');
+select diskquota.refresh();
+select quota_in_mb is null as no_quota
+	from diskquota.database_usage()
+	where dbid = (select oid from pg_database where datname = current_database());
+insert into t_database select generate_series(1,100);
+
+drop table t_database;
@@ -0,0 +1,36 @@
+-- Test Drop table with the pgstat active table detector
+alter system set diskquota.active_table_detector = 'pgstat';
+\! pg_ctl -D /tmp/pg_diskquota_test/data restart -l /dev/null 2>/dev/null >/dev/null
+\c
+select pg_sleep(9);
+create schema sdrtbl_pgstat;
+select diskquota.set_schema_quota('sdrtbl_pgstat', '1 MB');
+set search_path to sdrtbl_pgstat;
+create table a(i int);
+create table a2(i int);
+insert into a select generate_series(1,100000);
+select pg_sleep(5);
+-- expect insert fail
+insert into a2 select generate_series(1,100);
+drop table a;
+select pg_sleep(5);
+-- expect insert succeed
+insert into a2 select generate_series(1,100);
+select pg_sleep(5);
+select usage_in_bytes = pg_total_relation_size('a2') as dropped_table_removed
+	from diskquota.headroom('sdrtbl_pgstat'::regnamespace);
+-- expect the table re-measured when its new index is scanned
+create index a2_idx on a2(i);
+set enable_seqscan to off;
+select count(*) from a2 where i = 1;
+reset enable_seqscan;
+select pg_sleep(5);
+select usage_in_bytes = pg_total_relation_size('a2') as index_measured
+	from diskquota.headroom('sdrtbl_pgstat'::regnamespace);
+drop table a2;
+reset search_path;
+drop schema sdrtbl_pgstat;
+alter system reset diskquota.active_table_detector;
+\! pg_ctl -D /tmp/pg_diskquota_test/data restart -l /dev/null 2>/dev/null >/dev/null
+\c
+select pg_sleep(9);
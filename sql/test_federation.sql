@@ -0,0 +1,53 @@
+-- Test federation sums other instances but not the databases of one instance
+\! mkdir -p /tmp/pg_diskquota_federation
+alter system set diskquota.federation_directory = '/tmp/pg_diskquota_federation';
+\! pg_ctl -D /tmp/pg_diskquota_test/data restart -l /dev/null 2>/dev/null >/dev/null
+\c
+select pg_sleep(9);
+create database db_federation;
+\c db_federation
+create extension diskquota;
+\! sleep 2
+create schema s_federation;
+create table s_federation.a(i int);
+insert into s_federation.a select generate_series(1,100000);
+select diskquota.refresh();
+\c contrib_regression
+create schema s_federation;
+select diskquota.set_schema_quota('s_federation', '1 MB');
+create table s_federation.a(i int);
+insert into s_federation.a select generate_series(1,100);
+select diskquota.refresh();
+-- expect the schema of the same name in db_federation not counted
+select usage_in_bytes = pg_total_relation_size('s_federation.a') as is_local
+	from diskquota.headroom('s_federation'::regnamespace);
+-- expect insert succeed
+insert into s_federation.a select generate_series(1,100);
+-- expect the usage published by another instance counted
+insert into s_federation.a select generate_series(1,20000);
+select diskquota.refresh();
+select oid as dboid from pg_database where datname = current_database() \gset
+\setenv DBOID :dboid
+\! cp /tmp/pg_diskquota_federation/*_${DBOID}.dqfed /tmp/pg_diskquota_federation/other_instance.dqfed
+\! printf '\377\377\377\377' | dd of=/tmp/pg_diskquota_federation/other_instance.dqfed bs=1 seek=24 conv=notrunc 2>/dev/null
+select diskquota.refresh();
+select usage_in_bytes = 2 * pg_total_relation_size('s_federation.a') as is_federated
+	from diskquota.headroom('s_federation'::regnamespace);
+-- expect insert fail
+insert into s_federation.a select generate_series(1,100);
+\! rm -f /tmp/pg_diskquota_federation/other_instance.dqfed
+select diskquota.refresh();
+-- expect insert succeed
+insert into s_federation.a select generate_series(1,100);
+select diskquota.set_schema_quota('s_federation', '-1');
+drop table s_federation.a;
+drop schema s_federation;
+\c db_federation
+drop extension diskquota;
+\! sleep 2
+\c contrib_regression
+drop database db_federation;
+alter system reset diskquota.federation_directory;
+\! pg_ctl -D /tmp/pg_diskquota_test/data restart -l /dev/null 2>/dev/null >/dev/null
+\c
+select pg_sleep(9);
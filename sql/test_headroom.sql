@@ -0,0 +1,29 @@
+-- Test headroom
+create schema s_headroom;
+select diskquota.set_schema_quota('s_headroom', '1 MB');
+create table s_headroom.a(i int);
+insert into s_headroom.a select generate_series(1,100);
+select pg_sleep(5);
+select quota_in_mb, usage_in_bytes > 0 as has_usage,
+	headroom_in_bytes = quota_in_mb * 1024 * 1024 - usage_in_bytes as is_consistent,
+	staleness < interval '10 seconds' as is_fresh
+	from diskquota.headroom('s_headroom'::regnamespace);
+
+-- expect negative headroom after quota exceeded
+insert into s_headroom.a select generate_series(1,100000);
+select pg_sleep(5);
+select headroom_in_bytes < 0 as is_exceeded from diskquota.headroom('s_headroom'::regnamespace);
+
+-- expect no limit for role without quota
+create role u_headroom nologin;
+alter table s_headroom.a owner to u_headroom;
+select pg_sleep(5);
+select quota_in_mb is null as no_quota, usage_in_bytes > 0 as has_usage
+	from diskquota.headroom('u_headroom'::regrole, 1);
+
+-- expect error with invalid quota type
+select * from diskquota.headroom('s_headroom'::regnamespace, 3);
+
+drop table s_headroom.a;
+drop role u_headroom;
+drop schema s_headroom;
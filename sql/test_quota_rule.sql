@@ -0,0 +1,41 @@
+-- Test bulk quota setting
+create schema s_bulk1;
+create schema s_bulk2;
+select diskquota.set_schema_quotas(array['s_bulk1', 's_bulk2'], array['1 MB']);
+select nspname, quotalimitmb from diskquota.quota_config, pg_namespace
+	where targetoid = pg_namespace.oid and quotatype = 0 and nspname like 's_bulk%' order by nspname;
+-- update and delete in one call
+select diskquota.set_schema_quotas(array['s_bulk1', 's_bulk2'], array['2 MB', '-1']);
+select nspname, quotalimitmb from diskquota.quota_config, pg_namespace
+	where targetoid = pg_namespace.oid and quotatype = 0 and nspname like 's_bulk%' order by nspname;
+-- expect fail with mismatched arrays
+select diskquota.set_schema_quotas(array['s_bulk1', 's_bulk2'], array['1 MB', '2 MB', '3 MB']);
+select diskquota.set_schema_quotas(array['s_bulk1'], array['-1']);
+
+-- Test quota rule
+create schema tenant_1;
+select diskquota.set_schema_quota_rule('tenant_%', '1 MB');
+create table tenant_1.a(i int);
+insert into tenant_1.a select generate_series(1,100000);
+select diskquota.refresh();
+-- expect insert fail
+insert into tenant_1.a select generate_series(1,100);
+-- expect insert succeed after the schema is renamed out of the rule
+alter schema tenant_1 rename to other_1;
+select diskquota.refresh();
+insert into other_1.a select generate_series(1,100);
+alter schema other_1 rename to tenant_1;
+select diskquota.refresh();
+-- expect insert fail
+insert into tenant_1.a select generate_series(1,100);
+-- quota in quota_config takes precedence over rule
+select diskquota.set_schema_quota('tenant_1', '10 MB');
+select diskquota.refresh();
+-- expect insert succeed
+insert into tenant_1.a select generate_series(1,100);
+select diskquota.set_schema_quota('tenant_1', '-1');
+select diskquota.set_schema_quota_rule('tenant_%', '-1');
+select count(*) from diskquota.quota_rule;
+
+drop table tenant_1.a;
+drop schema tenant_1, s_bulk1, s_bulk2;
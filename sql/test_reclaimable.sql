@@ -0,0 +1,20 @@
+-- Test reclaimable space estimate
+create schema s_reclaim;
+select diskquota.set_schema_quota('s_reclaim', '1 MB');
+create table s_reclaim.a(i int);
+insert into s_reclaim.a select generate_series(1,100000);
+delete from s_reclaim.a where i % 2 = 0;
+vacuum s_reclaim.a;
+select pg_sleep(5);
+-- expect the table with free space in the schema over its quota limit
+select target_name, quotatype, table_name, reclaimable_in_bytes > 0 as has_free_space,
+	target_reclaimable_in_bytes >= reclaimable_in_bytes as is_consistent
+	from diskquota.show_reclaimable_view where target_name = 's_reclaim';
+
+-- expect no estimate after the quota limit is dropped
+select diskquota.set_schema_quota('s_reclaim', '-1');
+select pg_sleep(5);
+select count(*) from diskquota.show_reclaimable_view where target_name = 's_reclaim';
+
+drop table s_reclaim.a;
+drop schema s_reclaim;
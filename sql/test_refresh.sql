@@ -0,0 +1,24 @@
+-- Test refresh
+create schema s_refresh;
+select diskquota.set_schema_quota('s_refresh', '1 MB');
+create table s_refresh.a(i int);
+insert into s_refresh.a select generate_series(1,100000);
+select diskquota.refresh();
+-- expect insert fail
+insert into s_refresh.a select generate_series(1,100);
+truncate s_refresh.a;
+select diskquota.refresh('s_refresh'::regnamespace);
+-- expect insert succeed
+insert into s_refresh.a select generate_series(1,100);
+select diskquota.refresh(wait => false);
+-- expect fail with invalid quota type
+select diskquota.refresh('s_refresh'::regnamespace, true, 2);
+-- expect fail for non-superuser
+create role u_refresh nologin;
+set role u_refresh;
+select diskquota.refresh();
+reset role;
+drop role u_refresh;
+select diskquota.set_schema_quota('s_refresh', '-1');
+drop table s_refresh.a;
+drop schema s_refresh;
@@ -0,0 +1,28 @@
+-- Test relation activity
+create schema s_activity;
+create table s_activity.a(i int);
+insert into s_activity.a select generate_series(1,10000);
+select diskquota.refresh('s_activity'::regnamespace);
+-- expect the table extended but not truncated
+select size_in_bytes > 0 as has_size, last_extended is not null as is_extended,
+	last_truncated is null as not_truncated, first_seen <= last_extended as is_consistent
+	from diskquota.relation_activity() where relid = 's_activity.a'::regclass;
+
+-- expect the table truncated
+truncate s_activity.a;
+select diskquota.refresh('s_activity'::regnamespace);
+select size_in_bytes = 0 as is_empty, last_truncated >= last_extended as is_truncated
+	from diskquota.relation_activity() where relid = 's_activity.a'::regclass;
+
+-- expect the write while the worker is restarted found by the new worker
+select last_extended as extended_before from diskquota.relation_activity()
+	where relid = 's_activity.a'::regclass \gset
+insert into s_activity.a select generate_series(1,10000);
+\! pg_ctl -D /tmp/pg_diskquota_test/data restart -l /dev/null 2>/dev/null >/dev/null
+\c
+select pg_sleep(9);
+select size_in_bytes > 0 as has_size, last_extended > :'extended_before' as is_extended
+	from diskquota.relation_activity() where relid = 's_activity.a'::regclass;
+
+drop table s_activity.a;
+drop schema s_activity;
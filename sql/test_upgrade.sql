@@ -0,0 +1,25 @@
+-- Test a database with version 1.0 of the extension, and its update
+create database db_upgrade;
+\c db_upgrade
+create extension diskquota version '1.0';
+\! sleep 2
+create schema s_upgrade;
+select diskquota.set_schema_quota('s_upgrade', '1 MB');
+create table s_upgrade.a(i int);
+insert into s_upgrade.a select generate_series(1,100000);
+select pg_sleep(5);
+-- expect insert fail
+insert into s_upgrade.a select generate_series(1,100);
+alter extension diskquota update;
+select extversion from pg_extension where extname = 'diskquota';
+select diskquota.set_schema_quota_rule('other_%', '1 MB');
+select diskquota.set_schema_quota('s_upgrade', '-1');
+select diskquota.refresh();
+-- expect insert succeed
+insert into s_upgrade.a select generate_series(1,100);
+drop table s_upgrade.a;
+drop schema s_upgrade;
+drop extension diskquota;
+\! sleep 2
+\c contrib_regression
+drop database db_upgrade;
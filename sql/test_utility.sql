@@ -0,0 +1,59 @@
+-- Test quota check of utility commands
+create schema s_util;
+select diskquota.set_schema_quota('s_util', '1 MB');
+set search_path to s_util;
+
+create table a(i int);
+create materialized view mv0 as select 1 as i;
+-- expect insert fail
+insert into a select generate_series(1,100000000);
+-- expect create index fail
+create index a_idx on a(i);
+-- expect vacuum full fail
+vacuum full a;
+-- expect alter table rewrite fail
+alter table a alter column i type bigint;
+-- expect create table as fail
+create table b as select generate_series(1,100) as i;
+-- expect create materialized view fail
+create materialized view mv as select 1 as i;
+-- expect vacuum succeed
+vacuum a;
+-- expect reindex fail
+reindex table a;
+-- expect cluster fail
+cluster a;
+-- expect refresh materialized view fail
+refresh materialized view mv0;
+-- expect alter table without writing data succeed
+alter table a add column j int;
+alter table a add constraint a_check check (i > 0);
+alter table a add column k int default 1;
+alter table a add column v varchar(10);
+alter table a alter column v type varchar(20);
+-- expect alter table adding a column with volatile default fail
+alter table a add column r float8 default random();
+
+reset search_path;
+drop materialized view s_util.mv0;
+drop table s_util.a;
+drop schema s_util;
+
+-- Test diskquota.utility_headroom_check
+create schema s_util2;
+select diskquota.set_schema_quota('s_util2', '2 MB');
+create table s_util2.c(i int, v varchar(10));
+insert into s_util2.c select generate_series(1,30000), 'x';
+select diskquota.refresh();
+set diskquota.utility_headroom_check to on;
+-- expect rewrite larger than headroom fail
+vacuum full s_util2.c;
+alter table s_util2.c alter column i type bigint;
+-- expect alter table without rewrite succeed
+alter table s_util2.c alter column v type varchar(20);
+set diskquota.utility_headroom_check to off;
+-- expect vacuum full succeed without the check
+vacuum full s_util2.c;
+select diskquota.set_schema_quota('s_util2', '-1');
+drop table s_util2.c;
+drop schema s_util2;
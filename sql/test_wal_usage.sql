@@ -0,0 +1,18 @@
+-- Test WAL accounting
+alter system set diskquota.wal_accounting = on;
+select pg_reload_conf();
+select pg_sleep(1);
+create schema s_wal;
+set search_path to s_wal;
+create table a(i int);
+select diskquota.refresh();
+insert into a select generate_series(1,100000);
+select diskquota.refresh();
+select wal_bytes > 0 as has_wal, wal_bytes_per_sec >= 0 as has_rate
+from diskquota.wal_usage()
+where targetoid = 's_wal'::regnamespace and quotatype = 0;
+reset search_path;
+drop table s_wal.a;
+drop schema s_wal;
+alter system reset diskquota.wal_accounting;
+select pg_reload_conf();
@@ -0,0 +1,6 @@
+-- Test worker status
+select diskquota.refresh();
+select pid > 0 as has_pid, refresh_count > 0 as refreshed,
+	init_refresh_ms >= 0 as init_measured, last_refresh_ms >= 0 as last_measured
+from diskquota.worker_status()
+where dbid = (select oid from pg_database where datname = current_database());
@@ -0,0 +1,596 @@
+/* -------------------------------------------------------------------------
+ *
+ * dq_replay.c
+ *
+ * Offline replay of active table event captures written by diskquota when
+ * diskquota.capture_directory is set.
+ *
+ * The captured events of all the backends are merged by time and fed to a
+ * simulation of the shared active table map and the diskquota worker of
+ * each database, as fast as possible.  Every naptime of capture time, each
+ * worker drains all the active entries of its database and re-measures
+ * them; unlinked relfilenodes leave the model.  The true size of each
+ * relfilenode is tracked from the extended and truncated blocks.
+ *
+ * The simulation reports, as JSON, how the configuration behaves on the
+ * captured traffic: peak size of the active map, events dropped because
+ * the map is full, entries drained and stat() calls per refresh, how far
+ * the model lags behind the true size, and with a quota, how late and by
+ * how many bytes the quota is detected as exceeded.
+ *
+ * This is a standalone model, it shares no code with activetable.c and
+ * quotamodel.c.  Relfilenodes are not mapped to tables, so the usage and
+ * the quota are of whole databases, not of schemas or roles, and catalog
+ * changes such as table rewrites are only seen as unlink and extend.
+ *
+ * usage: dq_replay [options] capture-file...
+ *
+ * Copyright (C) 2013, PostgreSQL Global Development Group
+ *
+ *
+ * -------------------------------------------------------------------------
+ */
+#include "postgres_fe.h"
+
+#include <sys/time.h>
+
+#include "getopt_long.h"
+
+#include "capture.h"
+
+/* forks of a relfilenode, same as MAX_FORKNUM + 1 */
+#define NUM_FORKS 4
+/* fork of the key of a relfilenode as a whole */
+#define ALL_FORKS 0xFFFF
+
+typedef struct NodeKey
+{
+	uint32		spcnode;
+	uint32		dbnode;
+	uint32		relnode;
+	uint32		fork;
+} NodeKey;
+
+/* open addressing hash table from NodeKey to int64 */
+typedef struct NodeMap
+{
+	uint64		capacity;		/* power of 2 */
+	uint64		count;
+	NodeKey    *keys;
+	int64	   *values;
+	bool	   *used;
+} NodeMap;
+
+/* state of the simulated worker of a database */
+typedef struct DbState
+{
+	uint32		dbnode;
+	int64		true_size;		/* sum of the true size of relfilenodes */
+	int64		model_size;		/* sum of the sizes in the model */
+	int64		max_lag;		/* max true_size - model_size at a refresh */
+	int64		crossed_at;		/* time the true size exceeded the quota, or 0 */
+	int64		detected_at;	/* time the model exceeded the quota, or 0 */
+	int64		overshoot;		/* true size above the quota when detected */
+} DbState;
+
+/* a captured record with its position in the capture files */
+typedef struct ReplayRecord
+{
+	CaptureRecord record;
+	uint64		seq;			/* keeps the order of events of one backend */
+} ReplayRecord;
+
+typedef struct Options
+{
+	double		naptime;
+	uint64		max_active_tables;
+	int64		quota_mb;
+	const char *cycles_csv;
+} Options;
+
+static Options options = {10.0, 1024 * 1024, 0, NULL};
+
+static const char *progname;
+static uint32 block_size = 8192;
+
+static NodeMap true_sizes;		/* blocks of each fork of relfilenodes */
+static NodeMap model_sizes;		/* bytes of each relfilenode in the model */
+static NodeMap active_map;		/* active relfilenodes, value is 1 for unlink */
+
+static DbState *dbs = NULL;
+static int	num_dbs = 0;
+
+static void usage(void);
+static void *xmalloc(size_t size);
+static void map_init(NodeMap *map, uint64 capacity);
+static uint64 map_slot(NodeMap *map, const NodeKey *key);
+static int64 *map_find(NodeMap *map, const NodeKey *key);
+static int64 *map_enter(NodeMap *map, const NodeKey *key);
+static void map_remove(NodeMap *map, const NodeKey *key);
+static DbState *get_db(uint32 dbnode);
+static ReplayRecord *load_captures(char **files, int nfiles, uint64 *nrecords);
+static int	cmp_record(const void *a, const void *b);
+static int64 relfilenode_size(const NodeKey *node);
+static void apply_event(const CaptureRecord *record, uint64 *dropped);
+static void refresh(int64 now, FILE *csv, uint64 *max_drained, uint64 *max_stats,
+					uint64 *total_stats);
+
+static void
+usage(void)
+{
+	printf("%s replays diskquota active table event captures.\n\n", progname);
+	printf("Usage:\n  %s [OPTION]... FILE...\n\n", progname);
+	printf("Options:\n");
+	printf("  -n, --naptime=SECS             refresh interval of workers (default: 10)\n");
+	printf("  -m, --max-active-tables=N      capacity of the active table map (default: 1048576)\n");
+	printf("  -q, --quota-mb=MB              quota of each database, to measure enforcement delay\n");
+	printf("  -c, --cycles-csv=FILE          write the state after each refresh into FILE\n");
+	printf("  -?, --help                     show this help, then exit\n");
+}
+
+static void *
+xmalloc(size_t size)
+{
+	void	   *p = calloc(1, size);
+
+	if (p == NULL)
+	{
+		fprintf(stderr, "%s: out of memory\n", progname);
+		exit(1);
+	}
+	return p;
+}
+
+static void
+map_init(NodeMap *map, uint64 capacity)
+{
+	map->capacity = capacity;
+	map->count = 0;
+	map->keys = xmalloc(sizeof(NodeKey) * capacity);
+	map->values = xmalloc(sizeof(int64) * capacity);
+	map->used = xmalloc(sizeof(bool) * capacity);
+}
+
+/* slot of the key, or of the empty slot where the key would be */
+static uint64
+map_slot(NodeMap *map, const NodeKey *key)
+{
+	uint64		h;
+	uint64		i;
+
+	h = ((uint64) key->relnode * 0x9E3779B97F4A7C15ULL) ^
+		((uint64) key->dbnode * 0xC2B2AE3D27D4EB4FULL) ^
+		((uint64) key->spcnode * 0x165667B19E3779F9ULL) ^ key->fork;
+	h ^= h >> 29;
+	for (i = h & (map->capacity - 1);; i = (i + 1) & (map->capacity - 1))
+	{
+		if (!map->used[i] || memcmp(&map->keys[i], key, sizeof(NodeKey)) == 0)
+			return i;
+	}
+}
+
+static int64 *
+map_find(NodeMap *map, const NodeKey *key)
+{
+	uint64		i = map_slot(map, key);
+
+	return map->used[i] ? &map->values[i] : NULL;
+}
+
+static int64 *
+map_enter(NodeMap *map, const NodeKey *key)
+{
+	uint64		i;
+
+	if ((map->count + 1) * 10 > map->capacity * 7)
+	{
+		NodeMap		old = *map;
+		uint64		j;
+
+		map_init(map, old.capacity * 2);
+		for (j = 0; j < old.capacity; j++)
+		{
+			if (old.used[j])
+				*map_enter(map, &old.keys[j]) = old.values[j];
+		}
+		free(old.keys);
+		free(old.values);
+		free(old.used);
+	}
+
+	i = map_slot(map, key);
+	if (!map->used[i])
+	{
+		map->used[i] = true;
+		map->keys[i] = *key;
+		map->values[i] = 0;
+		map->count++;
+	}
+	return &map->values[i];
+}
+
+/* remove by backward shift, so that probing needs no tombstone */
+static void
+map_remove(NodeMap *map, const NodeKey *key)
+{
+	uint64		i = map_slot(map, key);
+	uint64		j;
+
+	if (!map->used[i])
+		return;
+	map->used[i] = false;
+	map->count--;
+
+	for (j = (i + 1) & (map->capacity - 1); map->used[j]; j = (j + 1) & (map->capacity - 1))
+	{
+		NodeKey		k = map->keys[j];
+		int64		v = map->values[j];
+
+		map->used[j] = false;
+		map->count--;
+		*map_enter(map, &k) = v;
+	}
+}
+
+static DbState *
+get_db(uint32 dbnode)
+{
+	int			i;
+
+	for (i = 0; i < num_dbs; i++)
+	{
+		if (dbs[i].dbnode == dbnode)
+			return &dbs[i];
+	}
+	dbs = realloc(dbs, sizeof(DbState) * (num_dbs + 1));
+	if (dbs == NULL)
+	{
+		fprintf(stderr, "%s: out of memory\n", progname);
+		exit(1);
+	}
+	memset(&dbs[num_dbs], 0, sizeof(DbState));
+	dbs[num_dbs].dbnode = dbnode;
+	return &dbs[num_dbs++];
+}
+
+static int
+cmp_record(const void *a, const void *b)
+{
+	const ReplayRecord *x = (const ReplayRecord *) a;
+	const ReplayRecord *y = (const ReplayRecord *) b;
+
+	if (x->record.timestamp != y->record.timestamp)
+		return x->record.timestamp < y->record.timestamp ? -1 : 1;
+	return x->seq < y->seq ? -1 : (x->seq > y->seq);
+}
+
+/*
+ * Load the records of all the capture files and sort them by time.
+ */
+static ReplayRecord *
+load_captures(char **files, int nfiles, uint64 *nrecords)
+{
+	ReplayRecord *records = NULL;
+	uint64		count = 0;
+	uint64		allocated = 0;
+	int			i;
+
+	for (i = 0; i < nfiles; i++)
+	{
+		FILE	   *f = fopen(files[i], "rb");
+		CaptureFileHeader header;
+		CaptureRecord record;
+
+		if (f == NULL)
+		{
+			fprintf(stderr, "%s: could not open \"%s\": %s\n", progname, files[i], strerror(errno));
+			exit(1);
+		}
+		if (fread(&header, sizeof(header), 1, f) != 1 ||
+			header.magic != CAPTURE_MAGIC || header.version != CAPTURE_VERSION ||
+			header.record_size != sizeof(CaptureRecord))
+		{
+			fprintf(stderr, "%s: \"%s\" is not a capture file of version %d\n",
+					progname, files[i], CAPTURE_VERSION);
+			exit(1);
+		}
+		block_size = header.block_size;
+
+		while (fread(&record, sizeof(record), 1, f) == 1)
+		{
+			if (count == allocated)
+			{
+				allocated = allocated ? allocated * 2 : 1024 * 1024;
+				records = realloc(records, sizeof(ReplayRecord) * allocated);
+				if (records == NULL)
+				{
+					fprintf(stderr, "%s: out of memory\n", progname);
+					exit(1);
+				}
+			}
+			records[count].record = record;
+			records[count].seq = count;
+			count++;
+		}
+		fclose(f);
+	}
+
+	qsort(records, count, sizeof(ReplayRecord), cmp_record);
+	*nrecords = count;
+	return records;
+}
+
+/* true size of all the forks of a relfilenode */
+static int64
+relfilenode_size(const NodeKey *node)
+{
+	NodeKey		key = *node;
+	int64		size = 0;
+	int64	   *blocks;
+
+	for (key.fork = 0; key.fork < NUM_FORKS; key.fork++)
+	{
+		blocks = map_find(&true_sizes, &key);
+		if (blocks)
+			size += *blocks * block_size;
+	}
+	return size;
+}
+
+/*
+ * Apply an event to the true sizes, and report it into the active map as
+ * the smgr hooks do.
+ */
+static void
+apply_event(const CaptureRecord *record, uint64 *dropped)
+{
+	NodeKey		key;
+	DbState    *db = get_db(record->dbnode);
+	int64		before;
+	int64	   *value;
+
+	key.spcnode = record->spcnode;
+	key.dbnode = record->dbnode;
+	key.relnode = record->relnode;
+	key.fork = ALL_FORKS;
+	before = relfilenode_size(&key);
+
+	if (record->op == CAPTURE_OP_UNLINK)
+	{
+		for (key.fork = 0; key.fork < NUM_FORKS; key.fork++)
+			map_remove(&true_sizes, &key);
+	}
+	else if (record->fork >= 0 && record->fork < NUM_FORKS)
+	{
+		key.fork = record->fork;
+		value = map_enter(&true_sizes, &key);
+		if (record->op == CAPTURE_OP_EXTEND && *value < (int64) record->block + 1)
+			*value = (int64) record->block + 1;
+		else if (record->op == CAPTURE_OP_TRUNCATE)
+			*value = record->block;
+	}
+	key.fork = ALL_FORKS;
+	db->true_size += relfilenode_size(&key) - before;
+
+	if (options.quota_mb > 0 && db->crossed_at == 0 &&
+		db->true_size > options.quota_mb * 1024 * 1024)
+		db->crossed_at = record->timestamp;
+
+	/* the shared active table map is full, the event is lost */
+	value = map_find(&active_map, &key);
+	if (value == NULL && active_map.count >= options.max_active_tables)
+	{
+		(*dropped)++;
+		return;
+	}
+	value = map_enter(&active_map, &key);
+	*value = (record->op == CAPTURE_OP_UNLINK);
+}
+
+/*
+ * Refresh the model of every database, as diskquota workers do.
+ */
+static void
+refresh(int64 now, FILE *csv, uint64 *max_drained, uint64 *max_stats, uint64 *total_stats)
+{
+	int			d;
+
+	for (d = 0; d < num_dbs; d++)
+	{
+		DbState    *db = &dbs[d];
+		uint64		drained = 0;
+		uint64		stats = 0;
+		uint64		i;
+
+		for (i = 0; i < active_map.capacity; i++)
+		{
+			NodeKey		key;
+			int64	   *model;
+			int64		size;
+
+			if (!active_map.used[i] || active_map.keys[i].dbnode != db->dbnode)
+				continue;
+
+			key = active_map.keys[i];
+			model = map_enter(&model_sizes, &key);
+			size = relfilenode_size(&key);
+			/* one stat() per segment of each existing fork, plus the missing ones */
+			stats += NUM_FORKS + size / (1024 * 1024 * 1024);
+			db->model_size += size - *model;
+			if (size == 0 && active_map.values[i])
+				map_remove(&model_sizes, &key);
+			else
+				*model = size;
+
+			map_remove(&active_map, &key);
+			drained++;
+			/* backward shift may have moved an entry into this slot */
+			i--;
+		}
+
+		*total_stats += stats;
+		if (stats > *max_stats)
+			*max_stats = stats;
+		if (drained > *max_drained)
+			*max_drained = drained;
+		if (db->true_size - db->model_size > db->max_lag)
+			db->max_lag = db->true_size - db->model_size;
+
+		if (options.quota_mb > 0 && db->crossed_at != 0 && db->detected_at == 0 &&
+			db->model_size > options.quota_mb * 1024 * 1024)
+		{
+			db->detected_at = now;
+			db->overshoot = db->true_size - options.quota_mb * 1024 * 1024;
+		}
+
+		if (csv)
+			fprintf(csv, INT64_FORMAT ",%u," UINT64_FORMAT "," UINT64_FORMAT "," UINT64_FORMAT ","
+					INT64_FORMAT "," INT64_FORMAT "\n",
+					now, db->dbnode, drained, (uint64) active_map.count, stats,
+					db->true_size, db->model_size);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	static struct option long_options[] = {
+		{"naptime", required_argument, NULL, 'n'},
+		{"max-active-tables", required_argument, NULL, 'm'},
+		{"quota-mb", required_argument, NULL, 'q'},
+		{"cycles-csv", required_argument, NULL, 'c'},
+		{"help", no_argument, NULL, '?'},
+		{NULL, 0, NULL, 0}
+	};
+	int			c;
+	int			optindex;
+	ReplayRecord *records;
+	uint64		nrecords;
+	uint64		i;
+	uint64		dropped = 0;
+	uint64		max_active = 0;
+	uint64		max_drained = 0;
+	uint64		cycles = 0;
+	uint64		max_stats = 0;
+	uint64		total_stats = 0;
+	int64		naptime_us;
+	int64		next_refresh;
+	int64		max_lag = 0;
+	int64		max_delay = -1;
+	int64		max_overshoot = 0;
+	struct timeval start,
+				end;
+	double		wall_s;
+	double		span_s = 0;
+	FILE	   *csv = NULL;
+	int			d;
+
+	progname = argv[0];
+	if (argc > 1 && (strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-?") == 0))
+	{
+		usage();
+		exit(0);
+	}
+
+	while ((c = getopt_long(argc, argv, "n:m:q:c:?", long_options, &optindex)) != -1)
+	{
+		switch (c)
+		{
+			case 'n':
+				options.naptime = atof(optarg);
+				break;
+			case 'm':
+				options.max_active_tables = strtoull(optarg, NULL, 10);
+				break;
+			case 'q':
+				options.quota_mb = strtoll(optarg, NULL, 10);
+				break;
+			case 'c':
+				options.cycles_csv = optarg;
+				break;
+			default:
+				fprintf(stderr, "Try \"%s --help\" for more information.\n", progname);
+				exit(1);
+		}
+	}
+	if (optind >= argc || options.naptime <= 0)
+	{
+		fprintf(stderr, "%s: no capture file or invalid naptime\n", progname);
+		fprintf(stderr, "Try \"%s --help\" for more information.\n", progname);
+		exit(1);
+	}
+
+	if (options.cycles_csv)
+	{
+		csv = fopen(options.cycles_csv, "w");
+		if (csv == NULL)
+		{
+			fprintf(stderr, "%s: could not open \"%s\": %s\n", progname, options.cycles_csv, strerror(errno));
+			exit(1);
+		}
+		fprintf(csv, "time_us,dbnode,drained,active_entries,stat_calls,true_size,model_size\n");
+	}
+
+	records = load_captures(&argv[optind], argc - optind, &nrecords);
+
+	map_init(&true_sizes, 1024);
+	map_init(&model_sizes, 1024);
+	map_init(&active_map, 1024);
+
+	gettimeofday(&start, NULL);
+	naptime_us = (int64) (options.naptime * 1000000);
+	next_refresh = nrecords > 0 ? records[0].record.timestamp + naptime_us : 0;
+	for (i = 0; i < nrecords; i++)
+	{
+		while (records[i].record.timestamp >= next_refresh)
+		{
+			refresh(next_refresh, csv, &max_drained, &max_stats, &total_stats);
+			next_refresh += naptime_us;
+			cycles++;
+		}
+		apply_event(&records[i].record, &dropped);
+		if (active_map.count > max_active)
+			max_active = active_map.count;
+	}
+	/* the last refresh after all the events */
+	if (nrecords > 0)
+	{
+		refresh(next_refresh, csv, &max_drained, &max_stats, &total_stats);
+		cycles++;
+		span_s = (records[nrecords - 1].record.timestamp - records[0].record.timestamp) / 1000000.0;
+	}
+	gettimeofday(&end, NULL);
+	wall_s = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+
+	for (d = 0; d < num_dbs; d++)
+	{
+		if (dbs[d].max_lag > max_lag)
+			max_lag = dbs[d].max_lag;
+		if (dbs[d].detected_at != 0 && dbs[d].detected_at - dbs[d].crossed_at > max_delay)
+			max_delay = dbs[d].detected_at - dbs[d].crossed_at;
+		if (dbs[d].overshoot > max_overshoot)
+			max_overshoot = dbs[d].overshoot;
+	}
+
+	printf("{\"files\": %d, \"records\": " UINT64_FORMAT ", \"databases\": %d, "
+		   "\"capture_span_s\": %.3f, \"replay_wall_s\": %.3f, \"speedup\": %.1f, "
+		   "\"naptime_s\": %.3f, \"max_active_tables\": " UINT64_FORMAT ", "
+		   "\"refreshes\": " UINT64_FORMAT ", \"peak_active_entries\": " UINT64_FORMAT ", "
+		   "\"dropped_events\": " UINT64_FORMAT ", \"max_drained_per_refresh\": " UINT64_FORMAT ", "
+		   "\"max_stat_calls_per_refresh\": " UINT64_FORMAT ", \"mean_stat_calls_per_refresh\": %.1f, "
+		   "\"max_model_lag_bytes\": " INT64_FORMAT,
+		   argc - optind, nrecords, num_dbs,
+		   span_s, wall_s, wall_s > 0 ? span_s / wall_s : 0,
+		   options.naptime, options.max_active_tables,
+		   cycles, max_active, dropped, max_drained,
+		   max_stats, cycles > 0 ? (double) total_stats / cycles : 0, max_lag);
+	if (options.quota_mb > 0)
+		printf(", \"quota_mb\": " INT64_FORMAT ", \"max_detect_delay_ms\": %.3f, "
+			   "\"max_overshoot_bytes\": " INT64_FORMAT,
+			   options.quota_mb, max_delay < 0 ? -1.0 : max_delay / 1000.0, max_overshoot);
+	printf("}\n");
+
+	if (csv)
+		fclose(csv);
+	return 0;
+}
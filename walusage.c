@@ -0,0 +1,195 @@
+/* -------------------------------------------------------------------------
+ *
+ * walusage.c
+ *
+ * WAL generation accounting.  WAL is a shared resource as well as disk
+ * space: bulk writes of one schema or role could generate enough WAL to
+ * lag every replica.  When diskquota.wal_accounting is on, the diskquota
+ * worker reads the WAL generated since its last refresh, and attributes
+ * the length of every record to the first relfilenode of current database
+ * the record refers to.  Full page images are part of the record, so they
+ * are accounted as well.  Records without block references, e.g. commit
+ * records, are not attributed to any table.
+ *
+ * The worker starts from the current insert position, history is never
+ * read.  If the WAL to read has been removed, or cannot be decoded, the
+ * bytes in between are lost and reading restarts from the current insert
+ * position.
+ *
+ * Copyright (C) 2013, PostgreSQL Global Development Group
+ *
+ *
+ * -------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/xlog.h"
+#include "access/xlog_internal.h"
+#include "access/xlogreader.h"
+#include "access/xlogutils.h"
+#include "miscadmin.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+
+#include "walusage.h"
+
+bool		diskquota_wal_accounting = false;
+int			diskquota_max_wal_rate = 0;
+
+static XLogReaderState *wal_reader = NULL;
+/* start of the next record to read, invalid if not started */
+static XLogRecPtr wal_read_ptr = InvalidXLogRecPtr;
+
+static XLogRecPtr get_wal_end_ptr(void);
+
+/*
+ * Define GUCs of WAL accounting.
+ */
+void
+init_wal_usage(void)
+{
+	DefineCustomBoolVariable("diskquota.wal_accounting",
+							 "Account the WAL generated by the tables of each schema and role.",
+							 NULL,
+							 &diskquota_wal_accounting,
+							 false,
+							 PGC_SIGHUP,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomIntVariable("diskquota.max_wal_rate",
+							"Max WAL generation rate of a schema or role, in kB per second.",
+							"Schemas and roles generating WAL faster are put into blacklist "
+							"until the next refresh, 0 disables the limit. It requires "
+							"diskquota.wal_accounting.",
+							&diskquota_max_wal_rate,
+							0,
+							0,
+							INT_MAX,
+							PGC_SIGHUP,
+							0,
+							NULL,
+							NULL,
+							NULL);
+}
+
+/*
+ * End of the WAL which could be read without waiting.
+ */
+static XLogRecPtr
+get_wal_end_ptr(void)
+{
+	if (RecoveryInProgress())
+		return GetXLogReplayRecPtr(NULL);
+	return GetFlushRecPtr();
+}
+
+/*
+ * Read the WAL generated since last call, and return the bytes attributed
+ * to each relfilenode of current database in a WalUsageEntry map, which is
+ * allocated in current memory context.  Return NULL in the first call, as
+ * it only takes the start position.
+ */
+HTAB *
+collect_wal_usage(void)
+{
+	HASHCTL		ctl;
+	HTAB	   *wal_usage_map;
+	XLogRecPtr	end_ptr;
+	XLogSegNo	segno;
+
+	if (wal_reader == NULL)
+	{
+		MemoryContext oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+
+		wal_reader = XLogReaderAllocate(wal_segment_size, &read_local_xlog_page, NULL);
+		MemoryContextSwitchTo(oldcontext);
+		if (wal_reader == NULL)
+			ereport(ERROR,
+					(errcode(ERRCODE_OUT_OF_MEMORY),
+					 errmsg("out of memory"),
+					 errdetail("Failed while allocating a WAL reading processor.")));
+	}
+
+	if (wal_read_ptr == InvalidXLogRecPtr)
+	{
+		/* both of them point to the start of the next record */
+		wal_read_ptr = RecoveryInProgress() ? GetXLogReplayRecPtr(NULL) : GetXLogInsertRecPtr();
+		return NULL;
+	}
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(RelFileNode);
+	ctl.entrysize = sizeof(WalUsageEntry);
+	ctl.hcxt = CurrentMemoryContext;
+	ctl.hash = tag_hash;
+
+	wal_usage_map = hash_create("local map of WAL usage of relfilenodes",
+								1024,
+								&ctl,
+								HASH_ELEM | HASH_CONTEXT | HASH_FUNCTION);
+
+	XLByteToSeg(wal_read_ptr, segno, wal_segment_size);
+	if (segno <= XLogGetLastRemovedSegno())
+	{
+		ereport(LOG,
+				(errmsg("[diskquota] WAL to account has been removed, skip to the current position")));
+		wal_read_ptr = InvalidXLogRecPtr;
+		return wal_usage_map;
+	}
+
+	/* records ending after end_ptr are read, read_local_xlog_page() waits for them */
+	end_ptr = get_wal_end_ptr();
+	while (wal_read_ptr < end_ptr)
+	{
+		XLogRecord *record;
+		char	   *errormsg = NULL;
+		int			block_id;
+
+		CHECK_FOR_INTERRUPTS();
+
+		record = XLogReadRecord(wal_reader, wal_read_ptr, &errormsg);
+		if (record == NULL)
+		{
+			ereport(LOG,
+					(errmsg("[diskquota] could not read WAL at %X/%X to account: %s",
+							(uint32) (wal_read_ptr >> 32), (uint32) wal_read_ptr,
+							errormsg ? errormsg : "no record")));
+			wal_read_ptr = InvalidXLogRecPtr;
+			break;
+		}
+		wal_read_ptr = wal_reader->EndRecPtr;
+
+		for (block_id = 0; block_id <= wal_reader->max_block_id; block_id++)
+		{
+			RelFileNode node;
+			WalUsageEntry *entry;
+			bool		found;
+
+			if (!XLogRecGetBlockTag(wal_reader, block_id, &node, NULL, NULL))
+				continue;
+			if (node.dbNode != MyDatabaseId)
+				continue;
+
+			entry = (WalUsageEntry *) hash_search(wal_usage_map, &node, HASH_ENTER, &found);
+			if (!found)
+				entry->bytes = 0;
+			entry->bytes += XLogRecGetTotalLen(wal_reader);
+			break;
+		}
+	}
+
+	return wal_usage_map;
+}
+
+/*
+ * Stop WAL accounting, the next collect_wal_usage() starts from the
+ * current position again.
+ */
+void
+stop_wal_usage(void)
+{
+	wal_read_ptr = InvalidXLogRecPtr;
+}
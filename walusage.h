@@ -0,0 +1,32 @@
+/* -------------------------------------------------------------------------
+ *
+ * walusage.h
+ *
+ * WAL generation accounting of the tables of a monitored database.
+ *
+ * Copyright (C) 2013, PostgreSQL Global Development Group
+ *
+ *
+ * -------------------------------------------------------------------------
+ */
+#ifndef DISKQUOTA_WALUSAGE_H
+#define DISKQUOTA_WALUSAGE_H
+
+#include "storage/relfilenode.h"
+#include "utils/hsearch.h"
+
+/* WAL bytes attributed to a relfilenode since last collection */
+typedef struct WalUsageEntry
+{
+	RelFileNode node;			/* hash table key */
+	int64		bytes;
+} WalUsageEntry;
+
+extern bool diskquota_wal_accounting;
+extern int	diskquota_max_wal_rate;
+
+extern void init_wal_usage(void);
+extern HTAB *collect_wal_usage(void);
+extern void stop_wal_usage(void);
+
+#endif